@@ -5,10 +5,21 @@
 
 #include <ctype.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "sexp_prettify.h"
 
+// Statistics counters (Compiled out with PRETTIFY_SEXPR_NO_STATS)
+#ifndef PRETTIFY_SEXPR_NO_STATS
+#define PRETTIFY_SEXPR_STATS_ADD(state, counter, amount) ((state)->stats ? (void)((state)->stats->counter += (amount)) : (void)0)
+#define PRETTIFY_SEXPR_STATS_MAX(state, counter, value) (((state)->stats && (state)->stats->counter < (value)) ? (void)((state)->stats->counter = (value)) : (void)0)
+#else
+#define PRETTIFY_SEXPR_STATS_ADD(state, counter, amount) ((void)0)
+#define PRETTIFY_SEXPR_STATS_MAX(state, counter, value) ((void)0)
+#endif
+
 bool sexp_prettify_init(struct PrettifySExprState *state, char indent_char, int indent_size, int consecutive_token_wrap_threshold)
 {
     if (indent_char == '\0')
@@ -24,53 +35,549 @@ bool sexp_prettify_init(struct PrettifySExprState *state, char indent_char, int
     state->indent_char = indent_char;
     state->indent_size = indent_size;
     state->consecutive_token_wrap_threshold = consecutive_token_wrap_threshold;
+    state->stats = NULL;
+
+    // Precompute newline plus indentation so line breaks can be emitted as a single slice
+    state->indent_buffer[0] = '\n';
+    memset(&state->indent_buffer[1], indent_char, PRETTIFY_SEXPR_INDENT_BUFFER_SIZE);
 
     return true;
 }
 
-bool sexp_prettify_compact_list_set(struct PrettifySExprState *state, const char **prefixes, int prefixes_entries_count, int column_limit)
+static bool sexp_prettify_prefix_trie_insert(struct PrettifySExprPrefixTrie *trie, const char *prefix, unsigned char match)
 {
-    if (prefixes_entries_count <= 0)
+    unsigned short node = PRETTIFY_SEXPR_PREFIX_TRIE_ROOT;
+
+    for (const unsigned char *c = (const unsigned char *)prefix; *c != '\0'; c++)
     {
-        return false;
+        // Find existing child
+        unsigned short child = (node == PRETTIFY_SEXPR_PREFIX_TRIE_ROOT) ? trie->root_child[*c] : trie->first_child[node];
+        if (node != PRETTIFY_SEXPR_PREFIX_TRIE_ROOT)
+        {
+            while (child && trie->key[child] != *c)
+            {
+                child = trie->next_sibling[child];
+            }
+        }
+
+        if (!child)
+        {
+            // Add new child
+            if (trie->node_count >= PRETTIFY_SEXPR_PREFIX_TRIE_SIZE)
+            {
+                return false;
+            }
+
+            child = trie->node_count++;
+            trie->key[child] = *c;
+
+            if (node == PRETTIFY_SEXPR_PREFIX_TRIE_ROOT)
+            {
+                trie->root_child[*c] = child;
+            }
+            else
+            {
+                trie->next_sibling[child] = trie->first_child[node];
+                trie->first_child[node] = child;
+            }
+        }
+
+        node = child;
+    }
+
+    trie->match[node] |= match;
+    return true;
+}
+
+static bool sexp_prettify_prefix_trie_build(struct PrettifySExprPrefixTrie *trie, const char **compact_list_prefixes, int compact_list_prefixes_entries_count,
+                                            const char **shortform_prefixes, int shortform_prefixes_entries_count)
+{
+    memset(trie, 0, sizeof(*trie));
+    trie->node_count = 1;
+
+    for (int i = 0; i < compact_list_prefixes_entries_count; i++)
+    {
+        if (!sexp_prettify_prefix_trie_insert(trie, compact_list_prefixes[i], PRETTIFY_SEXPR_PREFIX_MATCH_COMPACT_LIST))
+        {
+            return false;
+        }
     }
 
-    for (int i = 0; i < prefixes_entries_count; i++)
+    for (int i = 0; i < shortform_prefixes_entries_count; i++)
     {
-        if (strlen(prefixes[i]) > PRETTIFY_SEXPR_PREFIX_BUFFER_SIZE)
+        if (!sexp_prettify_prefix_trie_insert(trie, shortform_prefixes[i], PRETTIFY_SEXPR_PREFIX_MATCH_SHORTFORM))
         {
             return false;
         }
     }
 
+    return true;
+}
+
+static inline unsigned short sexp_prettify_prefix_trie_next(const struct PrettifySExprPrefixTrie *trie, unsigned short node, const char c)
+{
+    if (node == PRETTIFY_SEXPR_PREFIX_TRIE_ROOT)
+    {
+        const unsigned short child = trie->root_child[(unsigned char)c];
+        return child ? child : PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH;
+    }
+
+    if (node == PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH)
+    {
+        return PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH;
+    }
+
+    for (unsigned short child = trie->first_child[node]; child; child = trie->next_sibling[child])
+    {
+        if (trie->key[child] == (unsigned char)c)
+        {
+            return child;
+        }
+    }
+
+    return PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH;
+}
+
+bool sexp_prettify_compact_list_set(struct PrettifySExprState *state, const char **prefixes, int prefixes_entries_count, int column_limit)
+{
+    struct PrettifySExprPrefixTrie trie;
+
+    if (prefixes_entries_count <= 0)
+    {
+        return false;
+    }
+
+    if (!sexp_prettify_prefix_trie_build(&trie, prefixes, prefixes_entries_count, state->shortform_prefixes, state->shortform_prefixes_entries_count))
+    {
+        return false;
+    }
+
     state->compact_list_prefixes = prefixes;
     state->compact_list_prefixes_entries_count = prefixes_entries_count;
     state->compact_list_column_limit = column_limit;
+    state->prefix_trie = trie;
 
     return true;
 }
 
 bool sexp_prettify_shortform_set(struct PrettifySExprState *state, const char **prefixes, int prefixes_entries_count)
 {
+    struct PrettifySExprPrefixTrie trie;
+
     if (prefixes_entries_count <= 0)
     {
         return false;
     }
 
-    for (int i = 0; i < prefixes_entries_count; i++)
+    if (!sexp_prettify_prefix_trie_build(&trie, state->compact_list_prefixes, state->compact_list_prefixes_entries_count, prefixes, prefixes_entries_count))
     {
-        if (strlen(prefixes[i]) > PRETTIFY_SEXPR_PREFIX_BUFFER_SIZE)
-        {
-            return false;
-        }
+        return false;
     }
 
     state->shortform_prefixes = prefixes;
     state->shortform_prefixes_entries_count = prefixes_entries_count;
+    state->prefix_trie = trie;
+
+    return true;
+}
+
+bool sexp_prettify_stats_set(struct PrettifySExprState *state, struct PrettifySExprStats *stats)
+{
+#ifndef PRETTIFY_SEXPR_NO_STATS
+    state->stats = stats;
+    return true;
+#else
+    state->stats = NULL;
+    return stats == NULL;
+#endif
+}
+
+void sexp_prettify_stats_merge(struct PrettifySExprStats *stats, const struct PrettifySExprStats *other)
+{
+    stats->input_bytes += other->input_bytes;
+    stats->output_bytes += other->output_bytes;
+    stats->lines += other->lines;
+    stats->lists += other->lists;
+    stats->max_depth = stats->max_depth > other->max_depth ? stats->max_depth : other->max_depth;
+    stats->quoted_bytes += other->quoted_bytes;
+    stats->wrapped_tokens += other->wrapped_tokens;
+    stats->compact_list_lines += other->compact_list_lines;
+    stats->shortform_lists += other->shortform_lists;
+}
+
+bool sexp_prettify_sink_init(struct PrettifySExprSink *sink, char *buffer, size_t size, PrettifySExprSinkFlushFunc flush_func, void *flush_func_context)
+{
+    if (!buffer || size == 0 || !flush_func)
+    {
+        return false;
+    }
+
+    sink->buffer = buffer;
+    sink->size = size;
+    sink->count = 0;
+    sink->flush_func = flush_func;
+    sink->flush_func_context = flush_func_context;
 
     return true;
 }
 
+void sexp_prettify_sink_flush(struct PrettifySExprSink *sink)
+{
+    if (sink->count > 0)
+    {
+        sink->flush_func(sink, sink->flush_func_context);
+        sink->count = 0;
+    }
+}
+
+static inline void sexp_prettify_sink_putc(struct PrettifySExprSink *sink, const char c)
+{
+    if (sink->count >= sink->size)
+    {
+        sexp_prettify_sink_flush(sink);
+    }
+
+    sink->buffer[sink->count++] = c;
+}
+
+static inline void sexp_prettify_sink_putn(struct PrettifySExprSink *sink, const char *src, size_t size)
+{
+    while (size > 0)
+    {
+        if (sink->count >= sink->size)
+        {
+            sexp_prettify_sink_flush(sink);
+        }
+
+        size_t space = sink->size - sink->count;
+        size_t chunk = size < space ? size : space;
+        memcpy(sink->buffer + sink->count, src, chunk);
+        sink->count += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+void sexp_prettify_sink_write(struct PrettifySExprSink *sink, const char *src, size_t size) { sexp_prettify_sink_putn(sink, src, size); }
+
+// Emit a line break followed by the indentation for this depth as slices of the precomputed indent buffer
+static inline void sexp_prettify_sink_newline_indent(struct PrettifySExprSink *sink, const struct PrettifySExprState *state, unsigned int depth)
+{
+    size_t indent_count = (size_t)depth * state->indent_size;
+    size_t chunk = indent_count < PRETTIFY_SEXPR_INDENT_BUFFER_SIZE ? indent_count : PRETTIFY_SEXPR_INDENT_BUFFER_SIZE;
+
+    PRETTIFY_SEXPR_STATS_ADD(state, lines, 1);
+    PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1 + indent_count);
+
+    sexp_prettify_sink_putn(sink, state->indent_buffer, 1 + chunk);
+
+    for (indent_count -= chunk; indent_count > 0; indent_count -= chunk)
+    {
+        // Deeper than the indent buffer
+        chunk = indent_count < PRETTIFY_SEXPR_INDENT_BUFFER_SIZE ? indent_count : PRETTIFY_SEXPR_INDENT_BUFFER_SIZE;
+        sexp_prettify_sink_putn(sink, state->indent_buffer + 1, chunk);
+    }
+}
+
+/*
+ * Run Scanners
+ *
+ * Most input bytes are inside long quoted strings, long atoms or whitespace runs where the engine does nothing but copy
+ * (or skip) the byte. These scanners find the end of such a run so it can be handled in one step. Each scanner returns a
+ * pointer to the first byte in [pos, end) that stops the run (or end if there is none).
+ *  - Quoted run : stops on '"' or '\\'
+ *  - Atom run   : stops on '"', '(', ')', whitespace or '\0'
+ *  - Space run  : stops on anything that is not whitespace
+ *
+ * Whitespace matches isspace() in the C locale (' ', '\t', '\n', '\v', '\f', '\r').
+ * An SSE2 baseline is used on x86 with AVX2 and AVX-512 picked at runtime when the CPU supports it.
+ * Define PRETTIFY_SEXPR_NO_SIMD to force the scalar scanners.
+ */
+
+#define PRETTIFY_SEXPR_SCAN_QUOTE_STOP 0x01
+#define PRETTIFY_SEXPR_SCAN_ATOM_STOP 0x02
+#define PRETTIFY_SEXPR_SCAN_SPACE 0x04
+
+static const unsigned char sexp_prettify_scan_class[256] = {
+    ['"'] = PRETTIFY_SEXPR_SCAN_QUOTE_STOP | PRETTIFY_SEXPR_SCAN_ATOM_STOP,
+    ['\\'] = PRETTIFY_SEXPR_SCAN_QUOTE_STOP,
+    ['('] = PRETTIFY_SEXPR_SCAN_ATOM_STOP,
+    [')'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP,
+    ['\0'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP,
+    [' '] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+    ['\t'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+    ['\n'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+    ['\v'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+    ['\f'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+    ['\r'] = PRETTIFY_SEXPR_SCAN_ATOM_STOP | PRETTIFY_SEXPR_SCAN_SPACE,
+};
+
+static const char *sexp_prettify_scan_quoted_scalar(const char *pos, const char *end)
+{
+    while (pos < end && !(sexp_prettify_scan_class[(unsigned char)*pos] & PRETTIFY_SEXPR_SCAN_QUOTE_STOP))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+static const char *sexp_prettify_scan_atom_scalar(const char *pos, const char *end)
+{
+    while (pos < end && !(sexp_prettify_scan_class[(unsigned char)*pos] & PRETTIFY_SEXPR_SCAN_ATOM_STOP))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+static const char *sexp_prettify_scan_space_scalar(const char *pos, const char *end)
+{
+    while (pos < end && (sexp_prettify_scan_class[(unsigned char)*pos] & PRETTIFY_SEXPR_SCAN_SPACE))
+    {
+        pos++;
+    }
+    return pos;
+}
+
+typedef const char *(*PrettifySExprScanFunc)(const char *pos, const char *end);
+
+#if !defined(PRETTIFY_SEXPR_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define PRETTIFY_SEXPR_SIMD_X86 1
+#include <immintrin.h>
+
+// SSE2 (Baseline on x86_64)
+
+static inline __m128i sexp_prettify_sse2_space_mask(__m128i v)
+{
+    // Whitespace is ' ' or the '\t'..'\r' range (Signed compare is fine as bytes >= 0x80 are negative here)
+    const __m128i range = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return _mm_or_si128(range, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static const char *sexp_prettify_scan_quoted_sse2(const char *pos, const char *end)
+{
+    for (; end - pos >= 16; pos += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        const __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_quoted_scalar(pos, end);
+}
+
+static const char *sexp_prettify_scan_atom_sse2(const char *pos, const char *end)
+{
+    for (; end - pos >= 16; pos += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        __m128i hit = sexp_prettify_sse2_space_mask(v);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_atom_scalar(pos, end);
+}
+
+static const char *sexp_prettify_scan_space_sse2(const char *pos, const char *end)
+{
+    for (; end - pos >= 16; pos += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        const unsigned int mask = ~(unsigned int)_mm_movemask_epi8(sexp_prettify_sse2_space_mask(v)) & 0xFFFFu;
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_space_scalar(pos, end);
+}
+
+// AVX2
+
+__attribute__((target("avx2"))) static inline __m256i sexp_prettify_avx2_space_mask(__m256i v)
+{
+    const __m256i range = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    return _mm256_or_si256(range, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2"))) static const char *sexp_prettify_scan_quoted_avx2(const char *pos, const char *end)
+{
+    for (; end - pos >= 32; pos += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        const __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        const unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_quoted_sse2(pos, end);
+}
+
+__attribute__((target("avx2"))) static const char *sexp_prettify_scan_atom_avx2(const char *pos, const char *end)
+{
+    for (; end - pos >= 32; pos += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        __m256i hit = sexp_prettify_avx2_space_mask(v);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        const unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_atom_sse2(pos, end);
+}
+
+__attribute__((target("avx2"))) static const char *sexp_prettify_scan_space_avx2(const char *pos, const char *end)
+{
+    for (; end - pos >= 32; pos += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        const unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(sexp_prettify_avx2_space_mask(v));
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+    return sexp_prettify_scan_space_sse2(pos, end);
+}
+
+// AVX-512 (Needs BW for byte compares)
+
+__attribute__((target("avx512f,avx512bw"))) static inline __mmask64 sexp_prettify_avx512_space_mask(__m512i v)
+{
+    const __mmask64 range = _mm512_cmpgt_epi8_mask(v, _mm512_set1_epi8('\t' - 1)) & _mm512_cmplt_epi8_mask(v, _mm512_set1_epi8('\r' + 1));
+    return range | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' '));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static const char *sexp_prettify_scan_quoted_avx512(const char *pos, const char *end)
+{
+    for (; end - pos >= 64; pos += 64)
+    {
+        const __m512i v = _mm512_loadu_si512((const void *)pos);
+        const __mmask64 mask = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\\'));
+        if (mask)
+        {
+            return pos + __builtin_ctzll(mask);
+        }
+    }
+    return sexp_prettify_scan_quoted_avx2(pos, end);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static const char *sexp_prettify_scan_atom_avx512(const char *pos, const char *end)
+{
+    for (; end - pos >= 64; pos += 64)
+    {
+        const __m512i v = _mm512_loadu_si512((const void *)pos);
+        __mmask64 mask = sexp_prettify_avx512_space_mask(v);
+        mask |= _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"'));
+        mask |= _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('('));
+        mask |= _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(')'));
+        mask |= _mm512_cmpeq_epi8_mask(v, _mm512_setzero_si512());
+        if (mask)
+        {
+            return pos + __builtin_ctzll(mask);
+        }
+    }
+    return sexp_prettify_scan_atom_avx2(pos, end);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static const char *sexp_prettify_scan_space_avx512(const char *pos, const char *end)
+{
+    for (; end - pos >= 64; pos += 64)
+    {
+        const __m512i v = _mm512_loadu_si512((const void *)pos);
+        const __mmask64 mask = ~sexp_prettify_avx512_space_mask(v);
+        if (mask)
+        {
+            return pos + __builtin_ctzll(mask);
+        }
+    }
+    return sexp_prettify_scan_space_avx2(pos, end);
+}
+#endif
+
+struct PrettifySExprScanners
+{
+    PrettifySExprScanFunc quoted;
+    PrettifySExprScanFunc atom;
+    PrettifySExprScanFunc space;
+};
+
+#ifdef PRETTIFY_SEXPR_SIMD_X86
+static const struct PrettifySExprScanners *sexp_prettify_scanners_selected = NULL;
+#endif
+
+static const struct PrettifySExprScanners *sexp_prettify_scanners(void)
+{
+    static const struct PrettifySExprScanners scalar = {sexp_prettify_scan_quoted_scalar, sexp_prettify_scan_atom_scalar, sexp_prettify_scan_space_scalar};
+#ifdef PRETTIFY_SEXPR_SIMD_X86
+    static const struct PrettifySExprScanners sse2 = {sexp_prettify_scan_quoted_sse2, sexp_prettify_scan_atom_sse2, sexp_prettify_scan_space_sse2};
+    static const struct PrettifySExprScanners avx2 = {sexp_prettify_scan_quoted_avx2, sexp_prettify_scan_atom_avx2, sexp_prettify_scan_space_avx2};
+    static const struct PrettifySExprScanners avx512 = {sexp_prettify_scan_quoted_avx512, sexp_prettify_scan_atom_avx512, sexp_prettify_scan_space_avx512};
+
+    // Racing threads all pick the same table. The pointer is accessed atomically so that is not a data race either
+    const struct PrettifySExprScanners *selected = __atomic_load_n(&sexp_prettify_scanners_selected, __ATOMIC_ACQUIRE);
+    if (!selected)
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw"))
+        {
+            selected = &avx512;
+        }
+        else if (__builtin_cpu_supports("avx2"))
+        {
+            selected = &avx2;
+        }
+        else
+        {
+            selected = &sse2;
+        }
+        __atomic_store_n(&sexp_prettify_scanners_selected, selected, __ATOMIC_RELEASE);
+    }
+    (void)scalar;
+    return selected;
+#else
+    return &scalar;
+#endif
+}
+
+// Quoted string and escape tracking for a byte that is inside a quoted string or opens one (Shared with the minify engine)
+static inline void sexp_prettify_quote_track(bool *in_quote, bool *escape_next_char, const char c)
+{
+    if (*escape_next_char)
+    {
+        // Escaped Char
+        *escape_next_char = false;
+    }
+    else if (c == '\\')
+    {
+        // Escape Next Char
+        *escape_next_char = true;
+    }
+    else if (c == '"')
+    {
+        // End of quoted string mode
+        *in_quote = !*in_quote;
+    }
+}
+
 /*
  * Formatting rules (Based on KiCAD S-Expression Style Guide):
  * - All extra (non-indentation) whitespace is trimmed.
@@ -99,7 +606,7 @@ bool sexp_prettify_shortform_set(struct PrettifySExprState *state, const char **
  *     )
  * )
  */
-void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExprPutcFunc output_func, void *output_func_context)
+static inline void sexp_prettify_char(struct PrettifySExprState *state, const char c, struct PrettifySExprSink *sink)
 {
     // Parse quoted string
     if (state->in_quote || c == '"')
@@ -108,30 +615,19 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
         if (state->space_pending)
         {
             // Add space before this quoted string
-            output_func(' ', output_func_context);
+            sexp_prettify_sink_putc(sink, ' ');
             state->column += 1;
             state->space_pending = false;
+            PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
         }
 
-        if (state->escape_next_char)
-        {
-            // Escaped Char
-            state->escape_next_char = false;
-        }
-        else if (c == '\\')
-        {
-            // Escape Next Char
-            state->escape_next_char = true;
-        }
-        else if (c == '"')
-        {
-            // End of quoted string mode
-            state->in_quote = !state->in_quote;
-        }
+        sexp_prettify_quote_track(&state->in_quote, &state->escape_next_char, c);
 
-        output_func(c, output_func_context);
+        sexp_prettify_sink_putc(sink, c);
         state->column += 1;
         state->c_out_prev = c;
+        PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
+        PRETTIFY_SEXPR_STATS_ADD(state, quoted_bytes, 1);
         return;
     }
 
@@ -143,34 +639,21 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
 
         if (state->scanning_for_prefix)
         {
-            state->prefix_buffer[state->prefix_count_in_buffer] = '\0';
+            const unsigned char match = (state->prefix_node != PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH) ? state->prefix_trie.match[state->prefix_node] : 0;
 
             // Check if we got a match against an expected prefix for fixed indent mode
-            if (state->compact_list_prefixes)
+            if (match & PRETTIFY_SEXPR_PREFIX_MATCH_COMPACT_LIST)
             {
-                for (int key_lookup_index = 0; key_lookup_index < state->compact_list_prefixes_entries_count; key_lookup_index++)
-                {
-                    if (strcmp(state->prefix_buffer, state->compact_list_prefixes[key_lookup_index]) == 0)
-                    {
-                        state->compact_list_mode = true;
-                        state->compact_list_indent = state->indent;
-                        break;
-                    }
-                }
+                state->compact_list_mode = true;
+                state->compact_list_indent = state->indent;
             }
 
             // Check if we got a match against an expected prefix for fixed indent mode
-            if (state->shortform_prefixes)
+            if (match & PRETTIFY_SEXPR_PREFIX_MATCH_SHORTFORM)
             {
-                for (int key_lookup_index = 0; key_lookup_index < state->shortform_prefixes_entries_count; key_lookup_index++)
-                {
-                    if (strcmp(state->prefix_buffer, state->shortform_prefixes[key_lookup_index]) == 0)
-                    {
-                        state->shortform_mode = true;
-                        state->shortform_indent = state->indent;
-                        break;
-                    }
-                }
+                state->shortform_mode = true;
+                state->shortform_indent = state->indent;
+                PRETTIFY_SEXPR_STATS_ADD(state, shortform_lists, 1);
             }
 
             state->scanning_for_prefix = false;
@@ -191,58 +674,52 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
             if ((state->column < state->compact_list_column_limit && state->c_out_prev == ')') || state->compact_list_column_limit == 0)
             {
                 // Is a consecutive list and still within column limit (or column limit disabled)
-                output_func(' ', output_func_context);
+                sexp_prettify_sink_putc(sink, ' ');
                 state->column += 1;
                 state->space_pending = false;
+                PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
             }
             else
             {
                 // List is either beyond column limit or not after another list
                 // Move this list to the next line
 
-                output_func('\n', output_func_context);
-                state->column = 0;
-
-                for (unsigned int j = 0; j < (state->compact_list_indent * state->indent_size); ++j)
-                {
-                    output_func(state->indent_char, output_func_context);
-                }
-                state->column += state->compact_list_indent * state->indent_size;
+                sexp_prettify_sink_newline_indent(sink, state, state->compact_list_indent);
+                state->column = state->compact_list_indent * state->indent_size;
+                PRETTIFY_SEXPR_STATS_ADD(state, compact_list_lines, 1);
             }
         }
         else if (state->shortform_mode)
         {
             // In one liner mode
-            output_func(' ', output_func_context);
+            sexp_prettify_sink_putc(sink, ' ');
             state->column += 1;
             state->space_pending = false;
+            PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
         }
         else
         {
             // Start scanning for prefix for special list handling
             state->scanning_for_prefix = true;
-            state->prefix_count_in_buffer = 0;
+            state->prefix_node = PRETTIFY_SEXPR_PREFIX_TRIE_ROOT;
 
             if (state->indent > 0)
             {
-                output_func('\n', output_func_context);
-                state->column = 0;
-
-                for (unsigned int j = 0; j < (state->indent * state->indent_size); ++j)
-                {
-                    output_func(state->indent_char, output_func_context);
-                }
-                state->column += state->indent * state->indent_size;
+                sexp_prettify_sink_newline_indent(sink, state, state->indent);
+                state->column = state->indent * state->indent_size;
             }
         }
 
         state->singular_element = true;
         state->indent++;
 
-        output_func('(', output_func_context);
+        sexp_prettify_sink_putc(sink, '(');
         state->column += 1;
 
         state->c_out_prev = '(';
+        PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
+        PRETTIFY_SEXPR_STATS_ADD(state, lists, 1);
+        PRETTIFY_SEXPR_STATS_MAX(state, max_depth, state->indent);
         return;
     }
 
@@ -275,14 +752,8 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
         if (state->wrapped_list)
         {
             // This was a list with wrapped tokens so is already indented
-            output_func('\n', output_func_context);
-            state->column = 0;
-
-            for (unsigned int j = 0; j < (state->indent * state->indent_size); ++j)
-            {
-                output_func(state->indent_char, output_func_context);
-            }
-            state->column += state->indent * state->indent_size;
+            sexp_prettify_sink_newline_indent(sink, state, state->indent);
+            state->column = state->indent * state->indent_size;
 
             if (state->singular_element)
             {
@@ -303,25 +774,25 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
             else if (!curr_shortform_mode)
             {
                 // End of a parent element
-                output_func('\n', output_func_context);
-                state->column = 0;
-
-                for (unsigned int j = 0; j < (state->indent * state->indent_size); ++j)
-                {
-                    output_func(state->indent_char, output_func_context);
-                }
-                state->column += state->indent * state->indent_size;
+                sexp_prettify_sink_newline_indent(sink, state, state->indent);
+                state->column = state->indent * state->indent_size;
             }
         }
 
-        output_func(')', output_func_context);
+        sexp_prettify_sink_putc(sink, ')');
         state->column += 1;
+        PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
 
         if (state->indent <= 0)
         {
             // Cap Root Element
-            output_func('\n', output_func_context);
+            sexp_prettify_sink_putc(sink, '\n');
             state->column = 0;
+            PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
+            PRETTIFY_SEXPR_STATS_ADD(state, lines, 1);
+
+            // Root element is complete so hand over what we have so far
+            sexp_prettify_sink_flush(sink);
         }
 
         state->c_out_prev = ')';
@@ -338,14 +809,8 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
         {
             // Is Bare token after a list that should be on next line
             // Dev Note: In KiCAD this may indicate a flag bug
-            output_func('\n', output_func_context);
-            state->column = 0;
-
-            for (unsigned int j = 0; j < (state->indent * state->indent_size); ++j)
-            {
-                output_func(state->indent_char, output_func_context);
-            }
-            state->column += state->indent * state->indent_size;
+            sexp_prettify_sink_newline_indent(sink, state, state->indent);
+            state->column = state->indent * state->indent_size;
 
             state->space_pending = false;
         }
@@ -354,42 +819,1310 @@ void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExpr
         {
             // Token is above wrap threshold. Move token to next line (If token wrap threshold is zero then this feature is disabled)
             state->wrapped_list = true;
+            PRETTIFY_SEXPR_STATS_ADD(state, wrapped_tokens, 1);
 
-            output_func('\n', output_func_context);
-            state->column = 0;
-
-            for (unsigned int j = 0; j < (state->indent * state->indent_size); ++j)
-            {
-                output_func(state->indent_char, output_func_context);
-            }
-            state->column += state->indent * state->indent_size;
+            sexp_prettify_sink_newline_indent(sink, state, state->indent);
+            state->column = state->indent * state->indent_size;
 
             state->space_pending = false;
         }
         else if (state->space_pending && state->c_out_prev != '(')
         {
             // Space was pending
-            output_func(' ', output_func_context);
+            sexp_prettify_sink_putc(sink, ' ');
             state->column += 1;
+            PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
 
             state->space_pending = false;
         }
 
-        // Add to prefix scanning buffer if scanning for special list handling detection
+        // Advance prefix matcher if scanning for special list handling detection
         if (state->scanning_for_prefix)
         {
-            if (state->prefix_count_in_buffer < (PRETTIFY_SEXPR_PREFIX_BUFFER_SIZE - 1))
-            {
-                state->prefix_buffer[state->prefix_count_in_buffer] = c;
-                state->prefix_count_in_buffer++;
-            }
+            state->prefix_node = sexp_prettify_prefix_trie_next(&state->prefix_trie, state->prefix_node, c);
         }
 
         // Add character to list
-        output_func(c, output_func_context);
+        sexp_prettify_sink_putc(sink, c);
         state->column += 1;
+        PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, 1);
+
+        state->c_out_prev = c;
+        return;
+    }
+}
+
+// Adapter so the single character and chunk callback apis can share the sink based engine above
+struct PrettifySExprPutcAdapter
+{
+    PrettifySExprPutcFunc output_func;
+    void *output_func_context;
+};
+
+static void sexp_prettify_putc_adapter(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprPutcAdapter *adapter = (struct PrettifySExprPutcAdapter *)context;
+
+    for (size_t i = 0; i < sink->count; i++)
+    {
+        adapter->output_func(sink->buffer[i], adapter->output_func_context);
+    }
+}
+
+struct PrettifySExprWriteAdapter
+{
+    PrettifySExprWriteFunc write_func;
+    void *write_func_context;
+};
+
+static void sexp_prettify_write_adapter(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprWriteAdapter *adapter = (struct PrettifySExprWriteAdapter *)context;
+    adapter->write_func(sink->buffer, sink->count, adapter->write_func_context);
+}
+
+void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExprPutcFunc output_func, void *output_func_context)
+{
+    char buffer[PRETTIFY_SEXPR_PUTC_STAGING_SIZE];
+    struct PrettifySExprPutcAdapter adapter = {output_func, output_func_context};
+    struct PrettifySExprSink sink = {buffer, sizeof(buffer), 0, sexp_prettify_putc_adapter, &adapter};
+
+    PRETTIFY_SEXPR_STATS_ADD(state, input_bytes, 1);
+    sexp_prettify_char(state, c, &sink);
+    sexp_prettify_sink_flush(&sink);
+}
+
+void sexp_prettify_buffer(struct PrettifySExprState *state, const char *src, size_t src_size, PrettifySExprWriteFunc write_func, void *write_func_context)
+{
+    char buffer[PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE];
+    struct PrettifySExprWriteAdapter adapter = {write_func, write_func_context};
+    struct PrettifySExprSink sink = {buffer, sizeof(buffer), 0, sexp_prettify_write_adapter, &adapter};
+
+    sexp_prettify_buffer_to_sink(state, src, src_size, &sink);
+    sexp_prettify_sink_flush(&sink);
+}
+
+// Body of a quoted string that holds no unescaped quote. Copied as is
+static inline void sexp_prettify_quoted_run(struct PrettifySExprState *state, const char *src, size_t size, struct PrettifySExprSink *sink)
+{
+    sexp_prettify_sink_putn(sink, src, size);
+    state->column += size;
+    state->c_out_prev = src[size - 1];
+    PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, size);
+    PRETTIFY_SEXPR_STATS_ADD(state, quoted_bytes, size);
+}
+
+// Continuation of an atom (no space pending and not directly after a list). Copied as is
+static inline void sexp_prettify_atom_run(struct PrettifySExprState *state, const char *src, size_t size, struct PrettifySExprSink *sink)
+{
+    if (state->scanning_for_prefix)
+    {
+        for (size_t i = 0; i < size && state->prefix_node != PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH; i++)
+        {
+            state->prefix_node = sexp_prettify_prefix_trie_next(&state->prefix_trie, state->prefix_node, src[i]);
+        }
+    }
+
+    sexp_prettify_sink_putn(sink, src, size);
+    state->column += size;
+    state->c_out_prev = src[size - 1];
+    PRETTIFY_SEXPR_STATS_ADD(state, output_bytes, size);
+}
+
+// Body of sexp_prettify_buffer_to_sink() (Also used by the other engines, which count their own input)
+static void sexp_prettify_span(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink)
+{
+    const struct PrettifySExprScanners *scan = sexp_prettify_scanners();
+    const char *pos = src;
+    const char *end = src + src_size;
+
+    while (pos < end)
+    {
+        const char *run_end = pos;
 
+        if (state->in_quote)
+        {
+            if (!state->escape_next_char)
+            {
+                // Inside a quoted string. Copy everything up to the next quote or escape
+                run_end = scan->quoted(pos, end);
+                if (run_end != pos)
+                {
+                    sexp_prettify_quoted_run(state, pos, run_end - pos, sink);
+                    pos = run_end;
+                    continue;
+                }
+            }
+        }
+        else if (state->space_pending)
+        {
+            if (!state->scanning_for_prefix)
+            {
+                // Whitespace after whitespace has no further effect
+                run_end = scan->space(pos, end);
+                if (run_end != pos)
+                {
+                    pos = run_end;
+                    continue;
+                }
+            }
+        }
+        else if (state->c_out_prev != ')')
+        {
+            // Continuing an atom. No line breaks or spaces can be inserted here so copy it as is
+            run_end = scan->atom(pos, end);
+            if (run_end != pos)
+            {
+                sexp_prettify_atom_run(state, pos, run_end - pos, sink);
+                pos = run_end;
+                continue;
+            }
+        }
+
+        // Anything that may change the layout goes through the character engine
+        sexp_prettify_char(state, *pos, sink);
+        pos++;
+    }
+}
+
+void sexp_prettify_buffer_to_sink(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink)
+{
+    PRETTIFY_SEXPR_STATS_ADD(state, input_bytes, src_size);
+    sexp_prettify_span(state, src, src_size, sink);
+}
+
+/*
+ * Minify
+ * Keeps exactly the whitespace that changes what prettify does, collapsed into a single space:
+ *  - Before a quoted string or an atom (Spacing and token wrapping)
+ *  - Before '(' after a token, where it ends the list prefix that selects compact list and shortform mode
+ * Whitespace before ')' or between parentheses is dropped, as are '\0' bytes outside of quoted strings.
+ */
+
+// Flags the bytes of an 8 byte word that are below 0x23 (Whitespace, '"', '\0' and some unused control characters)
+// Bytes above the first flagged one may be flagged wrongly, so only the first one is used
+#define PRETTIFY_SEXPR_MINIFY_WORD_STOPS(word) (((word) - 0x2323232323232323ULL) & ~(word) & 0x8080808080808080ULL)
+// Same for the quoted string stops '"' (0x22) and '\\' (0x5C)
+#define PRETTIFY_SEXPR_MINIFY_WORD_HAS_ZERO(word) (((word) - 0x0101010101010101ULL) & ~(word) & 0x8080808080808080ULL)
+#define PRETTIFY_SEXPR_MINIFY_WORD_QUOTE_STOPS(word) (PRETTIFY_SEXPR_MINIFY_WORD_HAS_ZERO((word) ^ 0x2222222222222222ULL) | PRETTIFY_SEXPR_MINIFY_WORD_HAS_ZERO((word) ^ 0x5C5C5C5C5C5C5C5CULL))
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PRETTIFY_SEXPR_MINIFY_FIRST_STOP(stops) ((size_t)__builtin_ctzll(stops) / 8)
+#else
+#define PRETTIFY_SEXPR_MINIFY_FIRST_STOP(stops) ((size_t)0)
+#endif
+
+bool sexp_prettify_minify_init(struct PrettifySExprMinifyState *state)
+{
+    memset(state, 0, sizeof(*state));
+    return true;
+}
+
+// Whitespace run between the previous output byte and c (c is not whitespace). Returns true if a space must be kept
+static inline bool sexp_prettify_minify_keep_space(const char c_out_prev, const char c)
+{
+    const bool after_token = c_out_prev != '(' && c_out_prev != ')' && c_out_prev != '\0';
+    return c != ')' && (c != '(' || after_token);
+}
+
+static inline void sexp_prettify_minify_char(struct PrettifySExprMinifyState *state, const char c, struct PrettifySExprSink *sink)
+{
+    // Parse quoted string
+    if (state->in_quote || c == '"')
+    {
+        if (state->space_pending)
+        {
+            sexp_prettify_sink_putc(sink, ' ');
+            state->space_pending = false;
+        }
+
+        sexp_prettify_quote_track(&state->in_quote, &state->escape_next_char, c);
+
+        sexp_prettify_sink_putc(sink, c);
         state->c_out_prev = c;
         return;
     }
+
+    // Parse space and newlines
+    if (isspace(c))
+    {
+        state->space_pending = true;
+        return;
+    }
+
+    if (c == '\0')
+    {
+        return;
+    }
+
+    if (state->space_pending)
+    {
+        if (sexp_prettify_minify_keep_space(state->c_out_prev, c))
+        {
+            sexp_prettify_sink_putc(sink, ' ');
+        }
+        state->space_pending = false;
+    }
+
+    sexp_prettify_sink_putc(sink, c);
+    state->c_out_prev = c;
+}
+
+/*
+ * Same rules as sexp_prettify_minify_char(), on a span straight into the sink buffer. The output of a chunk is never
+ * longer than its input plus one pending space, so each chunk is sized to the free sink space and written without
+ * bounds checks. Atoms and parentheses are copied 8 bytes at a time up to the next stop byte and quoted strings with
+ * the run scanner. The previous output byte is read back from the sink buffer when a whitespace run needs it.
+ */
+void sexp_prettify_minify_buffer_to_sink(struct PrettifySExprMinifyState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink)
+{
+    const struct PrettifySExprScanners *scan = sexp_prettify_scanners();
+    const char *pos = src;
+    const char *end = src + src_size;
+
+    while (pos < end)
+    {
+        if (sink->size - sink->count < 2)
+        {
+            sexp_prettify_sink_flush(sink);
+        }
+
+        if (sink->size - sink->count < 2)
+        {
+            // Sink too small for the chunked loop
+            sexp_prettify_minify_char(state, *pos, sink);
+            pos++;
+            continue;
+        }
+
+        const size_t free_size = sink->size - sink->count - 1;
+        const char *chunk_end = (size_t)(end - pos) < free_size ? end : pos + free_size;
+        char *out = sink->buffer + sink->count;
+
+        // Kept in locals as writes through out may alias the state
+        bool in_quote = state->in_quote;
+        bool escape_next_char = state->escape_next_char;
+        bool space_pending = state->space_pending;
+
+        while (pos < chunk_end)
+        {
+            if (in_quote)
+            {
+                if (!escape_next_char)
+                {
+                    // Inside a quoted string. Copy everything up to the next quote or escape (Most are short, so check one word before scanning)
+                    const char *run_end = pos;
+                    if (chunk_end - pos >= 8)
+                    {
+                        uint64_t word;
+                        memcpy(&word, pos, 8);
+                        const uint64_t stops = PRETTIFY_SEXPR_MINIFY_WORD_QUOTE_STOPS(word);
+                        run_end = stops ? pos + PRETTIFY_SEXPR_MINIFY_FIRST_STOP(stops) : scan->quoted(pos + 8, chunk_end);
+                    }
+                    else
+                    {
+                        run_end = scan->quoted(pos, chunk_end);
+                    }
+
+                    if (run_end != pos)
+                    {
+                        memcpy(out, pos, run_end - pos);
+                        out += run_end - pos;
+                        pos = run_end;
+                        continue;
+                    }
+                }
+
+                sexp_prettify_quote_track(&in_quote, &escape_next_char, *pos);
+                *out++ = *pos++;
+                continue;
+            }
+
+            // Atoms and parentheses are copied as is (All 8 bytes are stored, but only those before the stop byte are kept)
+            if (!space_pending)
+            {
+                while (chunk_end - pos >= 8)
+                {
+                    uint64_t word;
+                    memcpy(&word, pos, 8);
+                    memcpy(out, pos, 8);
+
+                    const uint64_t stops = PRETTIFY_SEXPR_MINIFY_WORD_STOPS(word);
+                    const size_t copied = stops ? PRETTIFY_SEXPR_MINIFY_FIRST_STOP(stops) : 8;
+                    out += copied;
+                    pos += copied;
+
+                    if (copied < 8)
+                    {
+                        break;
+                    }
+                }
+
+                if (pos >= chunk_end)
+                {
+                    break;
+                }
+            }
+
+            const char c = *pos++;
+
+            if (sexp_prettify_scan_class[(unsigned char)c] & PRETTIFY_SEXPR_SCAN_SPACE)
+            {
+                // Whitespace run (Mostly a newline and its indentation)
+                while (pos < chunk_end && (sexp_prettify_scan_class[(unsigned char)*pos] & PRETTIFY_SEXPR_SCAN_SPACE))
+                {
+                    pos++;
+                }
+                space_pending = true;
+                continue;
+            }
+
+            if (c == '\0')
+            {
+                continue;
+            }
+
+            if (space_pending)
+            {
+                const char c_out_prev = (out > sink->buffer) ? out[-1] : state->c_out_prev;
+                if (sexp_prettify_minify_keep_space(c_out_prev, c))
+                {
+                    *out++ = ' ';
+                }
+                space_pending = false;
+            }
+
+            if (c == '"')
+            {
+                sexp_prettify_quote_track(&in_quote, &escape_next_char, c);
+            }
+
+            *out++ = c;
+        }
+
+        if (out > sink->buffer)
+        {
+            state->c_out_prev = out[-1];
+        }
+        sink->count = out - sink->buffer;
+        state->in_quote = in_quote;
+        state->escape_next_char = escape_next_char;
+        state->space_pending = space_pending;
+    }
+}
+
+/*
+ * Structural Index (Two stage engine)
+ *
+ * Stage 1 classifies 64 byte blocks into bitmasks and records the start offset of every lexeme:
+ *  - '(' and ')' outside of quoted strings
+ *  - Opening and closing quotes (Escapes are resolved from the backslash parity and the inside of quoted strings with a
+ *    prefix xor of the unescaped quotes, as in simdjson)
+ *  - Start of each whitespace run and each atom run
+ * Stage 2 walks these offsets and drives the same rules as sexp_prettify() with quoted string bodies and atoms copied
+ * in bulk. Blocks with constructs the index does not model (backslash or '\0' outside of a quoted string) are formatted
+ * with the byte engine instead.
+ */
+
+struct PrettifySExprIndexMasks
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t open;
+    uint64_t close;
+    uint64_t space;
+    uint64_t nul;
+};
+
+#ifdef PRETTIFY_SEXPR_SIMD_X86
+static void sexp_prettify_index_masks_sse2(const char *block, struct PrettifySExprIndexMasks *masks)
+{
+    memset(masks, 0, sizeof(*masks));
+
+    for (int i = 0; i < 4; i++)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(block + i * 16));
+        const int shift = i * 16;
+
+        masks->quote |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+        masks->backslash |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+        masks->open |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('('))) << shift;
+        masks->close |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(')'))) << shift;
+        masks->space |= (uint64_t)(unsigned int)_mm_movemask_epi8(sexp_prettify_sse2_space_mask(v)) << shift;
+        masks->nul |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) << shift;
+    }
+}
+#define sexp_prettify_index_masks sexp_prettify_index_masks_sse2
+#else
+static void sexp_prettify_index_masks_scalar(const char *block, struct PrettifySExprIndexMasks *masks)
+{
+    memset(masks, 0, sizeof(*masks));
+
+    for (int i = 0; i < 64; i++)
+    {
+        const uint64_t bit = (uint64_t)1 << i;
+        const unsigned char c = (unsigned char)block[i];
+
+        if (c == '"')
+        {
+            masks->quote |= bit;
+        }
+        else if (c == '\\')
+        {
+            masks->backslash |= bit;
+        }
+        else if (c == '(')
+        {
+            masks->open |= bit;
+        }
+        else if (c == ')')
+        {
+            masks->close |= bit;
+        }
+        else if (c == '\0')
+        {
+            masks->nul |= bit;
+        }
+        else if (sexp_prettify_scan_class[c] & PRETTIFY_SEXPR_SCAN_SPACE)
+        {
+            masks->space |= bit;
+        }
+    }
+}
+
+#define sexp_prettify_index_masks sexp_prettify_index_masks_scalar
+#endif
+
+// Bit i set if byte i is escaped by an odd length run of backslashes. escape_carry is set if the next block starts escaped
+static inline uint64_t sexp_prettify_index_escaped(uint64_t backslash, uint64_t *escape_carry)
+{
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~*escape_carry;
+    const uint64_t follows_escape = (backslash << 1) | *escape_carry;
+    const uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+    const uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+    *escape_carry = sequences_starting_on_even_bits < odd_sequence_starts;
+    const uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+static inline uint64_t sexp_prettify_index_prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+bool sexp_prettify_index_init(struct PrettifySExprIndex *index, uint32_t *entries, size_t capacity)
+{
+    if (!entries || capacity < 64)
+    {
+        return false;
+    }
+
+    index->entries = entries;
+    index->capacity = capacity;
+    index->count = 0;
+    index->in_quote = false;
+    index->escape_next_char = false;
+    index->valid = true;
+    return true;
+}
+
+size_t sexp_prettify_index_build(struct PrettifySExprIndex *index, const char *src, size_t src_size)
+{
+    // Every byte may start a lexeme so limit the span to the entry capacity (whole blocks only)
+    const size_t max_size = (index->capacity < UINT32_MAX ? index->capacity : UINT32_MAX) & ~(size_t)63;
+    const size_t size = src_size < max_size ? src_size : max_size;
+
+    uint64_t escape_carry = index->escape_next_char ? 1 : 0;
+    uint64_t quote_carry = index->in_quote ? ~(uint64_t)0 : 0;
+    uint64_t space_carry = 0;
+    uint64_t atom_carry = 0;
+    uint64_t invalid = 0;
+
+    index->count = 0;
+
+    for (size_t base = 0; base < size; base += 64)
+    {
+        struct PrettifySExprIndexMasks masks;
+        uint64_t valid_bits = ~(uint64_t)0;
+        const size_t block_size = size - base;
+
+        if (block_size >= 64)
+        {
+            sexp_prettify_index_masks(src + base, &masks);
+        }
+        else
+        {
+            // Pad the last partial block with whitespace and ignore the padding
+            char block[64];
+            memset(block, ' ', sizeof(block));
+            memcpy(block, src + base, block_size);
+            sexp_prettify_index_masks(block, &masks);
+            valid_bits = ((uint64_t)1 << block_size) - 1;
+        }
+
+        const uint64_t escaped = sexp_prettify_index_escaped(masks.backslash, &escape_carry);
+        const uint64_t quote = masks.quote & ~escaped & valid_bits;
+        const uint64_t in_string = sexp_prettify_index_prefix_xor(quote) ^ quote_carry; // Includes opening quote, excludes closing quote
+        const uint64_t outside = ~in_string & ~quote;
+
+        invalid |= (masks.backslash | masks.nul) & outside & valid_bits;
+
+        const uint64_t space = masks.space & outside;
+        const uint64_t atom = outside & ~(masks.open | masks.close | masks.space | masks.nul);
+        const uint64_t space_start = space & ~((space << 1) | space_carry);
+        const uint64_t atom_start = atom & ~((atom << 1) | atom_carry);
+
+        uint64_t entries = ((masks.open | masks.close) & outside) | space_start | atom_start | quote;
+        entries &= valid_bits;
+
+        while (entries)
+        {
+            index->entries[index->count++] = (uint32_t)(base + __builtin_ctzll(entries));
+            entries &= entries - 1;
+        }
+
+        if (block_size < 64)
+        {
+            // Carry out of the last real byte rather than out of the padding
+            index->in_quote = (in_string >> (block_size - 1)) & 1;
+            index->escape_next_char = index->in_quote && ((escaped >> block_size) & 1);
+            quote_carry = 0;
+            break;
+        }
+
+        quote_carry = (uint64_t)0 - (in_string >> 63);
+        space_carry = space >> 63;
+        atom_carry = atom >> 63;
+        index->in_quote = quote_carry != 0;
+        index->escape_next_char = index->in_quote && escape_carry;
+    }
+
+    index->valid = invalid == 0;
+    return size;
+}
+
+void sexp_prettify_indexed(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, struct PrettifySExprIndex *index)
+{
+    PRETTIFY_SEXPR_STATS_ADD(state, input_bytes, src_size);
+
+    while (src_size > 0)
+    {
+        // Stage 1: Index as much as fits
+        index->in_quote = state->in_quote;
+        index->escape_next_char = state->escape_next_char;
+        const size_t size = sexp_prettify_index_build(index, src, src_size);
+
+        if (!index->valid)
+        {
+            sexp_prettify_span(state, src, size, sink);
+            src += size;
+            src_size -= size;
+            continue;
+        }
+
+        // Stage 2: Layout
+        size_t pos = 0;
+        for (size_t i = 0; i <= index->count; i++)
+        {
+            const size_t next = (i < index->count) ? index->entries[i] : size;
+
+            if (next > pos)
+            {
+                // Bytes before the next lexeme start are the remainder of the current lexeme
+                if (state->in_quote)
+                {
+                    // Any pending escape is consumed by the first byte of the run
+                    sexp_prettify_quoted_run(state, src + pos, next - pos, sink);
+                    state->escape_next_char = false;
+                }
+                else if (sexp_prettify_scan_class[(unsigned char)src[pos]] & PRETTIFY_SEXPR_SCAN_SPACE)
+                {
+                    // Rest of a whitespace run has no further effect
+                }
+                else if (!state->space_pending)
+                {
+                    sexp_prettify_atom_run(state, src + pos, next - pos, sink);
+                }
+                else
+                {
+                    // Space is still pending after an atom that followed "( " so each character may emit a space
+                    sexp_prettify_span(state, src + pos, next - pos, sink);
+                }
+            }
+
+            if (i < index->count)
+            {
+                sexp_prettify_char(state, src[next], sink);
+                pos = next + 1;
+            }
+        }
+
+        if (state->in_quote)
+        {
+            state->escape_next_char = index->escape_next_char;
+        }
+
+        src += size;
+        src_size -= size;
+    }
+}
+
+/*
+ * Canonical Check
+ * Output is compared against the input it was formatted from as each sink buffer is flushed, so nothing is kept beyond
+ * a window of recent input. For canonical input the output never runs more than a byte or so ahead of the input consumed
+ * by the engine, so the window only ever needs to cover the output held in the sink and the span being formatted.
+ */
+struct PrettifySExprCheckContext
+{
+    // window[0..window_count) holds the input starting at input offset window_offset
+    char *window;
+    size_t window_size;
+    size_t window_count;
+    size_t window_offset;
+    PrettifySExprReadFunc read_func;
+    void *read_func_context;
+    bool end_of_input;
+
+    // Input offset of the next byte for the engine and of the next output byte to verify
+    size_t engine_offset;
+    size_t output_offset;
+
+    struct PrettifySExprCheck *result;
+    bool mismatch;
+};
+
+static bool sexp_prettify_check_read(struct PrettifySExprCheckContext *check)
+{
+    if (check->end_of_input || check->window_count >= check->window_size)
+    {
+        return false;
+    }
+
+    const size_t size = check->read_func(check->window + check->window_count, check->window_size - check->window_count, check->read_func_context);
+    if (size == 0)
+    {
+        check->end_of_input = true;
+        return false;
+    }
+
+    check->window_count += size;
+    return true;
+}
+
+static void sexp_prettify_check_verified(struct PrettifySExprCheckContext *check, const char *src, size_t size)
+{
+    for (const char *end = src + size; (src = memchr(src, '\n', end - src)) != NULL; src++)
+    {
+        check->result->line++;
+        check->result->line_offset = check->window_offset + (src - check->window) + 1;
+    }
+}
+
+static void sexp_prettify_check_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprCheckContext *check = (struct PrettifySExprCheckContext *)context;
+
+    if (check->mismatch)
+    {
+        return;
+    }
+
+    // Output may run ahead of what the engine has been given so far
+    while (check->window_offset + check->window_count < check->output_offset + sink->count && sexp_prettify_check_read(check))
+    {
+    }
+
+    const char *expected = check->window + (check->output_offset - check->window_offset);
+    const size_t available = check->window_offset + check->window_count - check->output_offset;
+    const size_t size = sink->count < available ? sink->count : available;
+
+    size_t matched = 0;
+    if (memcmp(expected, sink->buffer, size) == 0)
+    {
+        matched = size;
+    }
+    else
+    {
+        while (expected[matched] == sink->buffer[matched])
+        {
+            matched++;
+        }
+    }
+
+    sexp_prettify_check_verified(check, expected, matched);
+    check->output_offset += matched;
+
+    if (matched < sink->count)
+    {
+        // Differing byte, or output longer than the input (or than the window can hold)
+        check->mismatch = true;
+    }
+}
+
+static void sexp_prettify_check_run(struct PrettifySExprState *state, struct PrettifySExprCheckContext *check)
+{
+    char buffer[PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE];
+    struct PrettifySExprSink sink;
+    sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), sexp_prettify_check_flush, check);
+
+    check->result->line = 1;
+    check->result->line_offset = 0;
+
+    while (!check->mismatch)
+    {
+        if (check->read_func && check->window_count > check->window_size / 2)
+        {
+            // Drop input that is both verified and formatted
+            const size_t keep_offset = check->output_offset < check->engine_offset ? check->output_offset : check->engine_offset;
+            const size_t drop = keep_offset - check->window_offset;
+            memmove(check->window, check->window + drop, check->window_count - drop);
+            check->window_count -= drop;
+            check->window_offset += drop;
+        }
+
+        if (check->engine_offset == check->window_offset + check->window_count && !sexp_prettify_check_read(check))
+        {
+            break;
+        }
+
+        // Reads made by the flush function only append to the window, so this span stays valid while it is formatted
+        size_t size = check->window_offset + check->window_count - check->engine_offset;
+        size = size < PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE ? size : PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE;
+        sexp_prettify_buffer_to_sink(state, check->window + (check->engine_offset - check->window_offset), size, &sink);
+        check->engine_offset += size;
+    }
+
+    sexp_prettify_sink_flush(&sink);
+
+    if (!check->mismatch && (!check->end_of_input || check->output_offset != check->window_offset + check->window_count))
+    {
+        // Output shorter than the input
+        check->mismatch = true;
+    }
+
+    check->result->canonical = !check->mismatch;
+    check->result->offset = check->output_offset;
+    check->result->column = check->output_offset - check->result->line_offset + 1;
+}
+
+bool sexp_prettify_check(struct PrettifySExprState *state, PrettifySExprReadFunc read_func, void *read_func_context, char *window, size_t window_size, struct PrettifySExprCheck *result)
+{
+    if (!read_func || !window || window_size < 4 * PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE)
+    {
+        return false;
+    }
+
+    struct PrettifySExprCheckContext check = {0};
+    check.window = window;
+    check.window_size = window_size;
+    check.read_func = read_func;
+    check.read_func_context = read_func_context;
+    check.result = result;
+    sexp_prettify_check_run(state, &check);
+    return true;
+}
+
+bool sexp_prettify_check_buffer(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprCheck *result)
+{
+    // Whole input is already in the window
+    struct PrettifySExprCheckContext check = {0};
+    check.window = (char *)src;
+    check.window_size = src_size;
+    check.window_count = src_size;
+    check.end_of_input = true;
+    check.result = result;
+    sexp_prettify_check_run(state, &check);
+    return true;
+}
+
+/*
+ * Passthrough
+ * Each sink buffer is compared against the input at the offset where the output is expected to continue. Runs of
+ * matching bytes extend the current match, and a run that ends short of min_span is copied like any other byte. Only
+ * whitespace outside of quoted strings is ever changed by the engine, so on a differing byte the expected offset skips
+ * input whitespace to line up with the next output token again. The match is only a byte comparison, so whatever the
+ * aligning does the spans always hold exactly the engine output.
+ */
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PRETTIFY_SEXPR_PASSTHROUGH_FIRST_DIFFERENCE(x) ((size_t)__builtin_ctzll(x) / 8)
+#endif
+
+static inline size_t sexp_prettify_passthrough_common_prefix(const char *a, const char *b, size_t size)
+{
+    size_t i = 0;
+
+#ifdef PRETTIFY_SEXPR_PASSTHROUGH_FIRST_DIFFERENCE
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word_a;
+        uint64_t word_b;
+        memcpy(&word_a, a + i, 8);
+        memcpy(&word_b, b + i, 8);
+        if (word_a != word_b)
+        {
+            return i + PRETTIFY_SEXPR_PASSTHROUGH_FIRST_DIFFERENCE(word_a ^ word_b);
+        }
+    }
+#endif
+
+    while (i < size && a[i] == b[i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+bool sexp_prettify_passthrough_init(struct PrettifySExprPassthrough *passthrough, struct PrettifySExprSpan *spans, size_t span_capacity, char *literal, size_t literal_size, size_t min_span,
+                                    PrettifySExprPassthroughFlushFunc flush_func, void *flush_func_context)
+{
+    if (!spans || span_capacity == 0 || !literal || literal_size == 0 || !flush_func)
+    {
+        return false;
+    }
+
+    memset(passthrough, 0, sizeof(*passthrough));
+    passthrough->spans = spans;
+    passthrough->span_capacity = span_capacity;
+    passthrough->literal = literal;
+    passthrough->literal_size = literal_size;
+    passthrough->min_span = min_span;
+    passthrough->flush_func = flush_func;
+    passthrough->flush_func_context = flush_func_context;
+    return true;
+}
+
+static void sexp_prettify_passthrough_flush(struct PrettifySExprPassthrough *passthrough)
+{
+    if (passthrough->span_count > 0)
+    {
+        passthrough->flush_func(passthrough, passthrough->flush_func_context);
+        passthrough->span_count = 0;
+        passthrough->literal_count = 0;
+    }
+}
+
+static void sexp_prettify_passthrough_reference(struct PrettifySExprPassthrough *passthrough, const char *data, size_t size)
+{
+    if (passthrough->span_count >= passthrough->span_capacity)
+    {
+        sexp_prettify_passthrough_flush(passthrough);
+    }
+
+    passthrough->spans[passthrough->span_count].data = data;
+    passthrough->spans[passthrough->span_count].size = size;
+    passthrough->span_count++;
+    passthrough->passthrough_bytes += size;
+}
+
+static void sexp_prettify_passthrough_copy(struct PrettifySExprPassthrough *passthrough, const char *src, size_t size)
+{
+    passthrough->copied_bytes += size;
+
+    while (size > 0)
+    {
+        if (passthrough->literal_count >= passthrough->literal_size)
+        {
+            sexp_prettify_passthrough_flush(passthrough);
+        }
+
+        // Grow the last span if it ends right where this copy goes, else a new span is needed
+        char *dst = passthrough->literal + passthrough->literal_count;
+        struct PrettifySExprSpan *last = passthrough->span_count > 0 ? &passthrough->spans[passthrough->span_count - 1] : NULL;
+        if (!last || last->data + last->size != dst)
+        {
+            if (passthrough->span_count >= passthrough->span_capacity)
+            {
+                sexp_prettify_passthrough_flush(passthrough);
+                dst = passthrough->literal;
+            }
+
+            last = &passthrough->spans[passthrough->span_count++];
+            last->data = dst;
+            last->size = 0;
+        }
+
+        const size_t free_size = passthrough->literal_size - passthrough->literal_count;
+        const size_t chunk = size < free_size ? size : free_size;
+        memcpy(dst, src, chunk);
+        passthrough->literal_count += chunk;
+        last->size += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+static void sexp_prettify_passthrough_match_end(struct PrettifySExprPassthrough *passthrough)
+{
+    if (passthrough->match_size == 0)
+    {
+        return;
+    }
+
+    const char *match = passthrough->src + passthrough->match_offset;
+    if (passthrough->match_size >= passthrough->min_span)
+    {
+        sexp_prettify_passthrough_reference(passthrough, match, passthrough->match_size);
+    }
+    else
+    {
+        sexp_prettify_passthrough_copy(passthrough, match, passthrough->match_size);
+    }
+
+    passthrough->match_size = 0;
+}
+
+static void sexp_prettify_passthrough_sink_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprPassthrough *passthrough = (struct PrettifySExprPassthrough *)context;
+    const char *out = sink->buffer;
+    const char *out_end = sink->buffer + sink->count;
+
+    while (out < out_end)
+    {
+        const size_t src_available = passthrough->src_size - passthrough->src_offset;
+        const size_t out_available = out_end - out;
+        const size_t matched = sexp_prettify_passthrough_common_prefix(out, passthrough->src + passthrough->src_offset, out_available < src_available ? out_available : src_available);
+        if (matched > 0)
+        {
+            if (passthrough->match_size == 0)
+            {
+                passthrough->match_offset = passthrough->src_offset;
+            }
+
+            passthrough->match_size += matched;
+            passthrough->src_offset += matched;
+            out += matched;
+            continue;
+        }
+
+        sexp_prettify_passthrough_match_end(passthrough);
+
+        // A token after changed whitespace lines up with the next token of the input
+        if (!isspace((unsigned char)*out))
+        {
+            const char *src_end = passthrough->src + passthrough->src_size;
+            const char *pos = passthrough->src + passthrough->src_offset;
+            while (pos < src_end && (isspace((unsigned char)*pos) || *pos == '\0'))
+            {
+                pos++;
+            }
+
+            if (pos < src_end && *pos == *out)
+            {
+                passthrough->src_offset = pos - passthrough->src;
+                continue;
+            }
+        }
+
+        // Added or changed whitespace (or a token that could not be lined up, which is just copied)
+        const char *run_end = out + 1;
+        while (run_end < out_end && isspace((unsigned char)*run_end))
+        {
+            run_end++;
+        }
+
+        sexp_prettify_passthrough_copy(passthrough, out, run_end - out);
+        out = run_end;
+    }
+}
+
+void sexp_prettify_passthrough(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprPassthrough *passthrough)
+{
+    char buffer[PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE];
+    struct PrettifySExprSink sink;
+    sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), sexp_prettify_passthrough_sink_flush, passthrough);
+
+    passthrough->src = src;
+    passthrough->src_size = src_size;
+    passthrough->src_offset = 0;
+    passthrough->match_size = 0;
+
+    sexp_prettify_buffer_to_sink(state, src, src_size, &sink);
+    sexp_prettify_sink_flush(&sink);
+
+    sexp_prettify_passthrough_match_end(passthrough);
+    sexp_prettify_passthrough_flush(passthrough);
+
+    passthrough->src = NULL;
+}
+
+/*
+ * Incremental Reformat
+ */
+struct PrettifySExprCheckpointRecorder
+{
+    struct PrettifySExprCheckpoints *checkpoints;
+    PrettifySExprSinkFlushFunc flush_func;
+    void *flush_func_context;
+    size_t flushed;
+};
+
+bool sexp_prettify_checkpoints_init(struct PrettifySExprCheckpoints *checkpoints, struct PrettifySExprCheckpoint *entries, size_t capacity)
+{
+    if (!entries || capacity < 2)
+    {
+        return false;
+    }
+
+    checkpoints->entries = entries;
+    checkpoints->capacity = capacity;
+    checkpoints->count = 0;
+    checkpoints->stride = 1;
+    checkpoints->child_count = 0;
+    return true;
+}
+
+// Called for every root child in order. Only every stride-th one is kept
+static void sexp_prettify_checkpoint_add(struct PrettifySExprCheckpoints *checkpoints, const struct PrettifySExprCheckpoint *checkpoint)
+{
+    if (checkpoints->child_count++ % checkpoints->stride != 0)
+    {
+        return;
+    }
+
+    if (checkpoints->count >= checkpoints->capacity)
+    {
+        // Full. Halve the density
+        for (size_t i = 1; 2 * i < checkpoints->count; i++)
+        {
+            checkpoints->entries[i] = checkpoints->entries[2 * i];
+        }
+        checkpoints->count = (checkpoints->count + 1) / 2;
+        checkpoints->stride *= 2;
+    }
+
+    checkpoints->entries[checkpoints->count++] = *checkpoint;
+}
+
+static void sexp_prettify_checkpoint_save(struct PrettifySExprCheckpoint *checkpoint, const struct PrettifySExprState *state)
+{
+    checkpoint->indent = state->indent;
+    checkpoint->column = state->column;
+    checkpoint->c_out_prev = state->c_out_prev;
+    checkpoint->in_quote = state->in_quote;
+    checkpoint->escape_next_char = state->escape_next_char;
+    checkpoint->singular_element = state->singular_element;
+    checkpoint->space_pending = state->space_pending;
+    checkpoint->wrapped_list = state->wrapped_list;
+    checkpoint->scanning_for_prefix = state->scanning_for_prefix;
+    checkpoint->prefix_node = state->prefix_node;
+    checkpoint->compact_list_mode = state->compact_list_mode;
+    checkpoint->compact_list_indent = state->compact_list_indent;
+    checkpoint->shortform_mode = state->shortform_mode;
+    checkpoint->shortform_indent = state->shortform_indent;
+}
+
+static void sexp_prettify_checkpoint_restore(struct PrettifySExprState *state, const struct PrettifySExprCheckpoint *checkpoint)
+{
+    state->indent = checkpoint->indent;
+    state->column = checkpoint->column;
+    state->c_out_prev = checkpoint->c_out_prev;
+    state->in_quote = checkpoint->in_quote;
+    state->escape_next_char = checkpoint->escape_next_char;
+    state->singular_element = checkpoint->singular_element;
+    state->space_pending = checkpoint->space_pending;
+    state->wrapped_list = checkpoint->wrapped_list;
+    state->scanning_for_prefix = checkpoint->scanning_for_prefix;
+    state->prefix_node = checkpoint->prefix_node;
+    state->compact_list_mode = checkpoint->compact_list_mode;
+    state->compact_list_indent = checkpoint->compact_list_indent;
+    state->shortform_mode = checkpoint->shortform_mode;
+    state->shortform_indent = checkpoint->shortform_indent;
+}
+
+// Field by field as memcmp() would also compare the padding bytes
+static bool sexp_prettify_checkpoint_matches(const struct PrettifySExprState *state, const struct PrettifySExprCheckpoint *checkpoint)
+{
+    return state->indent == checkpoint->indent && state->column == checkpoint->column && state->c_out_prev == checkpoint->c_out_prev && state->in_quote == checkpoint->in_quote &&
+           state->escape_next_char == checkpoint->escape_next_char && state->singular_element == checkpoint->singular_element && state->space_pending == checkpoint->space_pending &&
+           state->wrapped_list == checkpoint->wrapped_list && state->scanning_for_prefix == checkpoint->scanning_for_prefix && state->prefix_node == checkpoint->prefix_node &&
+           state->compact_list_mode == checkpoint->compact_list_mode && state->compact_list_indent == checkpoint->compact_list_indent && state->shortform_mode == checkpoint->shortform_mode &&
+           state->shortform_indent == checkpoint->shortform_indent;
+}
+
+static void sexp_prettify_recorder_flush(struct PrettifySExprSink *sink, void *context)
+{
+    // Count the output on its way to the real flush function
+    struct PrettifySExprCheckpointRecorder *recorder = (struct PrettifySExprCheckpointRecorder *)context;
+    recorder->flushed += sink->count;
+    recorder->flush_func(sink, recorder->flush_func_context);
+}
+
+static void sexp_prettify_recorder_attach(struct PrettifySExprCheckpointRecorder *recorder, struct PrettifySExprSink *sink, struct PrettifySExprCheckpoints *checkpoints)
+{
+    recorder->checkpoints = checkpoints;
+    recorder->flush_func = sink->flush_func;
+    recorder->flush_func_context = sink->flush_func_context;
+    recorder->flushed = 0;
+    sink->flush_func = sexp_prettify_recorder_flush;
+    sink->flush_func_context = recorder;
+}
+
+static void sexp_prettify_recorder_detach(struct PrettifySExprCheckpointRecorder *recorder, struct PrettifySExprSink *sink)
+{
+    sink->flush_func = recorder->flush_func;
+    sink->flush_func_context = recorder->flush_func_context;
+}
+
+// Format src (at src_offset of the whole input) stopping before every '(' to record the root children
+static void sexp_prettify_recorder_format(struct PrettifySExprState *state, const char *src, size_t src_size, size_t src_offset, struct PrettifySExprSink *sink, struct PrettifySExprCheckpointRecorder *recorder)
+{
+    size_t pos = 0;
+
+    while (pos < src_size)
+    {
+        const char *open = (const char *)memchr(src + pos, '(', src_size - pos);
+        const size_t next = open ? (size_t)(open - src) : src_size;
+
+        sexp_prettify_buffer_to_sink(state, src + pos, next - pos, sink);
+        if (!open)
+        {
+            break;
+        }
+
+        if (state->indent == 1 && !state->in_quote)
+        {
+            struct PrettifySExprCheckpoint checkpoint;
+            checkpoint.src_offset = src_offset + next;
+            checkpoint.dst_offset = recorder->flushed + sink->count;
+            sexp_prettify_checkpoint_save(&checkpoint, state);
+            sexp_prettify_checkpoint_add(recorder->checkpoints, &checkpoint);
+        }
+
+        PRETTIFY_SEXPR_STATS_ADD(state, input_bytes, 1);
+        sexp_prettify_char(state, '(', sink);
+        pos = next + 1;
+    }
+}
+
+void sexp_prettify_buffer_checkpointed(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, struct PrettifySExprCheckpoints *checkpoints)
+{
+    struct PrettifySExprCheckpointRecorder recorder;
+    sexp_prettify_recorder_attach(&recorder, sink, checkpoints);
+    sexp_prettify_recorder_format(state, src, src_size, 0, sink, &recorder);
+    sexp_prettify_recorder_detach(&recorder, sink);
+}
+
+// Carry over previous checkpoints [first, last) that are past every edit so far, moved by the change in size before them
+static void sexp_prettify_reformat_carry(struct PrettifySExprCheckpoints *checkpoints, const struct PrettifySExprCheckpoints *prev_checkpoints, size_t first, size_t last, size_t src_old_anchor,
+                                         size_t src_new_anchor, size_t dst_old_anchor, size_t dst_new_anchor)
+{
+    for (size_t i = first; i < last; i++)
+    {
+        struct PrettifySExprCheckpoint checkpoint = prev_checkpoints->entries[i];
+        checkpoint.src_offset = checkpoint.src_offset - src_old_anchor + src_new_anchor;
+        checkpoint.dst_offset = checkpoint.dst_offset - dst_old_anchor + dst_new_anchor;
+        sexp_prettify_checkpoint_add(checkpoints, &checkpoint);
+    }
+}
+
+bool sexp_prettify_reformat(const struct PrettifySExprState *config, const char *src, size_t src_size, const char *prev_dst, size_t prev_dst_size, const struct PrettifySExprCheckpoints *prev_checkpoints,
+                            const struct PrettifySExprEdit *edits, size_t edit_count, struct PrettifySExprSink *sink, struct PrettifySExprCheckpoints *checkpoints)
+{
+    for (size_t e = 1; e < edit_count; e++)
+    {
+        if (edits[e].src_offset < edits[e - 1].src_offset + edits[e - 1].src_size)
+        {
+            return false;
+        }
+    }
+
+    const struct PrettifySExprCheckpoint *prev = prev_checkpoints->entries;
+    const size_t prev_count = prev_checkpoints->count;
+
+    checkpoints->count = 0;
+    checkpoints->stride = 1;
+    checkpoints->child_count = 0;
+
+    struct PrettifySExprCheckpointRecorder recorder;
+    sexp_prettify_recorder_attach(&recorder, sink, checkpoints);
+
+    // Previous offsets past the last edit map to new offsets as (offset - old_anchor + new_anchor)
+    size_t src_old_anchor = 0;
+    size_t src_new_anchor = 0;
+    size_t dst_old_anchor = 0;
+    size_t dst_new_anchor = 0;
+
+    size_t carried = 0; // Previous checkpoints before this are carried over or replaced
+    size_t copied = 0;  // Previous output before this is written
+    size_t e = 0;
+
+    while (e < edit_count)
+    {
+        // Resume from the last checkpoint at or before the edit, else from the start
+        size_t first = carried;
+        while (first < prev_count && prev[first].src_offset <= edits[e].src_offset)
+        {
+            first++;
+        }
+
+        struct PrettifySExprState state = *config;
+        size_t src_pos = 0;
+        size_t next = 0;
+        if (first > carried)
+        {
+            const size_t resume = first - 1;
+            sexp_prettify_reformat_carry(checkpoints, prev_checkpoints, carried, resume, src_old_anchor, src_new_anchor, dst_old_anchor, dst_new_anchor);
+            sexp_prettify_sink_write(sink, prev_dst + copied, prev[resume].dst_offset - copied);
+            sexp_prettify_checkpoint_restore(&state, &prev[resume]);
+            src_pos = prev[resume].src_offset - src_old_anchor + src_new_anchor;
+            next = resume + 1;
+        }
+
+        // Format up to the first checkpoint after the edits where the engine state is the same as before
+        while (true)
+        {
+            // Take in every edit before the candidate checkpoint, and move the candidate past them
+            while (e < edit_count && (next >= prev_count || edits[e].src_offset < prev[next].src_offset))
+            {
+                src_new_anchor = edits[e].src_offset - src_old_anchor + src_new_anchor + edits[e].new_size;
+                src_old_anchor = edits[e].src_offset + edits[e].src_size;
+                e++;
+
+                while (next < prev_count && prev[next].src_offset < src_old_anchor)
+                {
+                    next++;
+                }
+            }
+
+            const size_t src_next = next < prev_count ? prev[next].src_offset - src_old_anchor + src_new_anchor : src_size;
+            if (next >= prev_count || src_next > src_size)
+            {
+                // No checkpoint to rejoin. Format to the end
+                sexp_prettify_recorder_format(&state, src + src_pos, src_size - src_pos, src_pos, sink, &recorder);
+                sexp_prettify_recorder_detach(&recorder, sink);
+                return true;
+            }
+
+            sexp_prettify_recorder_format(&state, src + src_pos, src_next - src_pos, src_pos, sink, &recorder);
+            src_pos = src_next;
+
+            if (sexp_prettify_checkpoint_matches(&state, &prev[next]))
+            {
+                dst_old_anchor = prev[next].dst_offset;
+                dst_new_anchor = recorder.flushed + sink->count;
+                copied = prev[next].dst_offset;
+                carried = next;
+                break;
+            }
+
+            next++;
+        }
+    }
+
+    // Unchanged remainder
+    sexp_prettify_reformat_carry(checkpoints, prev_checkpoints, carried, prev_count, src_old_anchor, src_new_anchor, dst_old_anchor, dst_new_anchor);
+    sexp_prettify_sink_write(sink, prev_dst + copied, prev_dst_size - copied);
+    sexp_prettify_recorder_detach(&recorder, sink);
+    return true;
 }
@@ -11,6 +11,8 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Default Suggested Values (Based On KiCADv8)
 #define PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD 72
@@ -18,9 +20,62 @@ extern "C"
 #define PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR '\t'
 #define PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE 1
 
-// The size of this should be larger than the largest prefixes in compact_list_prefixes
+// Maximum number of nodes in the compiled prefix trie (Roughly the total length of all compact list and shortform prefixes)
+#define PRETTIFY_SEXPR_PREFIX_TRIE_SIZE 512
+
+// Deprecated: Prefixes are no longer copied into a buffer while scanning, so this does not limit anything anymore.
+// Kept so code sizing its prefixes with it still compiles. The limit is now PRETTIFY_SEXPR_PREFIX_TRIE_SIZE, shared by all prefixes
 #define PRETTIFY_SEXPR_PREFIX_BUFFER_SIZE 256
 
+// Prefix trie match flags and special nodes
+#define PRETTIFY_SEXPR_PREFIX_MATCH_COMPACT_LIST 0x01
+#define PRETTIFY_SEXPR_PREFIX_MATCH_SHORTFORM 0x02
+#define PRETTIFY_SEXPR_PREFIX_TRIE_ROOT 0
+#define PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH 0xFFFF
+
+// Number of indent characters precomputed for block emission of a newline plus indentation (Deeper levels are emitted in several slices)
+#define PRETTIFY_SEXPR_INDENT_BUFFER_SIZE 256
+
+// Output is collected in a stack buffer of this size and handed to the write callback in chunks by sexp_prettify_buffer()
+#define PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE 4096
+
+// Long quoted strings, atoms and whitespace runs are located with SSE2/AVX2/AVX-512 scanners on x86 (picked at runtime)
+// Define PRETTIFY_SEXPR_NO_SIMD when compiling sexp_prettify.c to only use the portable scalar scanners
+
+// Formatting statistics are collected when a PrettifySExprStats is attached with sexp_prettify_stats_set()
+// Define PRETTIFY_SEXPR_NO_STATS when compiling sexp_prettify.c to compile the counters out entirely
+
+// Small stack buffer used by the single character sexp_prettify() api (Larger output, such as deep indents, is handed over in multiple steps)
+#define PRETTIFY_SEXPR_PUTC_STAGING_SIZE 64
+
+// Compiled Prefix Matcher
+// Built by sexp_prettify_compact_list_set() and sexp_prettify_shortform_set() so the list prefix can be matched one byte
+// at a time while the token streams in. Node 0 is the root and a child or sibling index of 0 means there is none.
+struct PrettifySExprPrefixTrie
+{
+    unsigned short node_count;
+    unsigned short root_child[256];                              ///< Direct lookup of first character
+    unsigned short first_child[PRETTIFY_SEXPR_PREFIX_TRIE_SIZE];  ///< First child of each node
+    unsigned short next_sibling[PRETTIFY_SEXPR_PREFIX_TRIE_SIZE]; ///< Next child of the same parent
+    unsigned char key[PRETTIFY_SEXPR_PREFIX_TRIE_SIZE];           ///< Character leading into this node
+    unsigned char match[PRETTIFY_SEXPR_PREFIX_TRIE_SIZE];         ///< PRETTIFY_SEXPR_PREFIX_MATCH_* flags if a prefix ends at this node
+};
+
+// Formatting Statistics
+// Cheap counters to see why a file is slow or to size buffers ahead of time. Accumulated across calls until cleared
+struct PrettifySExprStats
+{
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+    uint64_t lines;              ///< Line breaks emitted
+    uint64_t lists;              ///< Lists opened
+    unsigned int max_depth;      ///< Deepest list nesting
+    uint64_t quoted_bytes;       ///< Bytes of quoted strings including their quotes
+    uint64_t wrapped_tokens;     ///< Tokens moved to the next line by consecutive_token_wrap_threshold
+    uint64_t compact_list_lines; ///< Lines started by compact list mode once the column limit is reached
+    uint64_t shortform_lists;    ///< Lists kept on one line by shortform mode
+};
+
 // Prettify S-Expr State
 struct PrettifySExprState
 {
@@ -39,6 +94,10 @@ struct PrettifySExprState
     // Settings: Indent
     char indent_char;
     int indent_size;
+    char indent_buffer[1 + PRETTIFY_SEXPR_INDENT_BUFFER_SIZE]; ///< '\n' followed by indent_char repeated. Filled by sexp_prettify_init()
+
+    // Statistics (NULL if not collected)
+    struct PrettifySExprStats *stats;
 
     // Parsing Position Tracking
     unsigned int indent;
@@ -54,8 +113,8 @@ struct PrettifySExprState
 
     // Prefix scanner to check if a list should be specially handled
     bool scanning_for_prefix;
-    int prefix_count_in_buffer;
-    char prefix_buffer[PRETTIFY_SEXPR_PREFIX_BUFFER_SIZE];
+    unsigned short prefix_node; ///< Current prefix trie node or PRETTIFY_SEXPR_PREFIX_TRIE_NO_MATCH
+    struct PrettifySExprPrefixTrie prefix_trie;
 
     // Fixed indent feature to place multiple elements in the same line for compactness
     bool compact_list_mode;
@@ -66,13 +125,215 @@ struct PrettifySExprState
     unsigned int shortform_indent;
 };
 
+// Output Sink
+// The engine stores output directly into the caller provided buffer and only calls flush_func when the buffer is full,
+// when a root list closes or when sexp_prettify_sink_flush() is called. The flush function must consume buffer[0..count)
+// and may point the sink at a fresh buffer (e.g. to batch several buffers into one writev() call).
+struct PrettifySExprSink;
+typedef void (*PrettifySExprSinkFlushFunc)(struct PrettifySExprSink *sink, void *context);
+
+struct PrettifySExprSink
+{
+    char *buffer;
+    size_t size;
+    size_t count;
+    PrettifySExprSinkFlushFunc flush_func;
+    void *flush_func_context;
+};
+
 typedef void (*PrettifySExprPutcFunc)(char c, void *context);
+typedef void (*PrettifySExprWriteFunc)(const char *buffer, size_t size, void *context);
 
 bool sexp_prettify_init(struct PrettifySExprState *state, char indent_char, int indent_size, int consecutive_token_wrap_threshold);
+
+// Compact list and shortform prefixes are compiled into one trie, so both return false once the two prefix sets together
+// need more than PRETTIFY_SEXPR_PREFIX_TRIE_SIZE - 1 nodes (one per character, less the leading characters prefixes share)
 bool sexp_prettify_compact_list_set(struct PrettifySExprState *state, const char **prefixes, int prefixes_entries_count, int column_limit);
 bool sexp_prettify_shortform_set(struct PrettifySExprState *state, const char **prefixes, int prefixes_entries_count);
+
+// Attach counters to a state (NULL to detach). Returns false if the counters are compiled out with PRETTIFY_SEXPR_NO_STATS
+bool sexp_prettify_stats_set(struct PrettifySExprState *state, struct PrettifySExprStats *stats);
+void sexp_prettify_stats_merge(struct PrettifySExprStats *stats, const struct PrettifySExprStats *other);
+
 void sexp_prettify(struct PrettifySExprState *state, const char c, PrettifySExprPutcFunc output_func, void *output_func_context);
 
+// Span variant of sexp_prettify(). Input may be split at any byte boundary across calls and still produce identical output
+void sexp_prettify_buffer(struct PrettifySExprState *state, const char *src, size_t src_size, PrettifySExprWriteFunc write_func, void *write_func_context);
+
+// Sink variant of sexp_prettify_buffer(). Output stays in the sink buffer between calls until flushed
+bool sexp_prettify_sink_init(struct PrettifySExprSink *sink, char *buffer, size_t size, PrettifySExprSinkFlushFunc flush_func, void *flush_func_context);
+void sexp_prettify_sink_flush(struct PrettifySExprSink *sink);
+void sexp_prettify_sink_write(struct PrettifySExprSink *sink, const char *src, size_t size);
+void sexp_prettify_buffer_to_sink(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink);
+
+// Structural Index
+// Start offsets of every lexeme ('(', ')', quotes, whitespace runs and atom runs) of a span. entries is caller provided
+// storage and one span is limited to capacity bytes (rounded down to whole 64 byte blocks).
+struct PrettifySExprIndex
+{
+    uint32_t *entries;
+    size_t capacity;
+    size_t count;
+
+    // Quote state carried into the next span
+    bool in_quote;
+    bool escape_next_char;
+
+    // False if the last span had a backslash or '\0' outside of a quoted string (Not modelled by the index)
+    bool valid;
+};
+
+bool sexp_prettify_index_init(struct PrettifySExprIndex *index, uint32_t *entries, size_t capacity);
+size_t sexp_prettify_index_build(struct PrettifySExprIndex *index, const char *src, size_t src_size);
+
+// Two stage variant of sexp_prettify_buffer_to_sink(). Indexes each span first and then lays it out from the index
+void sexp_prettify_indexed(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, struct PrettifySExprIndex *index);
+
+// Canonical Check
+// Formats the input and compares the output against it while streaming, stopping at the first difference
+struct PrettifySExprCheck
+{
+    bool canonical;
+
+    // First differing input byte (or the input size if the output is longer or shorter). line and column start at 1
+    size_t offset;
+    size_t line;
+    size_t column;
+    size_t line_offset;
+};
+
+// Read up to size bytes of input into buffer. Returns 0 at the end of the input
+typedef size_t (*PrettifySExprReadFunc)(char *buffer, size_t size, void *context);
+
+// window is caller provided storage for recent input and must be at least 4 * PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE bytes
+bool sexp_prettify_check(struct PrettifySExprState *state, PrettifySExprReadFunc read_func, void *read_func_context, char *window, size_t window_size, struct PrettifySExprCheck *result);
+bool sexp_prettify_check_buffer(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprCheck *result);
+
+// Default shortest stretch of unchanged input that is passed through as a span instead of being copied
+#define PRETTIFY_SEXPR_PASSTHROUGH_MIN_SPAN 128
+
+// Passthrough
+// Formats an input that is fully in memory (e.g. mmap) into a list of spans. Stretches of output that match the input
+// byte for byte point into the input, everything else is copied into caller provided literal storage. The spans can
+// then be written with writev() so mostly formatted files go from the page cache to the output without an extra copy.
+struct PrettifySExprSpan
+{
+    const char *data;
+    size_t size;
+};
+
+struct PrettifySExprPassthrough;
+typedef void (*PrettifySExprPassthroughFlushFunc)(struct PrettifySExprPassthrough *passthrough, void *context);
+
+// flush_func is called when spans or literal storage is full and at the end. It must consume spans[0..span_count), both are reused afterwards
+struct PrettifySExprPassthrough
+{
+    struct PrettifySExprSpan *spans;
+    size_t span_capacity;
+    size_t span_count;
+    char *literal;
+    size_t literal_size;
+    size_t literal_count;
+    size_t min_span;
+    PrettifySExprPassthroughFlushFunc flush_func;
+    void *flush_func_context;
+
+    // Output bytes pointing into the input and copied into literal storage. Accumulated across calls
+    uint64_t passthrough_bytes;
+    uint64_t copied_bytes;
+
+    // Input offset where the next output byte is expected (Only used while formatting)
+    const char *src;
+    size_t src_size;
+    size_t src_offset;
+    size_t match_offset;
+    size_t match_size;
+};
+
+bool sexp_prettify_passthrough_init(struct PrettifySExprPassthrough *passthrough, struct PrettifySExprSpan *spans, size_t span_capacity, char *literal, size_t literal_size, size_t min_span,
+                                    PrettifySExprPassthroughFlushFunc flush_func, void *flush_func_context);
+
+// Output is identical to sexp_prettify_buffer_to_sink() on the whole input. src must stay valid until the spans pointing into it are flushed
+void sexp_prettify_passthrough(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprPassthrough *passthrough);
+
+// Incremental Reformat
+// A checkpoint is taken right before each '(' opening a direct child of the root list. Formatting can resume from any
+// checkpoint, and once the engine state matches an old checkpoint again the rest of the old output can be reused as is.
+struct PrettifySExprCheckpoint
+{
+    size_t src_offset; ///< Input offset of the '('
+    size_t dst_offset; ///< Output offset before the '(' was formatted
+
+    // Parsing state of PrettifySExprState before the '('
+    unsigned int indent;
+    unsigned int column;
+    char c_out_prev;
+    bool in_quote;
+    bool escape_next_char;
+    bool singular_element;
+    bool space_pending;
+    bool wrapped_list;
+    bool scanning_for_prefix;
+    unsigned short prefix_node;
+    bool compact_list_mode;
+    unsigned int compact_list_indent;
+    bool shortform_mode;
+    unsigned int shortform_indent;
+};
+
+// entries is caller provided storage. Once full, every other checkpoint is dropped and only every stride-th root child is recorded from then on
+struct PrettifySExprCheckpoints
+{
+    struct PrettifySExprCheckpoint *entries;
+    size_t capacity;
+    size_t count;
+    size_t stride;
+    size_t child_count;
+};
+
+// Replaces src_size bytes at src_offset of the previous input with new_size bytes. Offsets are in previous input coordinates
+struct PrettifySExprEdit
+{
+    size_t src_offset;
+    size_t src_size;
+    size_t new_size;
+};
+
+bool sexp_prettify_checkpoints_init(struct PrettifySExprCheckpoints *checkpoints, struct PrettifySExprCheckpoint *entries, size_t capacity);
+
+// Same as sexp_prettify_buffer_to_sink() while recording checkpoints. The whole input must be given in one call
+void sexp_prettify_buffer_checkpointed(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, struct PrettifySExprCheckpoints *checkpoints);
+
+/*
+ * Reformat an edited input, given the output and checkpoints of the previous input. Only the root children containing
+ * edits are formatted again (more if an edit changes the state the following children start from). The rest of the
+ * output is copied from prev_dst. The result is identical to formatting src from scratch.
+ *
+ * config          : Configured state as it was before formatting the previous input (not modified)
+ * edits           : Sorted and not overlapping
+ * checkpoints     : Receives the checkpoints of the new output (must not be prev_checkpoints)
+ * Returns false if the edits are not sorted or overlap (nothing is written)
+ */
+bool sexp_prettify_reformat(const struct PrettifySExprState *config, const char *src, size_t src_size, const char *prev_dst, size_t prev_dst_size, const struct PrettifySExprCheckpoints *prev_checkpoints,
+                            const struct PrettifySExprEdit *edits, size_t edit_count, struct PrettifySExprSink *sink, struct PrettifySExprCheckpoints *checkpoints);
+
+// Minify
+// Inverse of prettify for storage and transfer. Whitespace outside of quoted strings is dropped where prettify ignores it
+// (around list parentheses) and collapsed into one space where it separates tokens, so prettifying the minified output
+// gives the same result as prettifying the original. The output has no line breaks at all (Not even a trailing newline).
+struct PrettifySExprMinifyState
+{
+    char c_out_prev;
+    bool in_quote;
+    bool escape_next_char;
+    bool space_pending;
+};
+
+bool sexp_prettify_minify_init(struct PrettifySExprMinifyState *state);
+
+// Input may be split at any byte boundary across calls. Output is only flushed when the sink is full, so call sexp_prettify_sink_flush() at the end
+void sexp_prettify_minify_buffer_to_sink(struct PrettifySExprMinifyState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink);
+
 #ifdef __cplusplus
 }
 #endif
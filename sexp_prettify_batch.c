@@ -0,0 +1,1321 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Batch formatting of many files in place on a pool of worker threads.
+// Files are only replaced (atomically via rename()) when the formatted output differs from the original.
+// On Linux the file I/O can instead go through an io_uring per worker thread (raw syscalls, no liburing needed).
+// Note: Unlike sexp_prettify.c this uses the heap, pthreads and the file system.
+
+// statx() for the io_uring backend
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PRETTIFY_SEXPR_BATCH_HAS_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_batch.h"
+
+enum PrettifySExprBatchResult
+{
+    PRETTIFY_SEXPR_BATCH_FAILED,
+    PRETTIFY_SEXPR_BATCH_CHANGED,
+    PRETTIFY_SEXPR_BATCH_UNCHANGED,
+};
+
+struct PrettifySExprBatchWorker
+{
+    struct PrettifySExprBatch *batch;
+    struct PrettifySExprBatchRun *run;
+
+    // Reused for every file this worker formats
+    char *output;
+    uint32_t *index_entries;
+
+    // File being formatted. Output is compared against src while it streams and only goes to a temp file once it differs
+    const char *src;
+    size_t src_size;
+    const char *dst_path;
+    char *temp_path;
+    int temp_fd;
+    size_t output_size;
+    bool changed;
+    const char *error_action;
+    int error;
+
+    // Totals merged into the batch summary once the worker is joined
+    size_t changed_count;
+    size_t unchanged_count;
+    size_t failed_count;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t syscalls;
+    struct PrettifySExprStats stats;
+
+    // io_uring backend
+    bool used_io_uring;
+    uint64_t random; ///< Temp file names
+};
+
+struct PrettifySExprBatchRun
+{
+    pthread_mutex_t lock;
+    size_t next_file;
+    mode_t umask; ///< io_uring backend: Temp files are created with the final mode, so fchmod() is only needed for bits the umask drops
+    uid_t uid;    ///< Owner of new temp files, so fchown() is only needed for originals owned by another user or group
+    gid_t gid;
+};
+
+static pthread_mutex_t sexp_prettify_batch_report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sexp_prettify_batch_report(const char *path, const char *action, int error)
+{
+    // strerror() is not thread safe
+    pthread_mutex_lock(&sexp_prettify_batch_report_lock);
+    fprintf(stderr, "%s: %s: %s\n", path, action, strerror(error));
+    pthread_mutex_unlock(&sexp_prettify_batch_report_lock);
+}
+
+static double sexp_prettify_batch_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+ * Queue
+ */
+bool sexp_prettify_batch_init(struct PrettifySExprBatch *batch, unsigned int thread_count, PrettifySExprBatchSelectFunc select_func, void *select_func_context)
+{
+    if (!select_func)
+    {
+        return false;
+    }
+
+    if (thread_count == 0)
+    {
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpu_count > 0 ? (unsigned int)cpu_count : 1;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+    batch->thread_count = thread_count;
+    batch->select_func = select_func;
+    batch->select_func_context = select_func_context;
+    return true;
+}
+
+void sexp_prettify_batch_free(struct PrettifySExprBatch *batch)
+{
+    for (size_t i = 0; i < batch->file_count; i++)
+    {
+        free(batch->files[i].path);
+    }
+    free(batch->files);
+    batch->files = NULL;
+    batch->file_count = 0;
+    batch->file_capacity = 0;
+}
+
+static void sexp_prettify_batch_queue(struct PrettifySExprBatch *batch, const char *path, const struct PrettifySExprState *config)
+{
+    if (batch->file_count >= batch->file_capacity)
+    {
+        const size_t capacity = batch->file_capacity ? batch->file_capacity * 2 : 256;
+        struct PrettifySExprBatchFile *files = realloc(batch->files, capacity * sizeof(*files));
+        if (!files)
+        {
+            sexp_prettify_batch_report(path, "queue", ENOMEM);
+            batch->failed_count++;
+            return;
+        }
+        batch->files = files;
+        batch->file_capacity = capacity;
+    }
+
+    char *path_copy = strdup(path);
+    if (!path_copy)
+    {
+        sexp_prettify_batch_report(path, "queue", ENOMEM);
+        batch->failed_count++;
+        return;
+    }
+
+    batch->files[batch->file_count].path = path_copy;
+    batch->files[batch->file_count].config = config;
+    batch->file_count++;
+}
+
+static void sexp_prettify_batch_add_directory(struct PrettifySExprBatch *batch, const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+    {
+        sexp_prettify_batch_report(dir_path, "open directory", errno);
+        batch->failed_count++;
+        return;
+    }
+
+    const size_t dir_path_size = strlen(dir_path);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        const size_t name_size = strlen(entry->d_name);
+        char *path = malloc(dir_path_size + 1 + name_size + 1);
+        if (!path)
+        {
+            sexp_prettify_batch_report(dir_path, "walk directory", ENOMEM);
+            batch->failed_count++;
+            break;
+        }
+        memcpy(path, dir_path, dir_path_size);
+        path[dir_path_size] = '/';
+        memcpy(path + dir_path_size + 1, entry->d_name, name_size + 1);
+
+        // Symlinked directories are not followed (Avoids loops) but symlinked files are formatted
+        struct stat path_stat;
+        if (lstat(path, &path_stat) != 0)
+        {
+            sexp_prettify_batch_report(path, "stat", errno);
+            batch->failed_count++;
+        }
+        else if (S_ISDIR(path_stat.st_mode))
+        {
+            sexp_prettify_batch_add_directory(batch, path);
+        }
+        else if (S_ISREG(path_stat.st_mode) || (S_ISLNK(path_stat.st_mode) && stat(path, &path_stat) == 0 && S_ISREG(path_stat.st_mode)))
+        {
+            const struct PrettifySExprState *config = batch->select_func(path, true, batch->select_func_context);
+            if (config)
+            {
+                sexp_prettify_batch_queue(batch, path, config);
+            }
+        }
+
+        free(path);
+    }
+
+    closedir(dir);
+}
+
+void sexp_prettify_batch_add(struct PrettifySExprBatch *batch, const char *path)
+{
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0)
+    {
+        sexp_prettify_batch_report(path, "stat", errno);
+        batch->failed_count++;
+        return;
+    }
+
+    if (S_ISDIR(path_stat.st_mode))
+    {
+        sexp_prettify_batch_add_directory(batch, path);
+        return;
+    }
+
+    const struct PrettifySExprState *config = batch->select_func(path, false, batch->select_func_context);
+    if (!config)
+    {
+        sexp_prettify_batch_report(path, "select profile", EINVAL);
+        batch->failed_count++;
+        return;
+    }
+
+    sexp_prettify_batch_queue(batch, path, config);
+}
+
+void sexp_prettify_batch_add_list(struct PrettifySExprBatch *batch, FILE *list)
+{
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_size;
+
+    while ((line_size = getline(&line, &line_capacity, list)) >= 0)
+    {
+        while (line_size > 0 && (line[line_size - 1] == '\n' || line[line_size - 1] == '\r'))
+        {
+            line[--line_size] = '\0';
+        }
+
+        if (line_size > 0)
+        {
+            sexp_prettify_batch_add(batch, line);
+        }
+    }
+
+    free(line);
+}
+
+/*
+ * Workers
+ */
+static bool sexp_prettify_batch_write_all(int fd, const char *buffer, size_t size, uint64_t *syscalls)
+{
+    while (size > 0)
+    {
+        const ssize_t written = write(fd, buffer, size);
+        (*syscalls)++;
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void sexp_prettify_batch_fail(struct PrettifySExprBatchWorker *worker, const char *action, int error)
+{
+    if (!worker->error_action)
+    {
+        worker->error_action = action;
+        worker->error = error;
+    }
+}
+
+// First difference found. Start the temp file next to the destination (so rename() stays on one file system) with the output that matched so far
+static void sexp_prettify_batch_temp_open(struct PrettifySExprBatchWorker *worker)
+{
+    worker->changed = true;
+
+    const char *dst_name = strrchr(worker->dst_path, '/');
+    const size_t dir_size = dst_name ? (size_t)(dst_name - worker->dst_path) + 1 : 0;
+    dst_name = dst_name ? dst_name + 1 : worker->dst_path;
+
+    worker->temp_path = malloc(dir_size + 1 + strlen(dst_name) + sizeof(".XXXXXX"));
+    if (!worker->temp_path)
+    {
+        sexp_prettify_batch_fail(worker, "create temp file", ENOMEM);
+        return;
+    }
+    sprintf(worker->temp_path, "%.*s.%s.XXXXXX", (int)dir_size, worker->dst_path, dst_name);
+
+    worker->temp_fd = mkstemp(worker->temp_path);
+    worker->syscalls++;
+    if (worker->temp_fd < 0)
+    {
+        sexp_prettify_batch_fail(worker, "create temp file", errno);
+        free(worker->temp_path);
+        worker->temp_path = NULL;
+        return;
+    }
+
+    if (!sexp_prettify_batch_write_all(worker->temp_fd, worker->src, worker->output_size, &worker->syscalls))
+    {
+        sexp_prettify_batch_fail(worker, "write temp file", errno);
+    }
+}
+
+static void sexp_prettify_batch_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprBatchWorker *worker = (struct PrettifySExprBatchWorker *)context;
+
+    if (worker->error_action)
+    {
+        return;
+    }
+
+    if (!worker->changed)
+    {
+        if (worker->src_size - worker->output_size >= sink->count && memcmp(worker->src + worker->output_size, sink->buffer, sink->count) == 0)
+        {
+            worker->output_size += sink->count;
+            return;
+        }
+
+        sexp_prettify_batch_temp_open(worker);
+    }
+
+    if (!worker->error_action && !sexp_prettify_batch_write_all(worker->temp_fd, sink->buffer, sink->count, &worker->syscalls))
+    {
+        sexp_prettify_batch_fail(worker, "write temp file", errno);
+    }
+    worker->output_size += sink->count;
+}
+
+static enum PrettifySExprBatchResult sexp_prettify_batch_format_file(struct PrettifySExprBatchWorker *worker, const struct PrettifySExprBatchFile *file)
+{
+    // Every system call is counted for the summary (Compared against the io_uring backend)
+    int src_fd = open(file->path, O_RDONLY);
+    worker->syscalls += 2;
+    if (src_fd < 0)
+    {
+        sexp_prettify_batch_report(file->path, "open", errno);
+        return PRETTIFY_SEXPR_BATCH_FAILED;
+    }
+
+    struct stat src_stat;
+    if (fstat(src_fd, &src_stat) != 0)
+    {
+        sexp_prettify_batch_report(file->path, "stat", errno);
+        close(src_fd);
+        return PRETTIFY_SEXPR_BATCH_FAILED;
+    }
+
+    if (!S_ISREG(src_stat.st_mode))
+    {
+        sexp_prettify_batch_report(file->path, "not a regular file", EINVAL);
+        close(src_fd);
+        return PRETTIFY_SEXPR_BATCH_FAILED;
+    }
+
+    const size_t src_size = src_stat.st_size;
+    const char *src = "";
+    if (src_size > 0)
+    {
+        void *src_map = mmap(NULL, src_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+        worker->syscalls += 2;
+        if (src_map == MAP_FAILED)
+        {
+            sexp_prettify_batch_report(file->path, "mmap", errno);
+            close(src_fd);
+            return PRETTIFY_SEXPR_BATCH_FAILED;
+        }
+        madvise(src_map, src_size, MADV_SEQUENTIAL);
+        src = (const char *)src_map;
+    }
+    close(src_fd);
+    worker->syscalls += 2;
+
+    // Replace the target of a symlink rather than the link itself
+    struct stat link_stat;
+    char *dst_path = NULL;
+    if (lstat(file->path, &link_stat) == 0 && S_ISLNK(link_stat.st_mode))
+    {
+        dst_path = realpath(file->path, NULL);
+        worker->syscalls++;
+    }
+
+    worker->src = src;
+    worker->src_size = src_size;
+    worker->dst_path = dst_path ? dst_path : file->path;
+    worker->temp_path = NULL;
+    worker->temp_fd = -1;
+    worker->output_size = 0;
+    worker->changed = false;
+    worker->error_action = NULL;
+    worker->error = 0;
+
+    // Format the whole file, comparing each output chunk against the source as it is flushed
+    struct PrettifySExprState state = *file->config;
+    sexp_prettify_stats_set(&state, &worker->stats);
+    struct PrettifySExprSink sink;
+    struct PrettifySExprIndex index;
+    sexp_prettify_sink_init(&sink, worker->output, PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE, sexp_prettify_batch_output_flush, worker);
+    sexp_prettify_index_init(&index, worker->index_entries, PRETTIFY_SEXPR_BATCH_INDEX_ENTRY_COUNT);
+    sexp_prettify_indexed(&state, src, src_size, &sink, &index);
+    sexp_prettify_sink_flush(&sink);
+
+    if (!worker->changed && worker->output_size != src_size)
+    {
+        // Output is a truncated copy of the source
+        sexp_prettify_batch_temp_open(worker);
+    }
+
+    // Swap the temp file in with rename() so readers only ever see the old or the new file. The owner goes first as chown clears
+    // the setuid bits, and the data is synced first so a crash right after the rename can not leave an empty file behind
+    if (worker->changed && !worker->error_action)
+    {
+        const bool chown_needed = src_stat.st_uid != worker->run->uid || src_stat.st_gid != worker->run->gid;
+        worker->syscalls += 4 + chown_needed;
+        if (chown_needed && fchown(worker->temp_fd, src_stat.st_uid, src_stat.st_gid) != 0)
+        {
+            sexp_prettify_batch_fail(worker, "chown temp file", errno);
+        }
+        else if (fchmod(worker->temp_fd, src_stat.st_mode & 07777) != 0)
+        {
+            sexp_prettify_batch_fail(worker, "chmod temp file", errno);
+        }
+        else if (fsync(worker->temp_fd) != 0)
+        {
+            sexp_prettify_batch_fail(worker, "sync temp file", errno);
+        }
+        else if (close(worker->temp_fd) != 0)
+        {
+            sexp_prettify_batch_fail(worker, "write temp file", errno);
+        }
+        else if (rename(worker->temp_path, worker->dst_path) != 0)
+        {
+            sexp_prettify_batch_fail(worker, "rename temp file", errno);
+        }
+        worker->temp_fd = -1;
+    }
+
+    if (worker->error_action)
+    {
+        sexp_prettify_batch_report(file->path, worker->error_action, worker->error);
+        if (worker->temp_fd >= 0)
+        {
+            close(worker->temp_fd);
+            worker->syscalls++;
+        }
+        if (worker->temp_path)
+        {
+            unlink(worker->temp_path);
+            worker->syscalls++;
+        }
+    }
+
+    if (src_size > 0)
+    {
+        munmap((void *)src, src_size);
+        worker->syscalls++;
+    }
+    free(worker->temp_path);
+    free(dst_path);
+
+    if (worker->error_action)
+    {
+        return PRETTIFY_SEXPR_BATCH_FAILED;
+    }
+
+    worker->bytes_in += src_size;
+    worker->bytes_out += worker->output_size;
+    return worker->changed ? PRETTIFY_SEXPR_BATCH_CHANGED : PRETTIFY_SEXPR_BATCH_UNCHANGED;
+}
+
+// Claim the next queued file, or NULL once every file has been claimed
+static const struct PrettifySExprBatchFile *sexp_prettify_batch_next_file(struct PrettifySExprBatchWorker *worker)
+{
+    pthread_mutex_lock(&worker->run->lock);
+    const size_t file_index = worker->run->next_file < worker->batch->file_count ? worker->run->next_file++ : worker->batch->file_count;
+    pthread_mutex_unlock(&worker->run->lock);
+
+    return file_index < worker->batch->file_count ? &worker->batch->files[file_index] : NULL;
+}
+
+static void sexp_prettify_batch_count(struct PrettifySExprBatchWorker *worker, enum PrettifySExprBatchResult result)
+{
+    switch (result)
+    {
+        case PRETTIFY_SEXPR_BATCH_CHANGED:
+            worker->changed_count++;
+            break;
+        case PRETTIFY_SEXPR_BATCH_UNCHANGED:
+            worker->unchanged_count++;
+            break;
+        default:
+            worker->failed_count++;
+            break;
+    }
+}
+
+static void sexp_prettify_batch_worker_files(struct PrettifySExprBatchWorker *worker)
+{
+    const struct PrettifySExprBatchFile *file;
+    while ((file = sexp_prettify_batch_next_file(worker)))
+    {
+        sexp_prettify_batch_count(worker, sexp_prettify_batch_format_file(worker, file));
+    }
+}
+
+/*
+ * io_uring backend
+ * Each worker drives its own ring through raw syscalls and keeps up to PRETTIFY_SEXPR_BATCH_URING_FILES files in flight:
+ *   openat + statx -> read (whole file) -> close while the file is formatted in memory
+ *   -> if the output differs: openat (temp file) -> write, fsync, close and renameat linked into one chain
+ * All of it is submitted with one io_uring_enter() per round of completions instead of a system call per step.
+ * Symlinks and files above PRETTIFY_SEXPR_BATCH_URING_MAX_FILE_SIZE take the thread pool path instead.
+ */
+#ifdef PRETTIFY_SEXPR_BATCH_HAS_URING
+
+struct PrettifySExprBatchUring
+{
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+};
+
+static void sexp_prettify_batch_uring_free(struct PrettifySExprBatchUring *ring, uint64_t *syscalls)
+{
+    if (ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+        (*syscalls)++;
+    }
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+        (*syscalls)++;
+    }
+    if (ring->sq_map != MAP_FAILED)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+        (*syscalls)++;
+    }
+    close(ring->fd);
+    (*syscalls)++;
+}
+
+// Returns false if io_uring is not available (Old kernel, or disabled by sysctl or seccomp)
+static bool sexp_prettify_batch_uring_init(struct PrettifySExprBatchUring *ring, uint64_t *syscalls)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, PRETTIFY_SEXPR_BATCH_URING_ENTRIES, &params);
+    (*syscalls)++;
+    if (ring->fd < 0)
+    {
+        return false;
+    }
+
+    const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (single_map && ring->cq_map_size > ring->sq_map_size)
+    {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single_map ? ring->sq_map : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    *syscalls += single_map ? 2 : 3;
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        sexp_prettify_batch_uring_free(ring, syscalls);
+        return false;
+    }
+
+    char *sq = (char *)ring->sq_map;
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+
+    // Entries are always submitted in order, so the index array never changes
+    unsigned int *sq_array = (unsigned int *)(sq + params.sq_off.array);
+    for (unsigned int i = 0; i < params.sq_entries; i++)
+    {
+        sq_array[i] = i;
+    }
+
+    char *cq = (char *)ring->cq_map;
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Queue a request. The queue can not overflow as each file in flight has at most 4 requests queued (see PRETTIFY_SEXPR_BATCH_URING_ENTRIES)
+// op_flags is the open_flags, statx_flags or rename_flags of the request (They share one union)
+static void sexp_prettify_batch_uring_prep(struct PrettifySExprBatchUring *ring, uint8_t opcode, int fd, const void *addr, uint32_t len, uint64_t off, uint32_t op_flags, uint8_t sqe_flags, uint64_t user_data)
+{
+    const unsigned int tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = sqe_flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->open_flags = op_flags;
+    sqe->user_data = user_data;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submit everything queued and wait for at least one completion
+static bool sexp_prettify_batch_uring_enter(struct PrettifySExprBatchUring *ring, uint64_t *syscalls)
+{
+    while (true)
+    {
+        const unsigned int to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        (*syscalls)++;
+        if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0)
+        {
+            return true;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return false;
+        }
+    }
+}
+
+enum PrettifySExprBatchUringStep
+{
+    PRETTIFY_SEXPR_BATCH_URING_IDLE,
+    PRETTIFY_SEXPR_BATCH_URING_OPEN,      ///< openat and statx of the source
+    PRETTIFY_SEXPR_BATCH_URING_READ,      ///< read of the source
+    PRETTIFY_SEXPR_BATCH_URING_UNCHANGED, ///< close of the source. Output matched it
+    PRETTIFY_SEXPR_BATCH_URING_TEMP_OPEN, ///< close of the source and openat of the temp file. Output differs
+    PRETTIFY_SEXPR_BATCH_URING_REPLACE,   ///< write, fsync, close and renameat of the temp file
+    PRETTIFY_SEXPR_BATCH_URING_CLOSE,     ///< close of the source before giving up or handing the file to the thread pool path
+};
+
+enum PrettifySExprBatchUringOp
+{
+    PRETTIFY_SEXPR_BATCH_URING_OP_OPEN,
+    PRETTIFY_SEXPR_BATCH_URING_OP_STATX,
+    PRETTIFY_SEXPR_BATCH_URING_OP_READ,
+    PRETTIFY_SEXPR_BATCH_URING_OP_CLOSE,
+    PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_OPEN,
+    PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_WRITE,
+    PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_FSYNC,
+    PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_CLOSE,
+    PRETTIFY_SEXPR_BATCH_URING_OP_RENAME,
+    PRETTIFY_SEXPR_BATCH_URING_OP_COUNT,
+};
+
+struct PrettifySExprBatchUringFile
+{
+    struct PrettifySExprBatchWorker *worker;
+    struct PrettifySExprBatchUring *ring;
+    const struct PrettifySExprBatchFile *file;
+    unsigned int slot;
+
+    enum PrettifySExprBatchUringStep step;
+    unsigned int pending;                           ///< Requests not completed yet
+    int results[PRETTIFY_SEXPR_BATCH_URING_OP_COUNT]; ///< Completion result of each request (-errno on error)
+    bool use_thread_pool_path;
+
+    struct statx src_stat;
+    int src_fd;
+    char *src;
+    size_t src_size;
+    size_t src_read;
+
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+    bool output_failed;
+
+    char *temp_path;
+    unsigned int temp_attempts;
+    int temp_fd;
+
+    const char *error_action;
+    int error;
+};
+
+static const uint8_t sexp_prettify_batch_uring_opcodes[PRETTIFY_SEXPR_BATCH_URING_OP_COUNT] = {
+    IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE, IORING_OP_RENAMEAT,
+};
+
+// The completion is routed back by its user_data (entry slot and request)
+static void sexp_prettify_batch_uring_prep_file(struct PrettifySExprBatchUringFile *entry, enum PrettifySExprBatchUringOp op, int fd, const void *addr, uint32_t len, uint64_t off, uint32_t op_flags, uint8_t sqe_flags)
+{
+    entry->pending++;
+    sexp_prettify_batch_uring_prep(entry->ring, sexp_prettify_batch_uring_opcodes[op], fd, addr, len, off, op_flags, sqe_flags, ((uint64_t)entry->slot << 8) | op);
+}
+
+static void sexp_prettify_batch_uring_fail(struct PrettifySExprBatchUringFile *entry, const char *action, int error)
+{
+    if (!entry->error_action)
+    {
+        entry->error_action = action;
+        entry->error = error;
+    }
+}
+
+static void sexp_prettify_batch_uring_finish(struct PrettifySExprBatchUringFile *entry, enum PrettifySExprBatchResult result)
+{
+    struct PrettifySExprBatchWorker *worker = entry->worker;
+
+    if (result == PRETTIFY_SEXPR_BATCH_FAILED)
+    {
+        sexp_prettify_batch_report(entry->file->path, entry->error_action, entry->error);
+    }
+    else
+    {
+        worker->bytes_in += entry->src_size;
+        worker->bytes_out += entry->output_size;
+    }
+
+    sexp_prettify_batch_count(worker, result);
+
+    free(entry->src);
+    free(entry->output);
+    free(entry->temp_path);
+    entry->src = NULL;
+    entry->output = NULL;
+    entry->temp_path = NULL;
+    entry->step = PRETTIFY_SEXPR_BATCH_URING_IDLE;
+}
+
+static void sexp_prettify_batch_uring_start(struct PrettifySExprBatchUringFile *entry, const struct PrettifySExprBatchFile *file)
+{
+    entry->file = file;
+    entry->pending = 0;
+    entry->use_thread_pool_path = false;
+    entry->src_fd = -1;
+    entry->src_size = 0;
+    entry->src_read = 0;
+    entry->output_size = 0;
+    entry->output_failed = false;
+    entry->temp_attempts = 0;
+    entry->temp_fd = -1;
+    entry->error_action = NULL;
+    entry->error = 0;
+
+    // No link is followed here so symlinks can be told apart (They go through the thread pool path)
+    entry->step = PRETTIFY_SEXPR_BATCH_URING_OPEN;
+    sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_OPEN, AT_FDCWD, file->path, 0, 0, O_RDONLY | O_CLOEXEC, 0);
+    sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_STATX, AT_FDCWD, file->path, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE, (uint64_t)(uintptr_t)&entry->src_stat,
+                                        AT_SYMLINK_NOFOLLOW, 0);
+}
+
+static void sexp_prettify_batch_uring_close_source(struct PrettifySExprBatchUringFile *entry, enum PrettifySExprBatchUringStep step)
+{
+    entry->step = step;
+    sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_CLOSE, entry->src_fd, NULL, 0, 0, 0, 0);
+}
+
+static void sexp_prettify_batch_uring_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprBatchUringFile *entry = (struct PrettifySExprBatchUringFile *)context;
+
+    if (entry->output_failed)
+    {
+        return;
+    }
+
+    entry->output_size += sink->count;
+
+    if (entry->output_capacity - entry->output_size < PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE)
+    {
+        const size_t capacity = entry->output_capacity * 2;
+        char *output = realloc(entry->output, capacity);
+        if (!output)
+        {
+            // Finish formatting into the worker buffer. The file is then reported as failed
+            entry->output_failed = true;
+            sink->buffer = entry->worker->output;
+            sink->size = PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE;
+            return;
+        }
+        entry->output = output;
+        entry->output_capacity = capacity;
+    }
+
+    sink->buffer = entry->output + entry->output_size;
+    sink->size = entry->output_capacity - entry->output_size;
+}
+
+// Whole source is in memory, so format it all into a growing output buffer (The write needs it until it completes)
+static bool sexp_prettify_batch_uring_format(struct PrettifySExprBatchUringFile *entry)
+{
+    struct PrettifySExprBatchWorker *worker = entry->worker;
+
+    entry->output_capacity = entry->src_size + entry->src_size / 4 + 2 * PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE;
+    entry->output = malloc(entry->output_capacity);
+    if (!entry->output)
+    {
+        return false;
+    }
+
+    struct PrettifySExprState state = *entry->file->config;
+    sexp_prettify_stats_set(&state, &worker->stats);
+    struct PrettifySExprSink sink;
+    struct PrettifySExprIndex index;
+    sexp_prettify_sink_init(&sink, entry->output, entry->output_capacity, sexp_prettify_batch_uring_output_flush, entry);
+    sexp_prettify_index_init(&index, worker->index_entries, PRETTIFY_SEXPR_BATCH_INDEX_ENTRY_COUNT);
+    sexp_prettify_indexed(&state, entry->src, entry->src_size, &sink, &index);
+    sexp_prettify_sink_flush(&sink);
+
+    return !entry->output_failed;
+}
+
+// Same naming as the mkstemp() template of the thread pool path, with the random part picked here as the open is asynchronous
+static bool sexp_prettify_batch_uring_temp_open(struct PrettifySExprBatchUringFile *entry)
+{
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    const char *dst_path = entry->file->path;
+
+    if (!entry->temp_path)
+    {
+        const char *dst_name = strrchr(dst_path, '/');
+        const size_t dir_size = dst_name ? (size_t)(dst_name - dst_path) + 1 : 0;
+        dst_name = dst_name ? dst_name + 1 : dst_path;
+
+        entry->temp_path = malloc(dir_size + 1 + strlen(dst_name) + sizeof(".XXXXXX"));
+        if (!entry->temp_path)
+        {
+            return false;
+        }
+        sprintf(entry->temp_path, "%.*s.%s.XXXXXX", (int)dir_size, dst_path, dst_name);
+    }
+
+    uint64_t random = entry->worker->random;
+    char *suffix = entry->temp_path + strlen(entry->temp_path) - 6;
+    for (int i = 0; i < 6; i++)
+    {
+        // xorshift64
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        suffix[i] = chars[random % (sizeof(chars) - 1)];
+    }
+    entry->worker->random = random;
+
+    entry->temp_attempts++;
+    entry->step = PRETTIFY_SEXPR_BATCH_URING_TEMP_OPEN;
+    sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_OPEN, AT_FDCWD, entry->temp_path, entry->src_stat.stx_mode & 07777, 0, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0);
+    return true;
+}
+
+// All requests of the current step completed. Move the file on to its next step
+static void sexp_prettify_batch_uring_advance(struct PrettifySExprBatchUringFile *entry)
+{
+    struct PrettifySExprBatchWorker *worker = entry->worker;
+    const int *results = entry->results;
+
+    switch (entry->step)
+    {
+        case PRETTIFY_SEXPR_BATCH_URING_OPEN:
+        {
+            if (results[PRETTIFY_SEXPR_BATCH_URING_OP_OPEN] < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "open", -results[PRETTIFY_SEXPR_BATCH_URING_OP_OPEN]);
+                sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_FAILED);
+                return;
+            }
+
+            entry->src_fd = results[PRETTIFY_SEXPR_BATCH_URING_OP_OPEN];
+            const mode_t mode = entry->src_stat.stx_mode;
+            if (results[PRETTIFY_SEXPR_BATCH_URING_OP_STATX] < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "stat", -results[PRETTIFY_SEXPR_BATCH_URING_OP_STATX]);
+            }
+            else if (S_ISLNK(mode) || entry->src_stat.stx_size > PRETTIFY_SEXPR_BATCH_URING_MAX_FILE_SIZE)
+            {
+                entry->use_thread_pool_path = true;
+            }
+            else if (!S_ISREG(mode))
+            {
+                sexp_prettify_batch_uring_fail(entry, "not a regular file", EINVAL);
+            }
+            else if (!(entry->src = malloc(entry->src_stat.stx_size ? entry->src_stat.stx_size : 1)))
+            {
+                sexp_prettify_batch_uring_fail(entry, "read", ENOMEM);
+            }
+
+            if (entry->error_action || entry->use_thread_pool_path)
+            {
+                sexp_prettify_batch_uring_close_source(entry, PRETTIFY_SEXPR_BATCH_URING_CLOSE);
+                return;
+            }
+
+            entry->src_size = entry->src_stat.stx_size;
+            entry->step = PRETTIFY_SEXPR_BATCH_URING_READ;
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_READ, entry->src_fd, entry->src, entry->src_size, 0, 0, 0);
+            return;
+        }
+
+        case PRETTIFY_SEXPR_BATCH_URING_READ:
+        {
+            const int read_size = results[PRETTIFY_SEXPR_BATCH_URING_OP_READ];
+            if (read_size < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "read", -read_size);
+                sexp_prettify_batch_uring_close_source(entry, PRETTIFY_SEXPR_BATCH_URING_CLOSE);
+                return;
+            }
+
+            entry->src_read += read_size;
+            if (read_size > 0 && entry->src_read < entry->src_size)
+            {
+                // Short read
+                sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_READ, entry->src_fd, entry->src + entry->src_read, entry->src_size - entry->src_read, entry->src_read, 0, 0);
+                return;
+            }
+
+            // Format while the source closes (Files that shrank since the statx are formatted as read)
+            entry->src_size = entry->src_read;
+            entry->step = PRETTIFY_SEXPR_BATCH_URING_UNCHANGED;
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_CLOSE, entry->src_fd, NULL, 0, 0, 0, 0);
+
+            if (!sexp_prettify_batch_uring_format(entry))
+            {
+                sexp_prettify_batch_uring_fail(entry, "format", ENOMEM);
+                entry->step = PRETTIFY_SEXPR_BATCH_URING_CLOSE;
+            }
+            else if (entry->output_size != entry->src_size || memcmp(entry->output, entry->src, entry->src_size) != 0)
+            {
+                if (!sexp_prettify_batch_uring_temp_open(entry))
+                {
+                    sexp_prettify_batch_uring_fail(entry, "create temp file", ENOMEM);
+                    entry->step = PRETTIFY_SEXPR_BATCH_URING_CLOSE;
+                }
+            }
+            return;
+        }
+
+        case PRETTIFY_SEXPR_BATCH_URING_UNCHANGED:
+        {
+            sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_UNCHANGED);
+            return;
+        }
+
+        case PRETTIFY_SEXPR_BATCH_URING_TEMP_OPEN:
+        {
+            const int temp_fd = results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_OPEN];
+            if (temp_fd == -EEXIST && entry->temp_attempts < 100)
+            {
+                sexp_prettify_batch_uring_temp_open(entry);
+                return;
+            }
+
+            if (temp_fd < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "create temp file", -temp_fd);
+                sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_FAILED);
+                return;
+            }
+            entry->temp_fd = temp_fd;
+
+            // Only needed when the original belongs to another user or group, or the umask dropped some of its permission bits.
+            // The owner goes first as chown clears the setuid bits
+            const uid_t uid = entry->src_stat.stx_uid;
+            const gid_t gid = entry->src_stat.stx_gid;
+            const mode_t mode = entry->src_stat.stx_mode & 07777;
+            const bool chown_needed = uid != worker->run->uid || gid != worker->run->gid;
+            const bool chmod_needed = chown_needed || (mode & worker->run->umask) != 0;
+            worker->syscalls += chown_needed + chmod_needed;
+            if (chown_needed && fchown(temp_fd, uid, gid) != 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "chown temp file", errno);
+            }
+            else if (chmod_needed && fchmod(temp_fd, mode) != 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "chmod temp file", errno);
+            }
+
+            if (entry->error_action)
+            {
+                close(temp_fd);
+                unlink(entry->temp_path);
+                worker->syscalls += 2;
+                sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_FAILED);
+                return;
+            }
+
+            // Linked so the rest only runs once the previous request fully succeeded (A short write cancels them all).
+            // The data is synced before the rename so a crash right after it can not leave an empty file behind
+            entry->results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_FSYNC] = -ECANCELED;
+            entry->results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_CLOSE] = -ECANCELED;
+            entry->results[PRETTIFY_SEXPR_BATCH_URING_OP_RENAME] = -ECANCELED;
+            entry->step = PRETTIFY_SEXPR_BATCH_URING_REPLACE;
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_WRITE, temp_fd, entry->output, entry->output_size, 0, 0, IOSQE_IO_LINK);
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_FSYNC, temp_fd, NULL, 0, 0, 0, IOSQE_IO_LINK);
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_CLOSE, temp_fd, NULL, 0, 0, 0, IOSQE_IO_LINK);
+            sexp_prettify_batch_uring_prep_file(entry, PRETTIFY_SEXPR_BATCH_URING_OP_RENAME, AT_FDCWD, entry->temp_path, AT_FDCWD, (uint64_t)(uintptr_t)entry->file->path, 0, 0);
+            return;
+        }
+
+        case PRETTIFY_SEXPR_BATCH_URING_REPLACE:
+        {
+            const int written = results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_WRITE];
+            const int fsync_result = results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_FSYNC];
+            const int close_result = results[PRETTIFY_SEXPR_BATCH_URING_OP_TEMP_CLOSE];
+            const int rename_result = results[PRETTIFY_SEXPR_BATCH_URING_OP_RENAME];
+
+            if (written < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "write temp file", -written);
+            }
+            else if ((size_t)written != entry->output_size)
+            {
+                sexp_prettify_batch_uring_fail(entry, "write temp file", ENOSPC);
+            }
+            else if (fsync_result < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "sync temp file", -fsync_result);
+            }
+            else if (close_result < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "write temp file", -close_result);
+            }
+            else if (rename_result < 0)
+            {
+                sexp_prettify_batch_uring_fail(entry, "rename temp file", -rename_result);
+            }
+
+            if (!entry->error_action)
+            {
+                sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_CHANGED);
+                return;
+            }
+
+            if (close_result == -ECANCELED)
+            {
+                close(entry->temp_fd);
+                worker->syscalls++;
+            }
+            unlink(entry->temp_path);
+            worker->syscalls++;
+            sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_FAILED);
+            return;
+        }
+
+        case PRETTIFY_SEXPR_BATCH_URING_CLOSE:
+        {
+            if (entry->use_thread_pool_path)
+            {
+                entry->step = PRETTIFY_SEXPR_BATCH_URING_IDLE;
+                sexp_prettify_batch_count(worker, sexp_prettify_batch_format_file(worker, entry->file));
+                return;
+            }
+            sexp_prettify_batch_uring_finish(entry, PRETTIFY_SEXPR_BATCH_FAILED);
+            return;
+        }
+
+        default:
+            return;
+    }
+}
+
+// Returns false if io_uring is not available, before any file was claimed
+static bool sexp_prettify_batch_uring_worker_files(struct PrettifySExprBatchWorker *worker)
+{
+    struct PrettifySExprBatchUring ring;
+    if (!sexp_prettify_batch_uring_init(&ring, &worker->syscalls))
+    {
+        return false;
+    }
+
+    struct PrettifySExprBatchUringFile *entries = calloc(PRETTIFY_SEXPR_BATCH_URING_FILES, sizeof(*entries));
+    if (!entries)
+    {
+        sexp_prettify_batch_uring_free(&ring, &worker->syscalls);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < PRETTIFY_SEXPR_BATCH_URING_FILES; i++)
+    {
+        entries[i].worker = worker;
+        entries[i].ring = &ring;
+        entries[i].slot = i;
+    }
+
+    bool files_left = true;
+    while (true)
+    {
+        unsigned int active = 0;
+        for (unsigned int i = 0; i < PRETTIFY_SEXPR_BATCH_URING_FILES; i++)
+        {
+            if (entries[i].step == PRETTIFY_SEXPR_BATCH_URING_IDLE && files_left)
+            {
+                const struct PrettifySExprBatchFile *file = sexp_prettify_batch_next_file(worker);
+                files_left = file != NULL;
+                if (file)
+                {
+                    sexp_prettify_batch_uring_start(&entries[i], file);
+                }
+            }
+            active += entries[i].step != PRETTIFY_SEXPR_BATCH_URING_IDLE;
+        }
+
+        if (active == 0)
+        {
+            break;
+        }
+
+        if (!sexp_prettify_batch_uring_enter(&ring, &worker->syscalls))
+        {
+            // The kernel may still own the buffers of the files in flight, so they are left allocated and the ring open.
+            // Files not claimed yet go through the thread pool path
+            const int error = errno;
+            for (unsigned int i = 0; i < PRETTIFY_SEXPR_BATCH_URING_FILES; i++)
+            {
+                if (entries[i].step != PRETTIFY_SEXPR_BATCH_URING_IDLE)
+                {
+                    sexp_prettify_batch_report(entries[i].file->path, "io_uring_enter", error);
+                    worker->failed_count++;
+                }
+            }
+            worker->used_io_uring = true;
+            sexp_prettify_batch_worker_files(worker);
+            return true;
+        }
+
+        unsigned int head = *ring.cq_head;
+        const unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+            struct PrettifySExprBatchUringFile *entry = &entries[cqe->user_data >> 8];
+            entry->results[cqe->user_data & 0xff] = cqe->res;
+            if (--entry->pending == 0)
+            {
+                sexp_prettify_batch_uring_advance(entry);
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(entries);
+    sexp_prettify_batch_uring_free(&ring, &worker->syscalls);
+    worker->used_io_uring = true;
+    return true;
+}
+
+#endif
+
+static void *sexp_prettify_batch_worker(void *context)
+{
+    struct PrettifySExprBatchWorker *worker = (struct PrettifySExprBatchWorker *)context;
+
+#ifdef PRETTIFY_SEXPR_BATCH_HAS_URING
+    if (worker->batch->io_uring && sexp_prettify_batch_uring_worker_files(worker))
+    {
+        return NULL;
+    }
+#endif
+
+    sexp_prettify_batch_worker_files(worker);
+    return NULL;
+}
+
+/*
+ * Driver
+ * The calling thread is worker 0, so the run still completes if no extra threads could be started.
+ */
+bool sexp_prettify_batch_run(struct PrettifySExprBatch *batch)
+{
+    const double start_time = sexp_prettify_batch_now();
+
+    unsigned int worker_count = batch->thread_count;
+    if (worker_count > batch->file_count)
+    {
+        worker_count = batch->file_count ? (unsigned int)batch->file_count : 1;
+    }
+
+    struct PrettifySExprBatchRun run = {0};
+    pthread_mutex_init(&run.lock, NULL);
+    run.uid = geteuid();
+    run.gid = getegid();
+
+    if (batch->io_uring)
+    {
+        run.umask = umask(0);
+        umask(run.umask);
+    }
+
+    struct PrettifySExprBatchWorker *workers = calloc(worker_count, sizeof(*workers));
+    pthread_t *threads = calloc(worker_count, sizeof(*threads));
+    unsigned int workers_ready = 0;
+    if (workers && threads)
+    {
+        for (; workers_ready < worker_count; workers_ready++)
+        {
+            struct PrettifySExprBatchWorker *worker = &workers[workers_ready];
+            worker->batch = batch;
+            worker->run = &run;
+            worker->random = ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)worker ^ (uint64_t)(start_time * 1e9) ^ 0x9e3779b97f4a7c15ull;
+            worker->output = malloc(PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE);
+            worker->index_entries = malloc(PRETTIFY_SEXPR_BATCH_INDEX_ENTRY_COUNT * sizeof(*worker->index_entries));
+            if (!worker->output || !worker->index_entries)
+            {
+                free(worker->output);
+                free(worker->index_entries);
+                break;
+            }
+        }
+    }
+
+    bool ok = workers_ready > 0;
+    bool used_io_uring = false;
+    if (ok)
+    {
+        unsigned int threads_started = 1;
+        for (; threads_started < workers_ready; threads_started++)
+        {
+            if (pthread_create(&threads[threads_started], NULL, sexp_prettify_batch_worker, &workers[threads_started]) != 0)
+            {
+                break;
+            }
+        }
+
+        sexp_prettify_batch_worker(&workers[0]);
+
+        for (unsigned int i = 1; i < threads_started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        for (unsigned int i = 0; i < workers_ready; i++)
+        {
+            batch->changed_count += workers[i].changed_count;
+            batch->unchanged_count += workers[i].unchanged_count;
+            batch->failed_count += workers[i].failed_count;
+            batch->bytes_in += workers[i].bytes_in;
+            batch->bytes_out += workers[i].bytes_out;
+            batch->syscalls += workers[i].syscalls;
+            used_io_uring = used_io_uring || workers[i].used_io_uring;
+            sexp_prettify_stats_merge(&batch->stats, &workers[i].stats);
+            free(workers[i].output);
+            free(workers[i].index_entries);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Batch: Out of memory for worker buffers\n");
+        batch->failed_count += batch->file_count;
+    }
+
+    free(threads);
+    free(workers);
+    pthread_mutex_destroy(&run.lock);
+
+    batch->seconds = sexp_prettify_batch_now() - start_time;
+    batch->backend = used_io_uring ? "io_uring" : batch->io_uring ? "thread pool, io_uring unavailable" : "thread pool";
+    return ok && batch->failed_count == 0;
+}
+
+void sexp_prettify_batch_summary(const struct PrettifySExprBatch *batch, FILE *stream)
+{
+    const size_t file_count = batch->changed_count + batch->unchanged_count + batch->failed_count;
+    const double mb_per_second = batch->seconds > 0 ? (double)batch->bytes_in / batch->seconds / 1e6 : 0;
+    const double files_per_second = batch->seconds > 0 ? (double)file_count / batch->seconds : 0;
+    const double syscalls_per_file = file_count > 0 ? (double)batch->syscalls / (double)file_count : 0;
+    fprintf(stream, "Batch: %zu changed, %zu unchanged, %zu failed, %llu bytes in, %llu bytes out, %.3f s (%.1f MB/s, %.0f files/s, %.1f syscalls per file, %s)\n", batch->changed_count,
+            batch->unchanged_count, batch->failed_count, (unsigned long long)batch->bytes_in, (unsigned long long)batch->bytes_out, batch->seconds, mb_per_second, files_per_second, syscalls_per_file,
+            batch->backend ? batch->backend : "thread pool");
+}
@@ -0,0 +1,94 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Batch formatting of many files in place on a pool of worker threads.
+// Files are only replaced (atomically via rename()) when the formatted output differs from the original.
+// On Linux the file I/O can instead go through an io_uring per worker thread (raw syscalls, no liburing needed).
+// Note: Unlike sexp_prettify.c this uses the heap, pthreads and the file system.
+
+#ifndef SEXP_PRETTIFY_BATCH
+#define SEXP_PRETTIFY_BATCH
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sexp_prettify.h"
+
+// Structural index entries held by each worker
+#define PRETTIFY_SEXPR_BATCH_INDEX_ENTRY_COUNT (16 * 1024)
+
+// Output buffer held by each worker. Output is compared against the original (and written out once it differs) a buffer at a time
+#define PRETTIFY_SEXPR_BATCH_OUTPUT_SIZE (64 * 1024)
+
+// io_uring backend: Files each worker keeps in flight. Each needs at most 4 submission queue entries at once
+#define PRETTIFY_SEXPR_BATCH_URING_FILES 32
+#define PRETTIFY_SEXPR_BATCH_URING_ENTRIES 128
+
+// io_uring backend: Files are read whole into memory, so larger ones go through the mmap() path of the thread pool instead
+#define PRETTIFY_SEXPR_BATCH_URING_MAX_FILE_SIZE (4 * 1024 * 1024)
+
+// Pick the configured state to format a path with. found_in_directory is true for files found while walking a directory.
+// Return NULL to skip the file (Explicitly listed files are then reported as an error)
+typedef const struct PrettifySExprState *(*PrettifySExprBatchSelectFunc)(const char *path, bool found_in_directory, void *context);
+
+struct PrettifySExprBatchFile
+{
+    char *path;
+    const struct PrettifySExprState *config;
+};
+
+struct PrettifySExprBatch
+{
+    // Settings
+    unsigned int thread_count;
+    PrettifySExprBatchSelectFunc select_func;
+    void *select_func_context;
+    bool io_uring; ///< Use the io_uring backend if the kernel allows it (Set after sexp_prettify_batch_init())
+
+    // Files queued by sexp_prettify_batch_add() and sexp_prettify_batch_add_list()
+    struct PrettifySExprBatchFile *files;
+    size_t file_count;
+    size_t file_capacity;
+
+    // Summary
+    size_t changed_count;
+    size_t unchanged_count;
+    size_t failed_count;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    double seconds;
+    uint64_t syscalls;   ///< System calls made to read, format and replace the files (Not counting the directory walk)
+    const char *backend; ///< I/O backend used by the last run
+    struct PrettifySExprStats stats; ///< Formatting counters of all files
+};
+
+/*
+ * thread_count : Number of worker threads. 0 picks the number of online cpus
+ * select_func  : Picks the configured state used for each file (eg. by file extension)
+ */
+bool sexp_prettify_batch_init(struct PrettifySExprBatch *batch, unsigned int thread_count, PrettifySExprBatchSelectFunc select_func, void *select_func_context);
+void sexp_prettify_batch_free(struct PrettifySExprBatch *batch);
+
+// Queue a file, or every selected file below a directory. Errors are reported to stderr and counted as failed files
+void sexp_prettify_batch_add(struct PrettifySExprBatch *batch, const char *path);
+
+// Queue every path listed in a stream, one per line
+void sexp_prettify_batch_add_list(struct PrettifySExprBatch *batch, FILE *list);
+
+// Format all queued files in place. A file is only replaced if its formatted output differs, via a temp file in the same
+// directory and rename(). Unchanged files are not touched. Per file errors are reported to stderr without stopping the run
+// Returns false if any file failed (including files that failed to queue)
+bool sexp_prettify_batch_run(struct PrettifySExprBatch *batch);
+
+// Print the file counts, bytes, time, files per second and system calls per file of the last run
+void sexp_prettify_batch_summary(const struct PrettifySExprBatch *batch, FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,385 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// In process benchmark of every formatting engine over in memory inputs (No process startup or file I/O in the timings)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern "C"
+{
+#include "sexp_prettify.h"
+}
+
+namespace sexp_prettify_kicad
+{
+void Prettify(std::string &aSource, bool aCompactSave);
+}
+
+#include "sexp_prettify_kicad.h"
+#include "sexp_prettify_template.h"
+
+namespace sexp_prettify_kicad_original
+{
+void Prettify(std::string &aSource, bool aCompactSave);
+}
+
+typedef enum styleProfile
+{
+    STYLE_PROFILE_NONE = 0,
+    STYLE_PROFILE_KICAD_STANDARD,
+    STYLE_PROFILE_KICAD_COMPACT,
+} styleProfile;
+
+const char *compact_list_prefixes_kicad[] = {"pts"};
+const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad) / sizeof(compact_list_prefixes_kicad[0]);
+
+const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
+
+// Same inputs as time_test.sh (unformatted and already formatted)
+const char *default_inputs[] = {
+    "testcases/pts_list_test_symbol.kicad_sym",
+    "testcases/standard/pts_list_test_symbol_formatted.kicad_sym",
+    "testcases/ad620.kicad_sym",
+    "testcases/standard/ad620_formatted.kicad_sym",
+    "testcases/complex_hierarchy_schlib.kicad_sym",
+    "testcases/standard/complex_hierarchy_schlib_formatted.kicad_sym",
+    "testcases/flat_hierarchy_schlib.kicad_sym",
+    "testcases/standard/flat_hierarchy_schlib_formatted.kicad_sym",
+    "testcases/group_and_image.kicad_pcb",
+    "testcases/standard/group_and_image_formatted.kicad_pcb",
+    "testcases/Reverb_BTDR-1V.kicad_mod",
+    "testcases/standard/Reverb_BTDR-1V_formatted.kicad_mod",
+    "testcases/Samtec_HLE-133-02-xx-DV-PE-LC_2x33_P2.54mm_Horizontal.kicad_mod",
+    "testcases/standard/Samtec_HLE-133-02-xx-DV-PE-LC_2x33_P2.54mm_Horizontal_formatted.kicad_mod",
+};
+
+struct benchEngine
+{
+    const char *name;
+    bool has_zerostyle; ///< KiCad engines are fixed to the kicad profiles
+
+    // Format src into out (cleared beforehand, capacity is kept between runs)
+    std::function<void(const std::string &src, styleProfile profile, std::string &out)> run;
+};
+
+static PrettifySExprState profile_state(styleProfile profile)
+{
+    PrettifySExprState state = {0};
+    sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+
+    if (profile == STYLE_PROFILE_KICAD_STANDARD || profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_compact_list_set(&state, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+    }
+
+    if (profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_shortform_set(&state, shortform_prefixes_kicad, shortform_prefixes_kicad_size);
+    }
+
+    return state;
+}
+
+static void sink_flush_handler(PrettifySExprSink *sink, void *context)
+{
+    static_cast<std::string *>(context)->append(sink->buffer, sink->count);
+}
+
+static std::vector<benchEngine> bench_engines()
+{
+    std::vector<benchEngine> engines;
+
+    engines.push_back({"c sexp_prettify", true, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           PrettifySExprState state = profile_state(profile);
+                           auto putc_handler = [](char c, void *context) { static_cast<std::string *>(context)->push_back(c); };
+                           for (const char c : src)
+                           {
+                               sexp_prettify(&state, c, putc_handler, &out);
+                           }
+                       }});
+
+    engines.push_back({"c sexp_prettify_buffer_to_sink", true, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           PrettifySExprState state = profile_state(profile);
+                           char buffer[64 * 1024];
+                           PrettifySExprSink sink;
+                           sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), sink_flush_handler, &out);
+                           sexp_prettify_buffer_to_sink(&state, src.data(), src.size(), &sink);
+                           sexp_prettify_sink_flush(&sink);
+                       }});
+
+    engines.push_back({"c sexp_prettify_indexed", true, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           PrettifySExprState state = profile_state(profile);
+                           char buffer[64 * 1024];
+                           static uint32_t entries[16 * 1024];
+                           PrettifySExprSink sink;
+                           PrettifySExprIndex index;
+                           sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), sink_flush_handler, &out);
+                           sexp_prettify_index_init(&index, entries, sizeof(entries) / sizeof(entries[0]));
+                           sexp_prettify_indexed(&state, src.data(), src.size(), &sink, &index);
+                           sexp_prettify_sink_flush(&sink);
+                       }});
+
+    // Not formatting, but the same whitespace handling. Reference for how close to a plain copy it gets
+    engines.push_back({"c sexp_prettify_minify", true, [](const std::string &src, styleProfile, std::string &out)
+                       {
+                           PrettifySExprMinifyState minify;
+                           sexp_prettify_minify_init(&minify);
+                           char buffer[64 * 1024];
+                           PrettifySExprSink sink;
+                           sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), sink_flush_handler, &out);
+                           sexp_prettify_minify_buffer_to_sink(&minify, src.data(), src.size(), &sink);
+                           sexp_prettify_sink_flush(&sink);
+                       }});
+
+    engines.push_back({"memcpy", true, [](const std::string &src, styleProfile, std::string &out) { out.assign(src); }});
+
+    engines.push_back({"cpp template prettify", true, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           // One specialized loop per compile time profile
+                           if (profile == STYLE_PROFILE_KICAD_COMPACT)
+                           {
+                               sexp_prettify_template::prettify<sexp_prettify_template::KicadCompactProfile>(std::string_view(src), std::back_inserter(out));
+                           }
+                           else if (profile == STYLE_PROFILE_KICAD_STANDARD)
+                           {
+                               sexp_prettify_template::prettify<sexp_prettify_template::KicadProfile>(std::string_view(src), std::back_inserter(out));
+                           }
+                           else
+                           {
+                               sexp_prettify_template::prettify<sexp_prettify_template::ZeroStyleProfile>(std::string_view(src), std::back_inserter(out));
+                           }
+                       }});
+
+    engines.push_back({"cpp template prettify runtime", true, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           sexp_prettify_template::RuntimeProfile runtime;
+                           if (profile == STYLE_PROFILE_KICAD_STANDARD || profile == STYLE_PROFILE_KICAD_COMPACT)
+                           {
+                               for (const char *prefix : compact_list_prefixes_kicad)
+                               {
+                                   runtime.compact_list_add(prefix);
+                               }
+                           }
+                           if (profile == STYLE_PROFILE_KICAD_COMPACT)
+                           {
+                               for (const char *prefix : shortform_prefixes_kicad)
+                               {
+                                   runtime.shortform_add(prefix);
+                               }
+                           }
+                           sexp_prettify_template::prettify(std::string_view(src), std::back_inserter(out), runtime);
+                       }});
+
+    engines.push_back({"cpp kicad Prettify", false, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           out.assign(src);
+                           sexp_prettify_kicad::Prettify(out, profile == STYLE_PROFILE_KICAD_COMPACT);
+                       }});
+
+    engines.push_back({"cpp kicad PrettifyTo", false, [](const std::string &src, styleProfile profile, std::string &out)
+                       { sexp_prettify_kicad::PrettifyTo(std::string_view(src), std::back_inserter(out), profile == STYLE_PROFILE_KICAD_COMPACT); }});
+
+    // Fed in 64K chunks as when reading a file
+    engines.push_back({"cpp kicad PrettifyStream", false, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           auto write = [&out](const char *buffer, std::size_t size) { out.append(buffer, size); };
+                           sexp_prettify_kicad::PrettifyStream<decltype(write)> stream(write, profile == STYLE_PROFILE_KICAD_COMPACT);
+                           for (std::size_t offset = 0; offset < src.size(); offset += 64 * 1024)
+                           {
+                               stream.Feed(std::string_view(src).substr(offset, 64 * 1024));
+                           }
+                           stream.Finish();
+                       }});
+
+    engines.push_back({"cpp kicad original Prettify", false, [](const std::string &src, styleProfile profile, std::string &out)
+                       {
+                           out.assign(src);
+                           sexp_prettify_kicad_original::Prettify(out, profile == STYLE_PROFILE_KICAD_COMPACT);
+                       }});
+
+    return engines;
+}
+
+static double percentile(std::vector<double> sorted_times, double fraction)
+{
+    // Nearest rank
+    size_t rank = (size_t)(fraction * sorted_times.size() + 0.999999);
+    rank = std::min(std::max(rank, (size_t)1), sorted_times.size());
+    return sorted_times[rank - 1];
+}
+
+void usage(const std::string &prog_name, bool full)
+{
+    if (full)
+    {
+        printf("S-Expression Formatter Benchmark (Brian Khuu 2024)\n");
+        printf("\n");
+    }
+
+    printf("Usage:\n");
+    printf("  %s [OPTION]... [INPUT]...\n", prog_name.c_str());
+    printf("  INPUT              Input file loaded into memory before timing. If omitted then the testcases used by time_test.sh\n");
+    printf("\n");
+
+    if (full)
+    {
+        printf("Options:\n");
+        printf("  -h                 Show Help Message\n");
+        printf("  -n RUNS            Timed steady state runs per engine and profile (default 20)\n");
+        printf("  -w WARMUP          Warm-up runs per engine and profile, reported separately (default 3)\n");
+        printf("  -e ENGINE          Only run engines whose name contains ENGINE\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const std::string prog_name = argv[0];
+    int run_count = 20;
+    int warmup_count = 3;
+    const char *engine_filter = nullptr;
+
+    while (optind < argc)
+    {
+        const int c = getopt(argc, argv, "hn:w:e:");
+        if (c == -1)
+        {
+            break;
+        }
+
+        switch (c)
+        {
+            case 'h':
+            {
+                usage(prog_name, true);
+                return EXIT_SUCCESS;
+            }
+            case 'n':
+            {
+                run_count = atoi(optarg);
+                if (run_count <= 0)
+                {
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'w':
+            {
+                warmup_count = atoi(optarg);
+                if (warmup_count < 0)
+                {
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'e':
+            {
+                engine_filter = optarg;
+                break;
+            }
+            default:
+            {
+                usage(prog_name, false);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // Load inputs
+    std::vector<const char *> input_paths;
+    for (int i = optind; i < argc; i++)
+    {
+        input_paths.push_back(argv[i]);
+    }
+
+    if (input_paths.empty())
+    {
+        input_paths.assign(std::begin(default_inputs), std::end(default_inputs));
+    }
+
+    std::vector<std::string> inputs;
+    size_t input_size = 0;
+    for (const char *path : input_paths)
+    {
+        std::ifstream src_file(path, std::ios::binary);
+        if (!src_file.is_open())
+        {
+            fprintf(stderr, "Error opening input file: %s\n", path);
+            return EXIT_FAILURE;
+        }
+        inputs.emplace_back((std::istreambuf_iterator<char>(src_file)), std::istreambuf_iterator<char>());
+        input_size += inputs.back().size();
+    }
+
+    printf("Inputs: %zu files, %zu bytes per run. Warm-up runs: %d, steady state runs: %d\n\n", inputs.size(), input_size, warmup_count, run_count);
+    printf("%-14s %-32s %12s %10s %10s %10s %10s %10s %9s\n", "profile", "engine", "output", "warmup ms", "min ms", "median ms", "p99 ms", "MB/s", "ns/byte");
+
+    const std::pair<styleProfile, const char *> profiles[] = {
+        {STYLE_PROFILE_NONE, "zerostyle"},
+        {STYLE_PROFILE_KICAD_STANDARD, "kicad"},
+        {STYLE_PROFILE_KICAD_COMPACT, "kicad-compact"},
+    };
+
+    std::vector<std::string> outputs(inputs.size());
+    for (const auto &profile : profiles)
+    {
+        for (const benchEngine &engine : bench_engines())
+        {
+            if ((profile.first == STYLE_PROFILE_NONE && !engine.has_zerostyle) || (engine_filter && !strstr(engine.name, engine_filter)))
+            {
+                continue;
+            }
+
+            std::vector<double> warmup_times;
+            std::vector<double> times;
+            size_t output_size = 0;
+
+            for (int run = 0; run < warmup_count + run_count; run++)
+            {
+                for (std::string &output : outputs)
+                {
+                    output.clear();
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < inputs.size(); i++)
+                {
+                    engine.run(inputs[i], profile.first, outputs[i]);
+                }
+                const auto end = std::chrono::steady_clock::now();
+
+                const double seconds = std::chrono::duration<double>(end - start).count();
+                (run < warmup_count ? warmup_times : times).push_back(seconds);
+
+                output_size = 0;
+                for (const std::string &output : outputs)
+                {
+                    output_size += output.size();
+                }
+            }
+
+            std::sort(times.begin(), times.end());
+            const double median = percentile(times, 0.5);
+            const double warmup = warmup_times.empty() ? 0 : warmup_times.front();
+
+            printf("%-14s %-32s %12zu %10.3f %10.3f %10.3f %10.3f %10.1f %9.2f\n", profile.second, engine.name, output_size, warmup * 1e3, times.front() * 1e3, median * 1e3, percentile(times, 0.99) * 1e3,
+                   input_size / median / 1e6, median * 1e9 / input_size);
+        }
+    }
+
+    printf("\nwarmup ms is the first (cold) run. min, median and p99 are over the steady state runs. MB/s and ns/byte use the median\n");
+    return EXIT_SUCCESS;
+}
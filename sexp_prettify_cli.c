@@ -3,15 +3,29 @@
 // This script reformats KiCad-like S-expressions to match a specific formatting style.
 // Note: This script modifies formatting only; it does not perform linting or validation.
 
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "sexp_prettify.h"
+#include "sexp_prettify_batch.h"
+#include "sexp_prettify_gzip.h"
+#include "sexp_prettify_parallel.h"
+#include "sexp_prettify_pipeline.h"
+#include "sexp_prettify_server.h"
 
 typedef enum styleProfile
 {
@@ -26,7 +40,420 @@ const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad)
 const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
 const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
 
-void putc_handler(char c, void *context_putc) { fputc(c, (FILE *)context_putc); }
+// S-Expression based KiCad files (.kicad_pro and .kicad_prl are json)
+const char *kicad_file_extensions[] = {".kicad_pcb", ".kicad_sch", ".kicad_sym", ".kicad_mod", ".kicad_wks"};
+const int kicad_file_extensions_size = sizeof(kicad_file_extensions) / sizeof(kicad_file_extensions[0]);
+
+#define CLI_IO_BUFFER_SIZE (64 * 1024)
+#define CLI_IOV_BATCH_COUNT 16
+#define CLI_INDEX_ENTRY_COUNT (16 * 1024)
+#define CLI_CHECK_WINDOW_SIZE (256 * 1024)
+#define CLI_GZIP_DEFAULT_LEVEL 6
+#define CLI_PASSTHROUGH_SPAN_COUNT 1024
+
+/*
+ * I/O Backends
+ *  - Input  : Regular files are mmap()ed with MADV_SEQUENTIAL and formatted in one pass (structural index), else buffered read() (pipes, ttys...)
+ *  - Output : Regular files receive batches of full output buffers via writev(), else each buffer is write() as it fills
+ *  - Mapped : Unless -j or --minify, output that matches the mapped input is written by writev() straight from the mapping
+ *             (passthrough) and only the changed stretches are copied, into the output buffers
+ *  - Threads: With -P, gzip input (detected by its magic bytes) or gzip output, a reader and a writer thread do the I/O (and gzip)
+ *             while the main thread formats, handing fixed size blocks over through two rings
+ */
+
+typedef struct cliOutput
+{
+    int fd;
+    bool vectored;
+    bool failed;
+    int iov_count;
+    struct iovec iov[CLI_IOV_BATCH_COUNT];
+} cliOutput;
+
+static char src_buffer[CLI_IO_BUFFER_SIZE];
+static uint32_t src_index[CLI_INDEX_ENTRY_COUNT];
+static char check_window[CLI_CHECK_WINDOW_SIZE];
+static char dst_buffer[CLI_IOV_BATCH_COUNT][CLI_IO_BUFFER_SIZE];
+static struct PrettifySExprSpan passthrough_spans[CLI_PASSTHROUGH_SPAN_COUNT];
+static struct iovec passthrough_iov[CLI_PASSTHROUGH_SPAN_COUNT];
+
+static bool writev_all(int fd, struct iovec *iov, int iov_count)
+{
+    while (iov_count > 0)
+    {
+        ssize_t written = writev(fd, iov, iov_count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        // Skip past what was written (Handles partial writes)
+        while (iov_count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+
+        if (iov_count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+static void cli_output_submit(cliOutput *output)
+{
+    if (output->iov_count > 0 && !output->failed && !writev_all(output->fd, output->iov, output->iov_count))
+    {
+        output->failed = true;
+    }
+    output->iov_count = 0;
+}
+
+void flush_handler(struct PrettifySExprSink *sink, void *context_flush)
+{
+    cliOutput *output = (cliOutput *)context_flush;
+
+    output->iov[output->iov_count].iov_base = sink->buffer;
+    output->iov[output->iov_count].iov_len = sink->count;
+    output->iov_count++;
+
+    if (!output->vectored || output->iov_count >= CLI_IOV_BATCH_COUNT)
+    {
+        cli_output_submit(output);
+    }
+
+    // Continue in the next free buffer while the previous ones wait for the batch to be written
+    sink->buffer = dst_buffer[output->iov_count];
+}
+
+// Spans point into the mapped source and the output buffers, so all of them are written before returning
+static void passthrough_flush_handler(struct PrettifySExprPassthrough *passthrough, void *context)
+{
+    cliOutput *output = (cliOutput *)context;
+
+    for (size_t i = 0; i < passthrough->span_count; i++)
+    {
+        passthrough_iov[i].iov_base = (void *)passthrough->spans[i].data;
+        passthrough_iov[i].iov_len = passthrough->spans[i].size;
+    }
+
+    if (!output->failed && !writev_all(output->fd, passthrough_iov, (int)passthrough->span_count))
+    {
+        output->failed = true;
+    }
+}
+
+static void pipeline_write_handler(const char *buffer, size_t size, void *context) { sexp_prettify_gzip_write((struct PrettifySExprGzipWriter *)context, buffer, size); }
+
+// Minified instead of formatted if minify is not NULL. Written through passthrough instead of the sink if it is not NULL
+static bool prettify_mmap(struct PrettifySExprState *state, struct PrettifySExprMinifyState *minify, struct PrettifySExprPassthrough *passthrough, struct PrettifySExprSink *sink, int src_fd, size_t src_size,
+                          unsigned int thread_count)
+{
+    void *src_map = mmap(NULL, src_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+    if (src_map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    madvise(src_map, src_size, MADV_SEQUENTIAL);
+
+    bool ok = true;
+    if (minify)
+    {
+        sexp_prettify_minify_buffer_to_sink(minify, (const char *)src_map, src_size, sink);
+    }
+    else if (passthrough)
+    {
+        // Every span pointing into the mapping is written by the time this returns
+        sexp_prettify_passthrough(state, (const char *)src_map, src_size, passthrough);
+    }
+    else if (thread_count == 1)
+    {
+        // Whole file is in memory so lex it through the structural index first
+        struct PrettifySExprIndex index;
+        sexp_prettify_index_init(&index, src_index, sizeof(src_index) / sizeof(src_index[0]));
+        sexp_prettify_indexed(state, (const char *)src_map, src_size, sink, &index);
+    }
+    else
+    {
+        ok = sexp_prettify_parallel(state, (const char *)src_map, src_size, sink, thread_count);
+    }
+
+    munmap(src_map, src_size);
+    return ok;
+}
+
+// Reads through the gzip reader as it holds the bytes already read while looking for the gzip magic bytes
+static bool prettify_read(struct PrettifySExprState *state, struct PrettifySExprMinifyState *minify, struct PrettifySExprSink *sink, struct PrettifySExprGzipReader *reader)
+{
+    while (true)
+    {
+        const size_t src_size = sexp_prettify_gzip_read(src_buffer, sizeof(src_buffer), reader);
+        if (src_size == 0)
+        {
+            return !reader->failed;
+        }
+
+        if (minify)
+        {
+            sexp_prettify_minify_buffer_to_sink(minify, src_buffer, src_size, sink);
+        }
+        else
+        {
+            sexp_prettify_buffer_to_sink(state, src_buffer, src_size, sink);
+        }
+    }
+}
+
+// Read errors of the pipeline reader thread are kept in the reader as errno is per thread
+static void report_read_error(const struct PrettifySExprGzipReader *reader)
+{
+    if (reader->failed && reader->error == 0)
+    {
+        fprintf(stderr, "Error reading source file: Corrupt or truncated gzip data\n");
+        return;
+    }
+
+    if (reader->error != 0)
+    {
+        errno = reader->error;
+    }
+    perror("Error reading source file");
+}
+
+static bool parse_size(const char *str, size_t *size)
+{
+    char *end = NULL;
+    const unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+    {
+        return false;
+    }
+
+    switch (*end)
+    {
+        case '\0':
+            *size = value;
+            return true;
+        case 'K':
+        case 'k':
+            *size = value << 10;
+            return end[1] == '\0';
+        case 'M':
+        case 'm':
+            *size = value << 20;
+            return end[1] == '\0';
+        default:
+            return false;
+    }
+}
+
+/*
+ * Check Mode
+ * Compares the formatted output against the source as it streams and stops at the first difference. No output is written.
+ */
+
+static bool check_source(struct PrettifySExprState *state, struct PrettifySExprGzipReader *reader, int src_fd, struct PrettifySExprCheck *result)
+{
+    struct stat src_stat;
+    if (!reader->gzip && fstat(src_fd, &src_stat) == 0 && S_ISREG(src_stat.st_mode) && src_stat.st_size > 0)
+    {
+        void *src_map = mmap(NULL, src_stat.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+        if (src_map != MAP_FAILED)
+        {
+            madvise(src_map, src_stat.st_size, MADV_SEQUENTIAL);
+            sexp_prettify_check_buffer(state, (const char *)src_map, src_stat.st_size, result);
+            munmap(src_map, src_stat.st_size);
+            return true;
+        }
+    }
+
+    // Gzip input is checked as it is decompressed
+    const bool check_ok = sexp_prettify_check(state, sexp_prettify_gzip_read, reader, check_window, sizeof(check_window), result);
+    assert(check_ok);
+    return check_ok && !reader->failed;
+}
+
+/*
+ * Statistics
+ */
+
+typedef enum statsFormat
+{
+    STATS_FORMAT_NONE = 0,
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+} statsFormat;
+
+static void print_stats(FILE *stream, const struct PrettifySExprStats *stats, statsFormat format)
+{
+    const struct
+    {
+        const char *name;
+        unsigned long long value;
+    } counters[] = {
+        {"input_bytes", stats->input_bytes},
+        {"output_bytes", stats->output_bytes},
+        {"lines", stats->lines},
+        {"lists", stats->lists},
+        {"max_depth", stats->max_depth},
+        {"quoted_bytes", stats->quoted_bytes},
+        {"wrapped_tokens", stats->wrapped_tokens},
+        {"compact_list_lines", stats->compact_list_lines},
+        {"shortform_lists", stats->shortform_lists},
+    };
+    const int counters_size = sizeof(counters) / sizeof(counters[0]);
+
+    if (format == STATS_FORMAT_JSON)
+    {
+        fprintf(stream, "{");
+        for (int i = 0; i < counters_size; i++)
+        {
+            fprintf(stream, "%s\"%s\": %llu", i ? ", " : "", counters[i].name, counters[i].value);
+        }
+        fprintf(stream, "}\n");
+        return;
+    }
+
+    fprintf(stream, "Stats:\n");
+    for (int i = 0; i < counters_size; i++)
+    {
+        fprintf(stream, "  %-20s %llu\n", counters[i].name, counters[i].value);
+    }
+}
+
+/*
+ * Batch Mode
+ *  - Files found in directories are only formatted if they have a KiCad extension
+ *  - KiCad files use the kicad profile and anything else the default style, unless a style was given on the command line
+ */
+
+typedef struct cliBatchProfiles
+{
+    bool style_from_options;
+    struct PrettifySExprState options;
+    struct PrettifySExprState kicad;
+} cliBatchProfiles;
+
+static bool has_kicad_file_extension(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+    if (!extension)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < kicad_file_extensions_size; i++)
+    {
+        if (strcmp(extension, kicad_file_extensions[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static const struct PrettifySExprState *batch_select_handler(const char *path, bool found_in_directory, void *context)
+{
+    const cliBatchProfiles *profiles = (const cliBatchProfiles *)context;
+    const bool kicad_file = has_kicad_file_extension(path);
+
+    if (found_in_directory && !kicad_file)
+    {
+        return NULL;
+    }
+
+    if (profiles->style_from_options || !kicad_file)
+    {
+        return &profiles->options;
+    }
+
+    return &profiles->kicad;
+}
+
+/*
+ * Server Mode
+ * Formats the requests of sexp_prettify_client until SIGINT or SIGTERM. Profiles are configured once and copied for each request,
+ * which brings its own wrap settings
+ */
+
+static int serve(const char *socket_path, unsigned int thread_count, bool verbose)
+{
+    char default_socket_path[PATH_MAX];
+    if (!socket_path)
+    {
+        if (!sexp_prettify_server_default_path(default_socket_path, sizeof(default_socket_path)))
+        {
+            fprintf(stderr, "Default socket path is too long\n");
+            return EXIT_FAILURE;
+        }
+        socket_path = default_socket_path;
+    }
+
+    struct PrettifySExprState none = {0};
+    struct PrettifySExprState kicad = {0};
+    struct PrettifySExprState kicad_compact = {0};
+    bool profiles_ok = sexp_prettify_init(&none, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+    profiles_ok = profiles_ok && sexp_prettify_init(&kicad, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+    profiles_ok = profiles_ok && sexp_prettify_compact_list_set(&kicad, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+    kicad_compact = kicad;
+    profiles_ok = profiles_ok && sexp_prettify_shortform_set(&kicad_compact, shortform_prefixes_kicad, shortform_prefixes_kicad_size);
+    if (!profiles_ok)
+    {
+        fprintf(stderr, "Could not set up the style profiles\n");
+        return EXIT_FAILURE;
+    }
+
+    const struct PrettifySExprState *profiles[PRETTIFY_SEXPR_SERVER_PROFILE_COUNT] = {
+        [PRETTIFY_SEXPR_SERVER_PROFILE_NONE] = &none,
+        [PRETTIFY_SEXPR_SERVER_PROFILE_KICAD] = &kicad,
+        [PRETTIFY_SEXPR_SERVER_PROFILE_KICAD_COMPACT] = &kicad_compact,
+    };
+
+    struct PrettifySExprServer server;
+    if (!sexp_prettify_server_init(&server, socket_path, thread_count, profiles))
+    {
+        fprintf(stderr, "Socket path is too long or out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    // Workers inherit the blocked signals, so only sigwait() below sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (!sexp_prettify_server_start(&server))
+    {
+        fprintf(stderr, "Error listening on %s: %s\n", socket_path, errno == EADDRINUSE ? "Another server is already listening" : strerror(errno));
+        sexp_prettify_server_free(&server);
+        return EXIT_FAILURE;
+    }
+
+    if (verbose)
+    {
+        fprintf(stderr, "Listening on %s with %u workers\n", socket_path, server.worker_count);
+    }
+
+    int signal_number = 0;
+    sigwait(&signals, &signal_number);
+
+    sexp_prettify_server_stop(&server);
+    sexp_prettify_server_summary(&server, stderr);
+    sexp_prettify_server_free(&server);
+    return EXIT_SUCCESS;
+}
 
 void usage(const char *prog_name, bool full)
 {
@@ -38,12 +465,16 @@ void usage(const char *prog_name, bool full)
 
     printf("Usage:\n");
     printf("  %s [OPTION]... SOURCE [DESTINATION]\n", prog_name);
+    printf("  %s [OPTION]... --check SOURCE\n", prog_name);
+    printf("  %s [OPTION]... -b [PATH]...\n", prog_name);
+    printf("  %s [-j THREADS] --serve[=SOCKET]\n", prog_name);
     if (!full)
     {
         printf("  %s -h          Show Full Help Message\n", prog_name);
     }
     printf("  SOURCE             Source file path. If '-' then use standard stream input\n");
     printf("  DESTINATION        Destination file path. If omitted or '-' then use standard stream output\n");
+    printf("  PATH               Batch mode file or directory (recursive). If omitted or '-' then read paths from standard input\n");
     printf("\n");
 
     if (full)
@@ -55,10 +486,35 @@ void usage(const char *prog_name, bool full)
         printf("  -k COLUMN_LIMIT    Add To Compact List Column Limit. Must be positive value. (default %d)\n", PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
         printf("  -s SHORTFORM       Add To Shortform List. Must be a string.\n");
         printf("  -p PROFILE         Predefined Style. (kicad, kicad-compact)\n");
+        printf("  -v                 Verbose. Report chosen I/O backend to standard error\n");
+        printf("  -j THREADS         Format children of the root list in parallel. 0 uses all cpus (default 1, needs a regular source file)\n");
+        printf("  --no-passthrough   Copy all output through the output buffers. By default output that matches a regular source file is written straight from it\n");
+        printf("  -b                 Batch. Format every PATH in place on -j THREADS (default all cpus). Style picked by file extension unless -p, -l or -s\n");
+        printf("                     Files are only replaced (atomically) if their content changes\n");
+        printf("  --io-uring         Batch. Do the file I/O of -b through io_uring, many files in flight per thread (Falls back to plain system calls if unavailable)\n");
+        printf("  --serve[=SOCKET]   Server. Format the requests of sexp_prettify_client on a Unix socket with -j THREADS warm workers (default all cpus) until SIGINT or SIGTERM\n");
+        printf("                     SOCKET defaults to $SEXP_PRETTIFY_SOCKET, else $XDG_RUNTIME_DIR/sexp_prettify.sock, else /tmp/sexp_prettify-UID.sock\n");
+        printf("  -c, --check        Check. Exit with 1 and report the offset and line of the first difference if SOURCE is not already formatted\n");
+        printf("  --stats[=FORMAT]   Print formatting counters (bytes, lines, lists, depth, wrapping...) to standard error. FORMAT is text (default) or json\n");
+        printf("  -m, --minify       Minify. Strip all whitespace that does not change the formatted result (Formatting it again gives the same output)\n");
+        printf("  -P, --pipeline     Pipeline. Read and write on their own threads while formatting, to overlap slow I/O (pipes, network file systems)\n");
+        printf("  --block-size=SIZE  Pipeline block size in bytes, or with a K or M suffix (default %dK)\n", PRETTIFY_SEXPR_PIPELINE_BLOCK_SIZE / 1024);
+        printf("  --block-count=N    Pipeline blocks in flight between each pair of threads (default %d)\n", PRETTIFY_SEXPR_PIPELINE_BLOCK_COUNT);
+        printf("  -z[LEVEL], --gzip[=LEVEL] Gzip compress the output at LEVEL, 1 (fastest) to 9 (smallest) (default %d). Gzip input is always detected and decompressed (Both use the pipeline)\n", CLI_GZIP_DEFAULT_LEVEL);
         printf("\n");
         printf("Example:\n");
         printf("  - Use standard input and standard output. Also use KiCAD's standard compact list and shortform setting.\n");
         printf("    %s -l pts -s font -s stroke -s fill -s offset -s rotate -s scale - -\n", prog_name);
+        printf("  - Reformat a KiCad library tree in place using all cpus.\n");
+        printf("    %s -b path/to/library\n", prog_name);
+        printf("  - Check that a board file is already formatted (eg. in a pre-commit hook).\n");
+        printf("    %s -p kicad --check board.kicad_pcb\n", prog_name);
+        printf("  - Minify a board file for storage.\n");
+        printf("    %s --minify board.kicad_pcb board.min.kicad_pcb\n", prog_name);
+        printf("  - Format a gzip compressed board file into a gzip compressed copy.\n");
+        printf("    %s -p kicad --gzip=9 board.kicad_pcb.gz formatted.kicad_pcb.gz\n", prog_name);
+        printf("  - Keep a formatter running for editor integrations and save hooks, then format through it.\n");
+        printf("    %s --serve & sexp_prettify_client -p kicad board.kicad_pcb\n", prog_name);
     }
 }
 
@@ -78,9 +534,40 @@ int main(int argc, char **argv)
 
     styleProfile kicad_profile_active = STYLE_PROFILE_NONE;
 
+    bool verbose = false;
+    bool batch_mode = false;
+    bool batch_io_uring = false;
+    bool serve_mode = false;
+    const char *serve_socket_path = NULL;
+    bool check_mode = false;
+    bool minify_mode = false;
+    bool passthrough_mode = true;
+    bool thread_count_set = false;
+    unsigned int thread_count = 1;
+    int gzip_level = PRETTIFY_SEXPR_GZIP_LEVEL_NONE;
+    bool pipeline_mode = false;
+    size_t pipeline_block_size = PRETTIFY_SEXPR_PIPELINE_BLOCK_SIZE;
+    size_t pipeline_block_count = PRETTIFY_SEXPR_PIPELINE_BLOCK_COUNT;
+    statsFormat stats_format = STATS_FORMAT_NONE;
+
     while (optind < argc)
     {
-        const char c = getopt(argc, argv, "hl:s:p:k:");
+        static const struct option long_options[] = {
+            {"help", no_argument, NULL, 'h'},
+            {"check", no_argument, NULL, 'c'},
+            {"stats", optional_argument, NULL, 'S'},
+            {"minify", no_argument, NULL, 'm'},
+            {"gzip", optional_argument, NULL, 'z'},
+            {"pipeline", no_argument, NULL, 'P'},
+            {"block-size", required_argument, NULL, 'B'},
+            {"block-count", required_argument, NULL, 'N'},
+            {"io-uring", no_argument, NULL, 'U'},
+            {"no-passthrough", no_argument, NULL, 'T'},
+            {"serve", optional_argument, NULL, 'D'},
+            {NULL, 0, NULL, 0},
+        };
+
+        const char c = getopt_long(argc, argv, "hw:l:s:p:k:vj:bcmz::P", long_options, NULL);
         if (c == -1)
         {
             break;
@@ -152,6 +639,130 @@ int main(int argc, char **argv)
                 break;
             }
 
+            case 'v':
+            {
+                verbose = true;
+                break;
+            }
+
+            case 'j':
+            {
+                const int value = atoi(optarg);
+
+                if (value < 0)
+                {
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                thread_count = value;
+                thread_count_set = true;
+                break;
+            }
+
+            case 'b':
+            {
+                batch_mode = true;
+                break;
+            }
+
+            case 'U':
+            {
+                batch_io_uring = true;
+                break;
+            }
+
+            case 'T':
+            {
+                passthrough_mode = false;
+                break;
+            }
+
+            case 'D':
+            {
+                serve_mode = true;
+                serve_socket_path = optarg;
+                break;
+            }
+
+            case 'c':
+            {
+                check_mode = true;
+                break;
+            }
+
+            case 'm':
+            {
+                minify_mode = true;
+                break;
+            }
+
+            case 'z':
+            {
+                const int value = optarg ? atoi(optarg) : CLI_GZIP_DEFAULT_LEVEL;
+
+                if (value < 1 || value > 9)
+                {
+                    fprintf(stderr, "Gzip level must be between 1 and 9\n");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                gzip_level = value;
+                break;
+            }
+
+            case 'P':
+            {
+                pipeline_mode = true;
+                break;
+            }
+
+            case 'B':
+            {
+                if (!parse_size(optarg, &pipeline_block_size) || pipeline_block_size == 0)
+                {
+                    fprintf(stderr, "Block size must be a positive size\n");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+
+            case 'N':
+            {
+                const int value = atoi(optarg);
+
+                if (value < 1)
+                {
+                    fprintf(stderr, "Block count must be at least 1\n");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                pipeline_block_count = value;
+                break;
+            }
+
+            case 'S':
+            {
+                if (!optarg || strcmp("text", optarg) == 0)
+                {
+                    stats_format = STATS_FORMAT_TEXT;
+                }
+                else if (strcmp("json", optarg) == 0)
+                {
+                    stats_format = STATS_FORMAT_JSON;
+                }
+                else
+                {
+                    fprintf(stderr, "Stats format must be either 'text' or 'json'\n");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+
             case 'p':
             {
                 if (strcmp("kicad", optarg) == 0)
@@ -223,6 +834,106 @@ int main(int argc, char **argv)
         }
     }
 
+    if (serve_mode && (batch_mode || check_mode || minify_mode || pipeline_mode || gzip_level != PRETTIFY_SEXPR_GZIP_LEVEL_NONE || stats_format != STATS_FORMAT_NONE || optind < argc))
+    {
+        fprintf(stderr, "Serve can only be combined with -j and -v (Style options come with each request)\n");
+        usage(prog_name, false);
+        return EXIT_FAILURE;
+    }
+
+    if (minify_mode && (batch_mode || check_mode || thread_count != 1 || stats_format != STATS_FORMAT_NONE))
+    {
+        fprintf(stderr, "Minify can not be combined with -b, -j, --check or --stats\n");
+        usage(prog_name, false);
+        return EXIT_FAILURE;
+    }
+
+    if (gzip_level != PRETTIFY_SEXPR_GZIP_LEVEL_NONE && (batch_mode || check_mode))
+    {
+        fprintf(stderr, "Gzip output can not be combined with -b or --check\n");
+        usage(prog_name, false);
+        return EXIT_FAILURE;
+    }
+
+    if (pipeline_mode && (batch_mode || check_mode || thread_count != 1))
+    {
+        fprintf(stderr, "Pipeline can not be combined with -b, -j or --check\n");
+        usage(prog_name, false);
+        return EXIT_FAILURE;
+    }
+
+    // Initialise and sanity check
+    struct PrettifySExprState state = {0};
+
+    bool style_ok = sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, wrap_threshold);
+
+    if (style_ok && compact_list_prefixes_entries_count > 0)
+    {
+        style_ok = sexp_prettify_compact_list_set(&state, compact_list_prefixes, compact_list_prefixes_entries_count, compact_list_prefixes_wrap_threshold);
+    }
+
+    if (style_ok && shortform_prefixes_entries_count > 0)
+    {
+        style_ok = sexp_prettify_shortform_set(&state, shortform_prefixes, shortform_prefixes_entries_count);
+    }
+
+    if (!style_ok)
+    {
+        fprintf(stderr, "Too many or too long compact list or shortform prefixes\n");
+        return EXIT_FAILURE;
+    }
+
+    struct PrettifySExprStats stats = {0};
+    if (stats_format != STATS_FORMAT_NONE && !sexp_prettify_stats_set(&state, &stats))
+    {
+        fprintf(stderr, "Statistics are not available (built with PRETTIFY_SEXPR_NO_STATS)\n");
+        return EXIT_FAILURE;
+    }
+
+    if (serve_mode)
+    {
+        return serve(serve_socket_path, thread_count_set ? thread_count : 0, verbose);
+    }
+
+    if (batch_mode)
+    {
+        cliBatchProfiles profiles = {0};
+        profiles.style_from_options = kicad_profile_active != STYLE_PROFILE_NONE || compact_list_prefixes_entries_count > 0 || shortform_prefixes_entries_count > 0;
+        profiles.options = state;
+
+        // Whole files are the unit of work here, so default to all cpus
+        struct PrettifySExprBatch batch;
+        if (!sexp_prettify_init(&profiles.kicad, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, wrap_threshold) ||
+            !sexp_prettify_compact_list_set(&profiles.kicad, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT) ||
+            !sexp_prettify_batch_init(&batch, thread_count_set ? thread_count : 0, batch_select_handler, &profiles))
+        {
+            fprintf(stderr, "Could not set up batch mode\n");
+            return EXIT_FAILURE;
+        }
+        batch.io_uring = batch_io_uring;
+
+        if (optind >= argc || (optind + 1 == argc && strcmp(argv[optind], "-") == 0))
+        {
+            sexp_prettify_batch_add_list(&batch, stdin);
+        }
+        else
+        {
+            for (; optind < argc; optind++)
+            {
+                sexp_prettify_batch_add(&batch, argv[optind]);
+            }
+        }
+
+        const bool batch_ok = sexp_prettify_batch_run(&batch);
+        sexp_prettify_batch_summary(&batch, stderr);
+        if (stats_format != STATS_FORMAT_NONE)
+        {
+            print_stats(stderr, &batch.stats, stats_format);
+        }
+        sexp_prettify_batch_free(&batch);
+        return batch_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Get fixed arguments
     const char *src_path = NULL;
     const char *dst_path = NULL;
@@ -245,57 +956,192 @@ int main(int argc, char **argv)
     }
 
     // Get File Descriptor
-    FILE *src_file = stdin;
+    int src_fd = STDIN_FILENO;
     if (src_path && strcmp(src_path, "-") != 0)
     {
-        src_file = fopen(src_path, "r");
-        if (!src_file)
+        src_fd = open(src_path, O_RDONLY);
+        if (src_fd < 0)
         {
             perror("Error opening source file");
             return EXIT_FAILURE;
         }
     }
 
+    struct PrettifySExprGzipReader reader;
+    if (!sexp_prettify_gzip_reader_init(&reader, src_fd))
+    {
+        fprintf(stderr, "Out of memory\n");
+        close(src_fd);
+        return EXIT_FAILURE;
+    }
+
+    if (check_mode)
+    {
+        struct PrettifySExprCheck check;
+        const bool src_ok = check_source(&state, &reader, src_fd, &check);
+        close(src_fd);
+
+        if (!src_ok)
+        {
+            report_read_error(&reader);
+            sexp_prettify_gzip_reader_free(&reader);
+            return EXIT_FAILURE;
+        }
+        sexp_prettify_gzip_reader_free(&reader);
+
+        if (stats_format != STATS_FORMAT_NONE)
+        {
+            print_stats(stderr, &stats, stats_format);
+        }
+
+        const char *src_name = strcmp(src_path, "-") == 0 ? "<stdin>" : src_path;
+        if (!check.canonical)
+        {
+            fprintf(stderr, "%s:%zu:%zu: Not formatted. First difference at byte offset %zu\n", src_name, check.line, check.column, check.offset);
+            return EXIT_FAILURE;
+        }
+
+        if (verbose)
+        {
+            fprintf(stderr, "%s: Formatted\n", src_name);
+        }
+        return EXIT_SUCCESS;
+    }
+
     // Open the destination file else default to standard output
-    FILE *dst_file = stdout;
+    int dst_fd = STDOUT_FILENO;
     if (dst_path && strcmp(dst_path, "-") != 0)
     {
-        dst_file = fopen(dst_path, "wb");
-        if (!dst_file)
+        dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (dst_fd < 0)
         {
             perror("Error opening destination file");
-            fclose(src_file);
+            sexp_prettify_gzip_reader_free(&reader);
+            close(src_fd);
             return EXIT_FAILURE;
         }
     }
 
-    // Initialise and sanity check
-    struct PrettifySExprState state = {0};
+    // Select I/O backend
+    struct stat src_stat;
+    struct stat dst_stat;
+    const bool src_mappable = fstat(src_fd, &src_stat) == 0 && S_ISREG(src_stat.st_mode) && src_stat.st_size > 0;
+    const bool dst_vectored = fstat(dst_fd, &dst_stat) == 0 && S_ISREG(dst_stat.st_mode);
 
-    assert(sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, wrap_threshold));
+    cliOutput output = {.fd = dst_fd, .vectored = dst_vectored};
 
-    if (compact_list_prefixes_entries_count > 0)
+    struct PrettifySExprSink sink;
+    if (!sexp_prettify_sink_init(&sink, dst_buffer[0], CLI_IO_BUFFER_SIZE, &flush_handler, &output))
     {
-        assert(sexp_prettify_compact_list_set(&state, compact_list_prefixes, compact_list_prefixes_entries_count, compact_list_prefixes_wrap_threshold));
+        fprintf(stderr, "Could not set up the output buffer\n");
+        sexp_prettify_gzip_reader_free(&reader);
+        return EXIT_FAILURE;
     }
 
-    if (shortform_prefixes_entries_count > 0)
+    struct PrettifySExprMinifyState minify;
+    sexp_prettify_minify_init(&minify);
+
+    // Process Source Files
+    bool src_ok = false;
+    int dst_error = 0;
+    const char *src_backend = "read";
+    const char *dst_backend = dst_vectored ? "writev" : "write";
+    const bool pipelined = pipeline_mode || reader.gzip || gzip_level != PRETTIFY_SEXPR_GZIP_LEVEL_NONE;
+    if (pipelined)
     {
-        assert(sexp_prettify_shortform_set(&state, shortform_prefixes, shortform_prefixes_entries_count));
+        struct PrettifySExprGzipWriter writer;
+        if (!sexp_prettify_gzip_writer_init(&writer, dst_fd, gzip_level))
+        {
+            fprintf(stderr, "Out of memory\n");
+            sexp_prettify_gzip_reader_free(&reader);
+            return EXIT_FAILURE;
+        }
+
+        if (!sexp_prettify_pipeline(&state, minify_mode ? &minify : NULL, sexp_prettify_gzip_read, &reader, pipeline_write_handler, &writer, pipeline_block_size, pipeline_block_count))
+        {
+            fprintf(stderr, "Could not start the pipeline threads\n");
+            sexp_prettify_gzip_writer_free(&writer);
+            sexp_prettify_gzip_reader_free(&reader);
+            return EXIT_FAILURE;
+        }
+
+        sexp_prettify_gzip_writer_finish(&writer);
+        sexp_prettify_gzip_writer_free(&writer);
+
+        src_ok = !reader.failed;
+        output.failed = writer.failed;
+        dst_error = writer.error;
+        src_backend = reader.gzip ? "gunzip (reader thread)" : "read (reader thread)";
+        dst_backend = gzip_level != PRETTIFY_SEXPR_GZIP_LEVEL_NONE ? "gzip (writer thread)" : "write (writer thread)";
     }
+    else if (src_mappable)
+    {
+        // Changed stretches are copied into the output buffers as the sink is not used then
+        struct PrettifySExprPassthrough passthrough;
+        const bool passthrough_used = passthrough_mode && !minify_mode && thread_count == 1;
+        if (!sexp_prettify_passthrough_init(&passthrough, passthrough_spans, CLI_PASSTHROUGH_SPAN_COUNT, dst_buffer[0], sizeof(dst_buffer), PRETTIFY_SEXPR_PASSTHROUGH_MIN_SPAN, passthrough_flush_handler,
+                                            &output))
+        {
+            fprintf(stderr, "Could not set up the passthrough writer\n");
+            sexp_prettify_gzip_reader_free(&reader);
+            return EXIT_FAILURE;
+        }
 
-    // Process Source Files
-    char src_char;
-    while ((src_char = fgetc(src_file)) != EOF)
+        src_ok = prettify_mmap(&state, minify_mode ? &minify : NULL, passthrough_used ? &passthrough : NULL, &sink, src_fd, src_stat.st_size, thread_count);
+        src_backend = src_ok ? (passthrough_used ? "mmap (passthrough)" : thread_count == 1 ? "mmap" : "mmap (parallel)") : "read (mmap failed)";
+
+        if (src_ok && passthrough_used)
+        {
+            dst_backend = "writev";
+            if (verbose)
+            {
+                fprintf(stderr, "Passthrough: %llu of %llu output bytes written straight from the input\n", (unsigned long long)passthrough.passthrough_bytes,
+                        (unsigned long long)(passthrough.passthrough_bytes + passthrough.copied_bytes));
+            }
+        }
+    }
+
+    if (!src_ok && !pipelined)
+    {
+        src_ok = prettify_read(&state, minify_mode ? &minify : NULL, &sink, &reader);
+    }
+
+    sexp_prettify_sink_flush(&sink);
+    cli_output_submit(&output);
+
+    if (verbose)
     {
-        sexp_prettify(&state, src_char, &putc_handler, dst_file);
+        fprintf(stderr, "I/O backend: input %s, output %s\n", src_backend, dst_backend);
+    }
+
+    if (stats_format != STATS_FORMAT_NONE)
+    {
+        print_stats(stderr, &stats, stats_format);
     }
 
     // Wrapup and Cleanup
-    fclose(src_file);
-    if (dst_file != stdout)
+    close(src_fd);
+    if (dst_fd != STDOUT_FILENO)
+    {
+        close(dst_fd);
+    }
+
+    if (!src_ok)
     {
-        fclose(dst_file);
+        report_read_error(&reader);
+        sexp_prettify_gzip_reader_free(&reader);
+        return EXIT_FAILURE;
+    }
+    sexp_prettify_gzip_reader_free(&reader);
+
+    if (output.failed)
+    {
+        if (dst_error != 0)
+        {
+            errno = dst_error;
+        }
+        perror("Error writing destination file");
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 import argparse
+import os
+import re
 import sys
 
 def prettify(source, 
@@ -161,7 +163,7 @@ def prettify(source,
                 formatted.append(indent_char * list_depth * indent_size)
                 column = list_depth * indent_size
                 space_pending = False
-            elif space_pending and not shortform_mode and not compact_list_mode and column >= consecutive_token_wrap_threshold:
+            elif space_pending and not shortform_mode and not compact_list_mode and consecutive_token_wrap_threshold > 0 and column >= consecutive_token_wrap_threshold:
                 # Token is above wrap threshold. Move token to next line (If token wrap threshold is zero then this feature is disabled)
                 wrapped_list = True
                 formatted.append('\n')
@@ -186,6 +188,94 @@ def prettify(source,
     return ''.join(formatted)
 
 
+def minify(source):
+    """
+    Strips the whitespace of KiCad-like S-expressions that does not change the prettify() output.
+    Whitespace before a token, or before a list that follows a token, is collapsed into one space.
+    Whitespace before ')' or between parentheses is dropped. The result has no line breaks at all.
+
+    Args:
+        source (str): The source S-expression string.
+
+    Returns:
+        str: The minified S-expression.
+    """
+
+    minified = []
+    previous_output = ''
+    in_quote = False
+    escape_next_char = False
+    space_pending = False
+
+    for c in source:
+
+        # Parse quoted strings (Same as prettify())
+        if c == '"' or in_quote:
+            if space_pending:
+                minified.append(' ')
+                space_pending = False
+
+            if escape_next_char:
+                escape_next_char = False
+            elif c == '\\':
+                escape_next_char = True
+            elif c == '"':
+                in_quote = not in_quote
+
+            minified.append(c)
+            previous_output = c
+            continue
+
+        # Parse spaces and newlines
+        if c.isspace():
+            space_pending = True
+            continue
+
+        if c == '\0':
+            continue
+
+        if space_pending:
+            after_token = previous_output not in ('(', ')', '')
+            if c != ')' and (c != '(' or after_token):
+                minified.append(' ')
+            space_pending = False
+
+        minified.append(c)
+        previous_output = c
+
+    return ''.join(minified)
+
+
+# Use the C extension module built from sexp_prettify.c (make python) when it is importable. It has the same signature,
+# also takes bytes-like objects and releases the GIL. It formats str as UTF-8 though, so its columns count bytes and only
+# the ASCII whitespace of C isspace() counts as whitespace. Text where that differs from str.isspace() and code points
+# (anything not ASCII, or the \x1c-\x1f separators) takes the pure Python versions, which stay available as below
+python_prettify = prettify
+python_minify = minify
+
+if not os.environ.get("SEXP_PRETTIFY_PURE_PYTHON"):
+    try:
+        import _sexp_prettify
+    except ImportError:
+        _sexp_prettify = None
+
+    if _sexp_prettify:
+        _separators = re.compile('[\x1c-\x1f]')
+
+        def _extension_output_same(source):
+            return not isinstance(source, str) or (source.isascii() and not _separators.search(source))
+
+        def prettify(source, *args, **kwargs):
+            if _extension_output_same(source):
+                return _sexp_prettify.prettify(source, *args, **kwargs)
+            return python_prettify(source, *args, **kwargs)
+
+        def minify(source):
+            if _extension_output_same(source):
+                return _sexp_prettify.minify(source)
+            return python_minify(source)
+
+
 def main():
     parser = argparse.ArgumentParser(
         description="KiCad S-Expression Formatter"
@@ -194,6 +284,7 @@ def main():
     parser.add_argument("dst", nargs="?", default="-", help="Destination file path ('-' for stdout)")
     parser.add_argument("-c", action="store_true", help="Use compact mode")
     parser.add_argument("-p", help="Predefined Style. (kicad, kicad-compact)")
+    parser.add_argument("-m", "--minify", action="store_true", help="Strip all whitespace that does not change the formatted result")
     args = parser.parse_args()
 
     # Read input
@@ -204,7 +295,10 @@ def main():
             source = f.read()
 
     # Process formatting
-    result = prettify(source = source, compact_save = args.c or args.p == "kicad-compact")
+    if args.minify:
+        result = minify(source)
+    else:
+        result = prettify(source = source, compact_save = args.c or args.p == "kicad-compact")
 
     # Write output
     if args.dst == "-":
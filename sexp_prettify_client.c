@@ -0,0 +1,569 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Thin client of the formatter server (sexp_prettify_cli --serve). Takes the same formatting options as sexp_prettify_cli
+// and sends the source (or its path) to the server instead of formatting it in process.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_server.h"
+
+#define CLIENT_READ_SIZE (64 * 1024)
+
+typedef struct clientOutput
+{
+    int fd;
+    bool failed;
+    bool discard; ///< Repeated requests after the first only measure latency
+    const struct PrettifySExprServerResponse *response;
+    char error[256];
+    size_t error_size;
+} clientOutput;
+
+static void output_handler(const char *buffer, size_t size, void *context)
+{
+    clientOutput *output = (clientOutput *)context;
+
+    // Keep the start of an error message for the report
+    if (output->response->status == PRETTIFY_SEXPR_SERVER_STATUS_ERROR)
+    {
+        const size_t count = size < sizeof(output->error) - 1 - output->error_size ? size : sizeof(output->error) - 1 - output->error_size;
+        memcpy(output->error + output->error_size, buffer, count);
+        output->error_size += count;
+        output->error[output->error_size] = '\0';
+        return;
+    }
+
+    while (size > 0 && !output->discard && !output->failed)
+    {
+        ssize_t written = write(output->fd, buffer, size);
+        if (written < 0)
+        {
+            if (errno != EINTR)
+            {
+                output->failed = true;
+            }
+            continue;
+        }
+        buffer += written;
+        size -= written;
+    }
+}
+
+static uint64_t now_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Whole source for a payload request. Regular files are mapped, anything else is read until its end
+static char *load_source(int fd, size_t *size, bool *mapped)
+{
+    struct stat src_stat;
+    *mapped = false;
+    if (fstat(fd, &src_stat) == 0 && S_ISREG(src_stat.st_mode) && src_stat.st_size > 0)
+    {
+        void *src_map = mmap(NULL, src_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (src_map != MAP_FAILED)
+        {
+            *size = src_stat.st_size;
+            *mapped = true;
+            return (char *)src_map;
+        }
+    }
+
+    char *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    while (true)
+    {
+        if (capacity - *size < CLIENT_READ_SIZE)
+        {
+            capacity = capacity ? capacity * 2 : CLIENT_READ_SIZE;
+            char *grown = realloc(data, capacity);
+            if (!grown)
+            {
+                free(data);
+                errno = ENOMEM;
+                return NULL;
+            }
+            data = grown;
+        }
+
+        ssize_t count = read(fd, data + *size, capacity - *size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            free(data);
+            return NULL;
+        }
+
+        if (count == 0)
+        {
+            return data;
+        }
+        *size += count;
+    }
+}
+
+void usage(const char *prog_name, bool full)
+{
+    if (full)
+    {
+        printf("S-Expression Formatter Client (Brian Khuu 2024)\n");
+        printf("\n");
+    }
+
+    printf("Usage:\n");
+    printf("  %s [OPTION]... SOURCE [DESTINATION]\n", prog_name);
+    printf("  %s [OPTION]... --check SOURCE\n", prog_name);
+    printf("  %s [--socket=SOCKET] --server-stats\n", prog_name);
+    if (!full)
+    {
+        printf("  %s -h          Show Full Help Message\n", prog_name);
+    }
+    printf("  SOURCE             Source file path. If '-' then use standard stream input\n");
+    printf("  DESTINATION        Destination file path. If omitted or '-' then use standard stream output\n");
+    printf("\n");
+
+    if (full)
+    {
+        printf("Formats through a running server (sexp_prettify_cli --serve) with the formatting options of sexp_prettify_cli.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf("  -h                 Show Help Message\n");
+        printf("  -w WRAP_THRESHOLD  Set Wrap Threshold. Must be postive value. (default %d)\n", PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+        printf("  -l COMPACT_LIST    Add To Compact List. Must be a string. \n");
+        printf("  -k COLUMN_LIMIT    Add To Compact List Column Limit. Must be positive value. (default %d)\n", PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+        printf("  -s SHORTFORM       Add To Shortform List. Must be a string.\n");
+        printf("  -p PROFILE         Predefined Style. (kicad, kicad-compact)\n");
+        printf("  -v                 Verbose. Report the round trip and server latency to standard error\n");
+        printf("  -c, --check        Check. Exit with 1 and report the offset and line of the first difference if SOURCE is not already formatted\n");
+        printf("  -m, --minify       Minify. Strip all whitespace that does not change the formatted result (Formatting it again gives the same output)\n");
+        printf("  --socket=SOCKET    Server socket. Defaults to $SEXP_PRETTIFY_SOCKET, else $XDG_RUNTIME_DIR/sexp_prettify.sock, else /tmp/sexp_prettify-UID.sock\n");
+        printf("  --send-path        Send the absolute path of SOURCE for the server to read, instead of its content (Same file system only)\n");
+        printf("  --repeat=N         Send the request N times, each on a new connection, and report p50/p99 latency to standard error\n");
+        printf("  --server-stats     Print the request count and p50/p99 latency of the server since it started\n");
+        printf("\n");
+        printf("Example:\n");
+        printf("  - Format a board file through the server in place of sexp_prettify_cli.\n");
+        printf("    %s -p kicad board.kicad_pcb formatted.kicad_pcb\n", prog_name);
+        printf("  - Measure the latency of 1000 check requests.\n");
+        printf("    %s -p kicad --check --repeat=1000 board.kicad_pcb\n", prog_name);
+    }
+}
+
+// Main function
+int main(int argc, char **argv)
+{
+    const char *prog_name = argv[0];
+
+    struct PrettifySExprServerRequest request = {
+        .magic = PRETTIFY_SEXPR_SERVER_REQUEST_MAGIC,
+        .kind = PRETTIFY_SEXPR_SERVER_KIND_PAYLOAD,
+        .mode = PRETTIFY_SEXPR_SERVER_MODE_PRETTIFY,
+        .profile = PRETTIFY_SEXPR_SERVER_PROFILE_NONE,
+        .consecutive_token_wrap_threshold = PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD,
+        .compact_list_column_limit = PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT,
+    };
+
+    // Prefixes added with -l and -s after the last -p. Compact list ones go first in the style block
+    const char **compact_list_prefixes = calloc(argc, sizeof(*compact_list_prefixes));
+    const char **shortform_prefixes = calloc(argc, sizeof(*shortform_prefixes));
+    int compact_list_prefixes_entries_count = 0;
+    int shortform_prefixes_entries_count = 0;
+
+    char socket_path[PATH_MAX];
+    bool socket_path_set = false;
+    bool verbose = false;
+    bool send_path = false;
+    bool server_stats = false;
+    unsigned long repeat_count = 1;
+
+    if (!compact_list_prefixes || !shortform_prefixes)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    while (optind < argc)
+    {
+        static const struct option long_options[] = {
+            {"help", no_argument, NULL, 'h'},
+            {"check", no_argument, NULL, 'c'},
+            {"minify", no_argument, NULL, 'm'},
+            {"socket", required_argument, NULL, 'X'},
+            {"send-path", no_argument, NULL, 'F'},
+            {"repeat", required_argument, NULL, 'R'},
+            {"server-stats", no_argument, NULL, 'Q'},
+            {NULL, 0, NULL, 0},
+        };
+
+        const char c = getopt_long(argc, argv, "hw:l:s:p:k:vcm", long_options, NULL);
+        if (c == -1)
+        {
+            break;
+        }
+
+        switch (c)
+        {
+            case 'h':
+            {
+                usage(prog_name, true);
+                return EXIT_SUCCESS;
+            }
+
+            case 'l':
+            {
+                compact_list_prefixes[compact_list_prefixes_entries_count++] = optarg;
+                break;
+            }
+
+            case 's':
+            {
+                shortform_prefixes[shortform_prefixes_entries_count++] = optarg;
+                break;
+            }
+
+            case 'w':
+            case 'k':
+            {
+                const int value = atoi(optarg);
+
+                if (value < 0)
+                {
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                if (c == 'w')
+                {
+                    request.consecutive_token_wrap_threshold = value;
+                }
+                else
+                {
+                    request.compact_list_column_limit = value;
+                }
+                break;
+            }
+
+            case 'v':
+            {
+                verbose = true;
+                break;
+            }
+
+            case 'c':
+            {
+                request.mode = PRETTIFY_SEXPR_SERVER_MODE_CHECK;
+                break;
+            }
+
+            case 'm':
+            {
+                request.mode = PRETTIFY_SEXPR_SERVER_MODE_MINIFY;
+                break;
+            }
+
+            case 'X':
+            {
+                if (snprintf(socket_path, sizeof(socket_path), "%s", optarg) >= (int)sizeof(socket_path))
+                {
+                    fprintf(stderr, "Socket path is too long\n");
+                    return EXIT_FAILURE;
+                }
+                socket_path_set = true;
+                break;
+            }
+
+            case 'F':
+            {
+                send_path = true;
+                break;
+            }
+
+            case 'R':
+            {
+                const long value = atol(optarg);
+
+                if (value < 1)
+                {
+                    fprintf(stderr, "Repeat count must be at least 1\n");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                repeat_count = value;
+                break;
+            }
+
+            case 'Q':
+            {
+                server_stats = true;
+                break;
+            }
+
+            case 'p':
+            {
+                // Like sexp_prettify_cli a profile replaces the prefixes given before it
+                if (strcmp("kicad", optarg) == 0)
+                {
+                    request.profile = PRETTIFY_SEXPR_SERVER_PROFILE_KICAD;
+                }
+                else if (strcmp("kicad-compact", optarg) == 0)
+                {
+                    request.profile = PRETTIFY_SEXPR_SERVER_PROFILE_KICAD_COMPACT;
+                }
+                else
+                {
+                    fprintf(stderr, "Must be either 'kicad' or 'kicad-compact'");
+                    usage(prog_name, false);
+                    return EXIT_FAILURE;
+                }
+
+                compact_list_prefixes_entries_count = 0;
+                shortform_prefixes_entries_count = 0;
+                break;
+            }
+
+            case '?':
+            {
+                usage(prog_name, false);
+                return EXIT_FAILURE;
+            }
+
+            default:
+            {
+                usage(prog_name, false);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (!socket_path_set && !sexp_prettify_server_default_path(socket_path, sizeof(socket_path)))
+    {
+        fprintf(stderr, "Default socket path is too long\n");
+        return EXIT_FAILURE;
+    }
+
+    // Style block of NUL terminated prefixes
+    char *style = NULL;
+    size_t style_size = 0;
+    for (int i = 0; i < compact_list_prefixes_entries_count + shortform_prefixes_entries_count; i++)
+    {
+        const char *prefix = i < compact_list_prefixes_entries_count ? compact_list_prefixes[i] : shortform_prefixes[i - compact_list_prefixes_entries_count];
+        const size_t prefix_size = strlen(prefix) + 1;
+        char *grown = realloc(style, style_size + prefix_size);
+        if (!grown)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+        style = grown;
+        memcpy(style + style_size, prefix, prefix_size);
+        style_size += prefix_size;
+    }
+
+    if (style_size > PRETTIFY_SEXPR_SERVER_MAX_STYLE_SIZE || compact_list_prefixes_entries_count > UINT16_MAX || shortform_prefixes_entries_count > UINT16_MAX)
+    {
+        fprintf(stderr, "Too many compact list or shortform prefixes\n");
+        return EXIT_FAILURE;
+    }
+
+    request.compact_list_prefixes_count = compact_list_prefixes_entries_count;
+    request.shortform_prefixes_count = shortform_prefixes_entries_count;
+    request.style_size = style_size;
+
+    // Get fixed arguments
+    const char *src_path = NULL;
+    const char *dst_path = NULL;
+
+    if (optind < argc)
+    {
+        src_path = argv[optind++];
+    }
+
+    if (optind < argc)
+    {
+        dst_path = argv[optind++];
+    }
+
+    // Payload (or path) of the request
+    char *data = NULL;
+    size_t data_size = 0;
+    bool data_mapped = false;
+    char src_real_path[PATH_MAX];
+
+    if (server_stats)
+    {
+        request = (struct PrettifySExprServerRequest){.magic = PRETTIFY_SEXPR_SERVER_REQUEST_MAGIC, .kind = PRETTIFY_SEXPR_SERVER_KIND_STATS};
+    }
+    else if (!src_path)
+    {
+        fprintf(stderr, "Source Path Missing\n");
+        usage(prog_name, true);
+        return EXIT_SUCCESS;
+    }
+    else if (send_path)
+    {
+        if (strcmp(src_path, "-") == 0 || !realpath(src_path, src_real_path))
+        {
+            fprintf(stderr, "Error resolving source path: %s\n", strcmp(src_path, "-") == 0 ? "Standard input has no path" : strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        request.kind = PRETTIFY_SEXPR_SERVER_KIND_PATH;
+        data = src_real_path;
+        data_size = strlen(src_real_path);
+    }
+    else
+    {
+        int src_fd = STDIN_FILENO;
+        if (strcmp(src_path, "-") != 0)
+        {
+            src_fd = open(src_path, O_RDONLY);
+            if (src_fd < 0)
+            {
+                perror("Error opening source file");
+                return EXIT_FAILURE;
+            }
+        }
+
+        data = load_source(src_fd, &data_size, &data_mapped);
+        if (!data)
+        {
+            perror("Error reading source file");
+            return EXIT_FAILURE;
+        }
+        close(src_fd);
+    }
+    request.size = data_size;
+
+    if (request.size > PRETTIFY_SEXPR_SERVER_MAX_PAYLOAD_SIZE)
+    {
+        fprintf(stderr, "Source is too large for the server (over %d MB)\n", PRETTIFY_SEXPR_SERVER_MAX_PAYLOAD_SIZE >> 20);
+        return EXIT_FAILURE;
+    }
+
+    // Open the destination file else default to standard output
+    int dst_fd = STDOUT_FILENO;
+    if (dst_path && strcmp(dst_path, "-") != 0 && request.mode != PRETTIFY_SEXPR_SERVER_MODE_CHECK)
+    {
+        dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (dst_fd < 0)
+        {
+            perror("Error opening destination file");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Send the request, and repeat it on new connections to measure latency like separate invocations would see it
+    struct PrettifySExprServerResponse response = {0};
+    clientOutput output = {.fd = dst_fd, .response = &response};
+
+    struct PrettifySExprLatency round_trip;
+    struct PrettifySExprLatency server_latency;
+    if (!sexp_prettify_latency_init(&round_trip, repeat_count) || !sexp_prettify_latency_init(&server_latency, repeat_count))
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned long i = 0; i < repeat_count; i++)
+    {
+        const uint64_t start_time = now_nanoseconds();
+
+        const int fd = sexp_prettify_client_connect(socket_path);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Error connecting to %s: %s (Start the server with sexp_prettify_cli --serve)\n", socket_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        output.discard = i > 0;
+        if (!sexp_prettify_client_request(fd, &request, style, data, &response, output_handler, &output))
+        {
+            fprintf(stderr, "Error talking to %s: %s\n", socket_path, strerror(errno));
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        close(fd);
+
+        sexp_prettify_latency_add(&round_trip, now_nanoseconds() - start_time);
+        sexp_prettify_latency_add(&server_latency, response.server_nanoseconds);
+
+        if (response.status == PRETTIFY_SEXPR_SERVER_STATUS_ERROR)
+        {
+            fprintf(stderr, "Server error: %s\n", output.error);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (verbose && repeat_count == 1)
+    {
+        fprintf(stderr, "Latency: round trip %.1f us, server %.1f us\n", round_trip.max / 1e3, server_latency.max / 1e3);
+    }
+    else if (repeat_count > 1)
+    {
+        sexp_prettify_latency_summary(&round_trip, "Round trip", stderr);
+        sexp_prettify_latency_summary(&server_latency, "Server", stderr);
+    }
+
+    // Wrapup and Cleanup
+    sexp_prettify_latency_free(&round_trip);
+    sexp_prettify_latency_free(&server_latency);
+    if (data_mapped)
+    {
+        munmap(data, data_size);
+    }
+    else if (data != src_real_path)
+    {
+        free(data);
+    }
+    free(style);
+    free(compact_list_prefixes);
+    free(shortform_prefixes);
+
+    if (dst_fd != STDOUT_FILENO)
+    {
+        close(dst_fd);
+    }
+
+    if (output.failed)
+    {
+        perror("Error writing destination file");
+        return EXIT_FAILURE;
+    }
+
+    if (response.status == PRETTIFY_SEXPR_SERVER_STATUS_NOT_FORMATTED)
+    {
+        const char *src_name = strcmp(src_path, "-") == 0 ? "<stdin>" : src_path;
+        fprintf(stderr, "%s:%llu:%llu: Not formatted. First difference at byte offset %llu\n", src_name, (unsigned long long)response.line, (unsigned long long)response.column,
+                (unsigned long long)response.offset);
+        return EXIT_FAILURE;
+    }
+
+    if (verbose && request.mode == PRETTIFY_SEXPR_SERVER_MODE_CHECK)
+    {
+        fprintf(stderr, "%s: Formatted\n", strcmp(src_path, "-") == 0 ? "<stdin>" : src_path);
+    }
+
+    return EXIT_SUCCESS;
+}
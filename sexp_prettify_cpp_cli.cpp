@@ -3,9 +3,12 @@
 // This script reformats KiCad-like S-expressions to match a specific formatting style.
 // Note: This script modifies formatting only; it does not perform linting or validation.
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <fstream>
+#include <getopt.h>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -17,6 +20,8 @@ extern "C"
 #include "sexp_prettify.h"
 }
 
+#include "sexp_prettify_template.h"
+
 typedef enum styleProfile
 {
     STYLE_PROFILE_NONE = 0,
@@ -30,6 +35,66 @@ const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad)
 const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
 const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
 
+// Print formatting counters as text or as a single line of json
+void print_stats(std::ostream &out, const PrettifySExprStats &stats, bool json)
+{
+    const std::pair<const char *, unsigned long long> counters[] = {
+        {"input_bytes", stats.input_bytes},
+        {"output_bytes", stats.output_bytes},
+        {"lines", stats.lines},
+        {"lists", stats.lists},
+        {"max_depth", stats.max_depth},
+        {"quoted_bytes", stats.quoted_bytes},
+        {"wrapped_tokens", stats.wrapped_tokens},
+        {"compact_list_lines", stats.compact_list_lines},
+        {"shortform_lists", stats.shortform_lists},
+    };
+
+    if (json)
+    {
+        const char *separator = "";
+        out << "{";
+        for (const auto &counter : counters)
+        {
+            out << separator << "\"" << counter.first << "\": " << counter.second;
+            separator = ", ";
+        }
+        out << "}\n";
+        return;
+    }
+
+    out << "Stats:\n";
+    for (const auto &counter : counters)
+    {
+        out << "  " << std::left << std::setw(20) << counter.first << " " << counter.second << "\n";
+    }
+}
+
+// True if the settings are exactly those of a compile time profile
+template <typename Profile>
+bool settings_match_profile(int wrap_threshold, const std::vector<std::string> &compact_list_prefixes, int compact_list_column_limit, const std::vector<std::string> &shortform_prefixes)
+{
+    return wrap_threshold == (int)Profile::consecutive_token_wrap_threshold && compact_list_column_limit == (int)Profile::compact_list_column_limit &&
+           std::equal(compact_list_prefixes.begin(), compact_list_prefixes.end(), Profile::compact_list_prefixes.begin(), Profile::compact_list_prefixes.end()) &&
+           std::equal(shortform_prefixes.begin(), shortform_prefixes.end(), Profile::shortform_prefixes.begin(), Profile::shortform_prefixes.end());
+}
+
+// Format a stream on the specialized loop of a compile time profile
+template <typename Profile> void prettify_stream(std::istream &src_stream, std::ostream &dst_stream)
+{
+    auto flush_handler = [&dst_stream](const char *buffer, size_t size) { dst_stream.write(buffer, size); };
+    sexp_prettify_template::BufferSink<decltype(flush_handler)> sink(flush_handler);
+    sexp_prettify_template::Formatter<Profile, decltype(sink)> formatter(sink);
+
+    std::vector<char> src_buffer(64 * 1024);
+    while (src_stream.read(src_buffer.data(), src_buffer.size()) || src_stream.gcount() > 0)
+    {
+        formatter.feed(std::string_view(src_buffer.data(), src_stream.gcount()));
+    }
+
+    sink.flush();
+}
+
 // Display usage instructions
 void usage(const std::string &prog_name, bool full = false)
 {
@@ -39,7 +104,8 @@ void usage(const std::string &prog_name, bool full = false)
     }
 
     std::cout << "Usage:\n"
-              << "  " << prog_name << " [OPTION]... SOURCE [DESTINATION]\n";
+              << "  " << prog_name << " [OPTION]... SOURCE [DESTINATION]\n"
+              << "  " << prog_name << " [OPTION]... --check SOURCE\n";
     if (!full)
     {
         std::cout << "  " << prog_name << " -h          Show Full Help Message\n";
@@ -56,6 +122,9 @@ void usage(const std::string &prog_name, bool full = false)
                   << "  -k COLUMN_LIMIT    Set Compact List Column Limit. Must be positive value. (default " << PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT << ")\n"
                   << "  -s SHORTFORM       Add To Shortform List. Must be a string.\n"
                   << "  -p PROFILE         Predefined Style. (kicad, kicad-compact)\n"
+                  << "  -c, --check        Check. Exit with 1 and report the offset and line of the first difference if SOURCE is not already formatted\n"
+                  << "  --stats[=FORMAT]   Print formatting counters (bytes, lines, lists, depth, wrapping...) to standard error. FORMAT is text (default) or json\n"
+                  << "  -m, --minify       Minify. Strip all whitespace that does not change the formatted result (Formatting it again gives the same output)\n"
                   << "Example:\n"
                   << "  - Use standard input and standard output. Also use KiCAD's standard compact list and shortform setting.\n"
                   << "    " << prog_name << " -l pts -s font -s stroke -s fill -s offset -s rotate -s scale - -\n";
@@ -75,10 +144,23 @@ int main(int argc, char **argv)
 
     styleProfile kicad_profile_active = STYLE_PROFILE_NONE;
 
+    bool check_mode = false;
+    bool minify_mode = false;
+    bool stats_mode = false;
+    bool stats_json = false;
+
     // Parse options
     while (optind < argc)
     {
-        const int c = getopt(argc, argv, "hl:s:w:k:p:");
+        static const struct option long_options[] = {
+            {"help", no_argument, nullptr, 'h'},
+            {"check", no_argument, nullptr, 'c'},
+            {"stats", optional_argument, nullptr, 'S'},
+            {"minify", no_argument, nullptr, 'm'},
+            {nullptr, 0, nullptr, 0},
+        };
+
+        const int c = getopt_long(argc, argv, "hl:s:w:k:p:cm", long_options, nullptr);
         if (c == -1)
         {
             break;
@@ -91,6 +173,28 @@ int main(int argc, char **argv)
                 usage(prog_name, true);
                 return EXIT_SUCCESS;
             }
+            case 'c':
+            {
+                check_mode = true;
+                break;
+            }
+            case 'm':
+            {
+                minify_mode = true;
+                break;
+            }
+            case 'S':
+            {
+                stats_mode = true;
+                stats_json = optarg && strcmp("json", optarg) == 0;
+                if (optarg && !stats_json && strcmp("text", optarg) != 0)
+                {
+                    std::cerr << "Stats format must be either 'text' or 'json'\n";
+                    usage(prog_name);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
             case 'l':
             {
                 compact_list_prefixes.emplace_back(optarg);
@@ -193,6 +297,13 @@ int main(int argc, char **argv)
         return EXIT_SUCCESS;
     }
 
+    if (minify_mode && (check_mode || stats_mode))
+    {
+        std::cerr << "Minify can not be combined with --check or --stats\n";
+        usage(prog_name);
+        return EXIT_FAILURE;
+    }
+
     // Set up file streams
     std::unique_ptr<std::ifstream> src_file;
     std::istream *src_stream = &std::cin;
@@ -209,7 +320,7 @@ int main(int argc, char **argv)
 
     std::unique_ptr<std::ofstream> dst_file;
     std::ostream *dst_stream = &std::cout;
-    if (dst_path && strcmp(dst_path, "-") != 0)
+    if (!check_mode && dst_path && strcmp(dst_path, "-") != 0)
     {
         dst_file = std::make_unique<std::ofstream>(dst_path);
         if (!dst_file->is_open())
@@ -225,40 +336,148 @@ int main(int argc, char **argv)
     std::vector<const char *> compact_list_ptrs;
     std::vector<const char *> shortform_ptrs;
 
-    assert(sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, wrap_threshold));
+    bool style_ok = sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, wrap_threshold);
 
-    if (!compact_list_prefixes.empty())
+    if (style_ok && !compact_list_prefixes.empty())
     {
         for (const auto &prefix : compact_list_prefixes)
         {
             compact_list_ptrs.push_back(prefix.c_str());
         }
 
-        assert(sexp_prettify_compact_list_set(&state, compact_list_ptrs.data(), compact_list_ptrs.size(), compact_list_prefixes_wrap_threshold));
+        style_ok = sexp_prettify_compact_list_set(&state, compact_list_ptrs.data(), compact_list_ptrs.size(), compact_list_prefixes_wrap_threshold);
     }
 
-    if (!shortform_prefixes.empty())
+    if (style_ok && !shortform_prefixes.empty())
     {
         for (const auto &prefix : shortform_prefixes)
         {
             shortform_ptrs.push_back(prefix.c_str());
         }
 
-        assert(sexp_prettify_shortform_set(&state, shortform_ptrs.data(), shortform_ptrs.size()));
+        style_ok = sexp_prettify_shortform_set(&state, shortform_ptrs.data(), shortform_ptrs.size());
+    }
+
+    if (!style_ok)
+    {
+        std::cerr << "Too many or too long compact list or shortform prefixes\n";
+        return EXIT_FAILURE;
+    }
+
+    PrettifySExprStats stats = {};
+    if (stats_mode && !sexp_prettify_stats_set(&state, &stats))
+    {
+        std::cerr << "Statistics are not available (built with PRETTIFY_SEXPR_NO_STATS)\n";
+        return EXIT_FAILURE;
+    }
+
+    if (check_mode)
+    {
+        // Compare the output against the source as it streams. Stops at the first difference
+        auto read_handler = [](char *buffer, size_t size, void *context_read) -> size_t
+        {
+            auto &in_stream = *static_cast<std::istream *>(context_read);
+            in_stream.read(buffer, size);
+            return in_stream.gcount();
+        };
+
+        std::vector<char> check_window(256 * 1024);
+        PrettifySExprCheck check;
+        const bool check_ok = sexp_prettify_check(&state, read_handler, src_stream, check_window.data(), check_window.size(), &check);
+        assert(check_ok);
+        if (!check_ok)
+        {
+            return EXIT_FAILURE;
+        }
+
+        if (stats_mode)
+        {
+            print_stats(std::cerr, stats, stats_json);
+        }
+
+        if (!check.canonical)
+        {
+            std::cerr << (strcmp(src_path, "-") == 0 ? "<stdin>" : src_path) << ":" << check.line << ":" << check.column << ": Not formatted. First difference at byte offset " << check.offset << "\n";
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (minify_mode)
+    {
+        auto minify_flush_handler = [](PrettifySExprSink *sink, void *context_flush) { static_cast<std::ostream *>(context_flush)->write(sink->buffer, sink->count); };
+
+        std::vector<char> dst_buffer(64 * 1024);
+        PrettifySExprSink sink;
+        if (!sexp_prettify_sink_init(&sink, dst_buffer.data(), dst_buffer.size(), minify_flush_handler, dst_stream))
+        {
+            std::cerr << "Could not set up the output buffer\n";
+            return EXIT_FAILURE;
+        }
+
+        PrettifySExprMinifyState minify;
+        sexp_prettify_minify_init(&minify);
+
+        std::vector<char> src_buffer(64 * 1024);
+        while (src_stream->read(src_buffer.data(), src_buffer.size()) || src_stream->gcount() > 0)
+        {
+            sexp_prettify_minify_buffer_to_sink(&minify, src_buffer.data(), src_stream->gcount(), &sink);
+        }
+
+        sexp_prettify_sink_flush(&sink);
+        return EXIT_SUCCESS;
+    }
+
+    // Predefined profiles without statistics run on their own specialized formatting loop (Same output as sexp_prettify())
+    if (!stats_mode)
+    {
+        if (settings_match_profile<sexp_prettify_template::ZeroStyleProfile>(wrap_threshold, compact_list_prefixes, compact_list_prefixes_wrap_threshold, shortform_prefixes))
+        {
+            prettify_stream<sexp_prettify_template::ZeroStyleProfile>(*src_stream, *dst_stream);
+            return EXIT_SUCCESS;
+        }
+
+        if (settings_match_profile<sexp_prettify_template::KicadProfile>(wrap_threshold, compact_list_prefixes, compact_list_prefixes_wrap_threshold, shortform_prefixes))
+        {
+            prettify_stream<sexp_prettify_template::KicadProfile>(*src_stream, *dst_stream);
+            return EXIT_SUCCESS;
+        }
+
+        if (settings_match_profile<sexp_prettify_template::KicadCompactProfile>(wrap_threshold, compact_list_prefixes, compact_list_prefixes_wrap_threshold, shortform_prefixes))
+        {
+            prettify_stream<sexp_prettify_template::KicadCompactProfile>(*src_stream, *dst_stream);
+            return EXIT_SUCCESS;
+        }
     }
 
     // Define the lambda closer to usage
-    auto putc_handler = [](char ch, void *context_putc)
+    auto flush_handler = [](PrettifySExprSink *sink, void *context_flush)
     {
-        auto &out_stream = *static_cast<std::ostream *>(context_putc);
-        out_stream.put(ch);
+        auto &out_stream = *static_cast<std::ostream *>(context_flush);
+        out_stream.write(sink->buffer, sink->count);
     };
 
+    std::vector<char> dst_buffer(64 * 1024);
+    PrettifySExprSink sink;
+    if (!sexp_prettify_sink_init(&sink, dst_buffer.data(), dst_buffer.size(), flush_handler, dst_stream))
+    {
+        std::cerr << "Could not set up the output buffer\n";
+        return EXIT_FAILURE;
+    }
+
     // Process the input
-    char c;
-    while (src_stream->get(c))
+    std::vector<char> src_buffer(64 * 1024);
+    while (src_stream->read(src_buffer.data(), src_buffer.size()) || src_stream->gcount() > 0)
+    {
+        sexp_prettify_buffer_to_sink(&state, src_buffer.data(), src_stream->gcount(), &sink);
+    }
+
+    sexp_prettify_sink_flush(&sink);
+
+    if (stats_mode)
     {
-        sexp_prettify(&state, c, putc_handler, dst_stream);
+        print_stats(std::cerr, stats, stats_json);
     }
 
     return EXIT_SUCCESS;
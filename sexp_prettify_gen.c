@@ -0,0 +1,601 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Synthetic KiCad shaped S-expression generator for scaling tests and benchmarks.
+// Output only depends on the seed and knobs, so the same command line always produces the same bytes.
+
+#define _DEFAULT_SOURCE
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sexp_prettify.h"
+
+typedef enum styleProfile
+{
+    STYLE_PROFILE_MINIFIED = 0,
+    STYLE_PROFILE_NONE,
+    STYLE_PROFILE_KICAD_STANDARD,
+    STYLE_PROFILE_KICAD_COMPACT,
+} styleProfile;
+
+const char *compact_list_prefixes_kicad[] = {"pts"};
+const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad) / sizeof(compact_list_prefixes_kicad[0]);
+
+const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
+
+const char *gen_layers[] = {"F.Cu", "B.Cu", "F.SilkS", "B.SilkS", "F.Fab", "B.Fab", "F.CrtYd", "Edge.Cuts", "Dwgs.User", "User.1"};
+const int gen_layers_size = sizeof(gen_layers) / sizeof(gen_layers[0]);
+
+const char *gen_words[] = {"GND", "VCC", "R", "C", "U", "SW", "LED", "Net", "clk", "data", "3V3", "10k", "100nF", "Resistor_SMD", "0603", "Connector"};
+const int gen_words_size = sizeof(gen_words) / sizeof(gen_words[0]);
+
+#define GEN_IO_BUFFER_SIZE (64 * 1024)
+#define GEN_IMAGE_TOKEN_SIZE 76
+
+typedef struct genKnobs
+{
+    uint64_t target_size;
+    uint64_t seed;
+    int depth;
+    int quote_percent;
+    int pts_count;
+    int shortform_percent;
+    int image_percent;
+    size_t image_size;
+    styleProfile profile;
+} genKnobs;
+
+typedef struct genContext
+{
+    const genKnobs *knobs;
+    uint64_t rng;
+
+    FILE *out;
+    bool failed;
+    uint64_t bytes_written;
+
+    // Formatted output is produced by running the generated minified text through the engine
+    bool format;
+    struct PrettifySExprState state;
+    struct PrettifySExprSink sink;
+
+    unsigned int item_count;
+} genContext;
+
+static char dst_buffer[GEN_IO_BUFFER_SIZE];
+
+/*
+ * Random Numbers (splitmix64)
+ */
+
+static uint64_t gen_rand(genContext *gen)
+{
+    uint64_t z = (gen->rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static unsigned int gen_range(genContext *gen, unsigned int count)
+{
+    return (unsigned int)(gen_rand(gen) % count);
+}
+
+static bool gen_chance(genContext *gen, int percent)
+{
+    return (int)gen_range(gen, 100) < percent;
+}
+
+/*
+ * Output
+ */
+
+static void gen_flush_handler(struct PrettifySExprSink *sink, void *context)
+{
+    genContext *gen = (genContext *)context;
+    if (!gen->failed && fwrite(sink->buffer, 1, sink->count, gen->out) != sink->count)
+    {
+        gen->failed = true;
+    }
+    gen->bytes_written += sink->count;
+}
+
+static void gen_write(genContext *gen, const char *str, size_t size)
+{
+    if (gen->format)
+    {
+        sexp_prettify_buffer_to_sink(&gen->state, str, size, &gen->sink);
+    }
+    else
+    {
+        sexp_prettify_sink_write(&gen->sink, str, size);
+    }
+}
+
+static void gen_printf(genContext *gen, const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    const int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    gen_write(gen, buffer, size < (int)sizeof(buffer) ? (size_t)size : sizeof(buffer) - 1);
+}
+
+static uint64_t gen_size(const genContext *gen)
+{
+    return gen->bytes_written + gen->sink.count;
+}
+
+/*
+ * Atoms
+ */
+
+// Millimetres as KiCad writes them (up to 4 decimals, no trailing zeros)
+static void gen_number(genContext *gen, int range_mm)
+{
+    const long value = (long)gen_range(gen, (unsigned int)range_mm * 10000) - (range_mm * 10000) / 2;
+    const long whole = labs(value) / 10000;
+    long fraction = labs(value) % 10000;
+
+    char buffer[32];
+    int size = snprintf(buffer, sizeof(buffer), " %s%ld", value < 0 ? "-" : "", whole);
+    if (fraction)
+    {
+        int digits = 4;
+        while (fraction % 10 == 0)
+        {
+            fraction /= 10;
+            digits--;
+        }
+        size += snprintf(buffer + size, sizeof(buffer) - size, ".%0*ld", digits, fraction);
+    }
+    gen_write(gen, buffer, size);
+}
+
+static void gen_uuid(genContext *gen)
+{
+    const uint64_t a = gen_rand(gen);
+    const uint64_t b = gen_rand(gen);
+    gen_printf(gen, " (uuid \"%08x-%04x-%04x-%04x-%012llx\")", (unsigned int)(a >> 32), (unsigned int)(a >> 16) & 0xFFFF, (unsigned int)a & 0xFFFF, (unsigned int)(b >> 48),
+               (unsigned long long)(b & 0xFFFFFFFFFFFFull));
+}
+
+static void gen_layer(genContext *gen)
+{
+    gen_printf(gen, " (layer \"%s\")", gen_layers[gen_range(gen, gen_layers_size)]);
+}
+
+// Names and free text. Quoted strings may hold spaces, brackets and escaped quotes that the formatter must pass through
+static void gen_text(genContext *gen)
+{
+    const char *word = gen_words[gen_range(gen, gen_words_size)];
+    if (!gen_chance(gen, gen->knobs->quote_percent))
+    {
+        gen_printf(gen, " %s%u", word, gen_range(gen, 1000));
+        return;
+    }
+
+    switch (gen_range(gen, 4))
+    {
+        case 0:
+            gen_printf(gen, " \"%s (%u) \\\"%s\\\"\"", word, gen_range(gen, 100), gen_words[gen_range(gen, gen_words_size)]);
+            break;
+        case 1:
+            gen_printf(gen, " \"\"");
+            break;
+        default:
+            gen_printf(gen, " \"%s %s%u\"", word, gen_words[gen_range(gen, gen_words_size)], gen_range(gen, 1000));
+            break;
+    }
+}
+
+/*
+ * Items
+ */
+
+static void gen_stroke(genContext *gen)
+{
+    if (gen_chance(gen, gen->knobs->shortform_percent))
+    {
+        gen_printf(gen, " (stroke (width 0.%u) (type %s))", 1 + gen_range(gen, 9), gen_range(gen, 4) ? "solid" : "dash");
+    }
+}
+
+static void gen_effects(genContext *gen)
+{
+    if (gen_chance(gen, gen->knobs->shortform_percent))
+    {
+        gen_printf(gen, " (effects (font (size 1.27 1.27) (thickness 0.15))%s)", gen_range(gen, 3) ? "" : " (justify left bottom)");
+    }
+}
+
+static void gen_pts(genContext *gen)
+{
+    gen_printf(gen, " (pts");
+    for (int i = 0; i < gen->knobs->pts_count; i++)
+    {
+        gen_printf(gen, " (xy");
+        gen_number(gen, 300);
+        gen_number(gen, 300);
+        gen_printf(gen, ")");
+    }
+    gen_printf(gen, ")");
+}
+
+static void gen_graphic(genContext *gen)
+{
+    switch (gen_range(gen, 3))
+    {
+        case 0:
+            gen_printf(gen, " (gr_line (start");
+            gen_number(gen, 300);
+            gen_number(gen, 300);
+            gen_printf(gen, ") (end");
+            gen_number(gen, 300);
+            gen_number(gen, 300);
+            gen_printf(gen, ")");
+            gen_stroke(gen);
+            break;
+        case 1:
+            gen_printf(gen, " (gr_poly");
+            gen_pts(gen);
+            gen_stroke(gen);
+            if (gen_chance(gen, gen->knobs->shortform_percent))
+            {
+                gen_printf(gen, " (fill %s)", gen_range(gen, 2) ? "solid" : "none");
+            }
+            break;
+        default:
+            gen_printf(gen, " (gr_text");
+            gen_text(gen);
+            gen_printf(gen, " (at");
+            gen_number(gen, 300);
+            gen_number(gen, 300);
+            gen_printf(gen, " 0)");
+            gen_effects(gen);
+            break;
+    }
+    gen_layer(gen);
+    gen_uuid(gen);
+    gen_printf(gen, ")");
+}
+
+static void gen_property(genContext *gen, const char *key)
+{
+    gen_printf(gen, " (property \"%s\"", key);
+    gen_text(gen);
+    gen_printf(gen, " (at");
+    gen_number(gen, 10);
+    gen_number(gen, 10);
+    gen_printf(gen, " 0)");
+    gen_layer(gen);
+    gen_uuid(gen);
+    gen_effects(gen);
+    gen_printf(gen, ")");
+}
+
+// Graphics nested in up to depth levels of units
+static void gen_unit(genContext *gen, int depth)
+{
+    gen_printf(gen, " (symbol \"unit_%u_%d\"", gen->item_count, depth);
+    const unsigned int graphic_count = 1 + gen_range(gen, 3);
+    for (unsigned int i = 0; i < graphic_count; i++)
+    {
+        gen_graphic(gen);
+    }
+    if (depth > 1)
+    {
+        gen_unit(gen, depth - 1);
+    }
+    gen_printf(gen, ")");
+}
+
+static void gen_footprint(genContext *gen)
+{
+    gen_printf(gen, " (footprint");
+    gen_text(gen);
+    gen_layer(gen);
+    gen_uuid(gen);
+    gen_printf(gen, " (at");
+    gen_number(gen, 300);
+    gen_number(gen, 300);
+    gen_printf(gen, ")");
+    gen_property(gen, "Reference");
+    gen_property(gen, "Value");
+
+    const unsigned int pad_count = 1 + gen_range(gen, 8);
+    for (unsigned int i = 0; i < pad_count; i++)
+    {
+        gen_printf(gen, " (pad \"%u\" smd roundrect (at", i + 1);
+        gen_number(gen, 10);
+        gen_number(gen, 10);
+        gen_printf(gen, ") (size 1.5 0.9) (layers \"F.Cu\" \"F.Paste\" \"F.Mask\") (roundrect_rratio 0.25) (net %u", gen_range(gen, 64));
+        gen_text(gen);
+        gen_printf(gen, ")");
+        gen_uuid(gen);
+        gen_printf(gen, ")");
+    }
+
+    if (gen->knobs->depth > 0)
+    {
+        gen_unit(gen, gen->knobs->depth);
+    }
+
+    gen_printf(gen, " (model \"${KICAD8_3DMODEL_DIR}/Resistor_SMD.3dshapes/R_0603.wrl\" (offset (xyz 0 0 0)) (scale (xyz 1 1 1)) (rotate (xyz 0 0 0))))");
+}
+
+// Long runs of base64 tokens, as KiCad saves embedded images
+static void gen_image(genContext *gen)
+{
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    gen_printf(gen, " (image (at");
+    gen_number(gen, 300);
+    gen_number(gen, 300);
+    gen_printf(gen, ")");
+    gen_layer(gen);
+    gen_uuid(gen);
+    gen_printf(gen, " (data");
+
+    char token[GEN_IMAGE_TOKEN_SIZE + 1];
+    for (size_t remaining = gen->knobs->image_size; remaining > 0;)
+    {
+        const size_t size = remaining < GEN_IMAGE_TOKEN_SIZE ? remaining : GEN_IMAGE_TOKEN_SIZE;
+        token[0] = ' ';
+        for (size_t i = 0; i < size; i++)
+        {
+            token[1 + i] = base64[gen_range(gen, 64)];
+        }
+        gen_write(gen, token, size + 1);
+        remaining -= size;
+    }
+
+    gen_printf(gen, "))");
+}
+
+static void gen_document(genContext *gen)
+{
+    gen_printf(gen, "(kicad_pcb (version 20240108) (generator \"sexp_prettify_gen\") (generator_version \"8.0\") (general (thickness 1.6) (legacy_teardrops no)) (paper \"A4\") (layers");
+    for (int i = 0; i < gen_layers_size; i++)
+    {
+        gen_printf(gen, " (%d \"%s\" %s)", i, gen_layers[i], i < 2 ? "signal" : "user");
+    }
+    gen_printf(gen, ") (setup (pad_to_mask_clearance 0) (allow_soldermask_bridges_in_footprints no))");
+
+    while (!gen->failed && gen_size(gen) < gen->knobs->target_size)
+    {
+        if (gen->knobs->image_size > 0 && gen_chance(gen, gen->knobs->image_percent))
+        {
+            gen_image(gen);
+        }
+        else if (gen_range(gen, 3) == 0)
+        {
+            gen_footprint(gen);
+        }
+        else
+        {
+            gen_graphic(gen);
+        }
+        gen->item_count++;
+    }
+
+    gen_printf(gen, ")\n");
+    sexp_prettify_sink_flush(&gen->sink);
+}
+
+/*
+ * Command Line
+ */
+
+static bool parse_size(const char *str, uint64_t *size)
+{
+    char *end = NULL;
+    const unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+    {
+        return false;
+    }
+
+    switch (*end)
+    {
+        case '\0':
+            *size = value;
+            return true;
+        case 'K':
+        case 'k':
+            *size = value << 10;
+            return end[1] == '\0';
+        case 'M':
+        case 'm':
+            *size = value << 20;
+            return end[1] == '\0';
+        case 'G':
+        case 'g':
+            *size = value << 30;
+            return end[1] == '\0';
+        default:
+            return false;
+    }
+}
+
+static bool parse_int(const char *str, int min, int max, int *value)
+{
+    char *end = NULL;
+    const long parsed = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || parsed < min || parsed > max)
+    {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+void usage(const char *prog_name, bool full)
+{
+    if (full)
+    {
+        printf("S-Expression Synthetic Input Generator (Brian Khuu 2024)\n");
+        printf("\n");
+    }
+
+    printf("Usage:\n");
+    printf("  %s [OPTION]... [DESTINATION]\n", prog_name);
+    printf("  DESTINATION        Output file. If omitted or '-' then write to standard output\n");
+    printf("\n");
+
+    if (full)
+    {
+        printf("Options:\n");
+        printf("  -h                 Show Help Message\n");
+        printf("  -s SIZE            Target output size in bytes with optional K, M or G suffix (default 1M)\n");
+        printf("  -S SEED            Random seed. The same seed and knobs always produce the same output (default 1)\n");
+        printf("  -d DEPTH           Levels of nested (symbol ...) units inside each footprint (default 2)\n");
+        printf("  -q PERCENT         Ratio of names and text written as quoted strings instead of bare tokens (default 50)\n");
+        printf("  -l COUNT           Number of (xy ...) points in each (pts ...) list (default 8)\n");
+        printf("  -f PERCENT         Density of font, stroke and fill shortform lists on items that can have them (default 80)\n");
+        printf("  -i SIZE            Bytes of base64 (data ...) payload per image with optional K or M suffix, 0 for none (default 16K)\n");
+        printf("  -I PERCENT         Ratio of items that are images (default 1)\n");
+        printf("  -p PROFILE         Write pre-formatted output in a style profile (zerostyle, kicad, kicad-compact) instead of minified\n");
+        printf("\n");
+        printf("Example:\n");
+        printf("  - Generate a reproducible 1 GB minified board\n");
+        printf("    %s -s 1G -S 42 board.kicad_pcb\n", prog_name);
+        printf("  - Generate a 100 MB board already in KiCad style (eg. for --check)\n");
+        printf("    %s -s 100M -p kicad board.kicad_pcb\n", prog_name);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *prog_name = argv[0];
+
+    genKnobs knobs = {
+        .target_size = 1 << 20,
+        .seed = 1,
+        .depth = 2,
+        .quote_percent = 50,
+        .pts_count = 8,
+        .shortform_percent = 80,
+        .image_percent = 1,
+        .image_size = 16 * 1024,
+        .profile = STYLE_PROFILE_MINIFIED,
+    };
+
+    int c;
+    while ((c = getopt(argc, argv, "hs:S:d:q:l:f:i:I:p:")) != -1)
+    {
+        bool valid = true;
+        uint64_t size = 0;
+        switch (c)
+        {
+            case 'h':
+                usage(prog_name, true);
+                return EXIT_SUCCESS;
+            case 's':
+                valid = parse_size(optarg, &knobs.target_size);
+                break;
+            case 'S':
+                knobs.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                valid = parse_int(optarg, 0, 64, &knobs.depth);
+                break;
+            case 'q':
+                valid = parse_int(optarg, 0, 100, &knobs.quote_percent);
+                break;
+            case 'l':
+                valid = parse_int(optarg, 0, 1 << 20, &knobs.pts_count);
+                break;
+            case 'f':
+                valid = parse_int(optarg, 0, 100, &knobs.shortform_percent);
+                break;
+            case 'i':
+                valid = parse_size(optarg, &size) && size <= (1u << 30);
+                knobs.image_size = (size_t)size;
+                break;
+            case 'I':
+                valid = parse_int(optarg, 0, 100, &knobs.image_percent);
+                break;
+            case 'p':
+                if (strcmp(optarg, "zerostyle") == 0)
+                {
+                    knobs.profile = STYLE_PROFILE_NONE;
+                }
+                else if (strcmp(optarg, "kicad") == 0)
+                {
+                    knobs.profile = STYLE_PROFILE_KICAD_STANDARD;
+                }
+                else if (strcmp(optarg, "kicad-compact") == 0)
+                {
+                    knobs.profile = STYLE_PROFILE_KICAD_COMPACT;
+                }
+                else
+                {
+                    valid = false;
+                }
+                break;
+            default:
+                valid = false;
+                break;
+        }
+
+        if (!valid)
+        {
+            usage(prog_name, false);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind > 1)
+    {
+        usage(prog_name, false);
+        return EXIT_FAILURE;
+    }
+
+    const char *dst_path = optind < argc ? argv[optind] : "-";
+
+    genContext gen = {0};
+    gen.knobs = &knobs;
+    gen.rng = knobs.seed;
+    gen.out = strcmp(dst_path, "-") == 0 ? stdout : fopen(dst_path, "wb");
+    if (!gen.out)
+    {
+        fprintf(stderr, "Error opening output file: %s\n", dst_path);
+        return EXIT_FAILURE;
+    }
+
+    sexp_prettify_sink_init(&gen.sink, dst_buffer, sizeof(dst_buffer), gen_flush_handler, &gen);
+
+    if (knobs.profile != STYLE_PROFILE_MINIFIED)
+    {
+        gen.format = true;
+        sexp_prettify_init(&gen.state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+
+        if (knobs.profile == STYLE_PROFILE_KICAD_STANDARD || knobs.profile == STYLE_PROFILE_KICAD_COMPACT)
+        {
+            sexp_prettify_compact_list_set(&gen.state, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+        }
+
+        if (knobs.profile == STYLE_PROFILE_KICAD_COMPACT)
+        {
+            sexp_prettify_shortform_set(&gen.state, shortform_prefixes_kicad, shortform_prefixes_kicad_size);
+        }
+    }
+
+    gen_document(&gen);
+
+    if (fflush(gen.out) != 0 || gen.failed || (gen.out != stdout && fclose(gen.out) != 0))
+    {
+        fprintf(stderr, "Error writing output file: %s\n", dst_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,297 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Transparent gzip input and optional gzip output. Run through sexp_prettify_pipeline() to decode and encode on their own threads.
+// Note: Unlike sexp_prettify.c this uses the heap and zlib.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_gzip.h"
+
+// 16 + window bits selects the gzip wrapper in inflateInit2() and deflateInit2()
+#define PRETTIFY_SEXPR_GZIP_WINDOW_BITS (16 + MAX_WBITS)
+
+/*
+ * Reader
+ */
+static size_t sexp_prettify_gzip_read_fd(struct PrettifySExprGzipReader *reader, void *buffer, size_t size)
+{
+    while (true)
+    {
+        const ssize_t read_size = read(reader->fd, buffer, size);
+        if (read_size >= 0)
+        {
+            reader->bytes_in += read_size;
+            return read_size;
+        }
+
+        if (errno != EINTR)
+        {
+            reader->failed = true;
+            reader->error = errno;
+            return 0;
+        }
+    }
+}
+
+bool sexp_prettify_gzip_reader_init(struct PrettifySExprGzipReader *reader, int fd)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    reader->input = malloc(PRETTIFY_SEXPR_GZIP_BUFFER_SIZE);
+    if (!reader->input)
+    {
+        return false;
+    }
+
+    // Only the magic bytes are read here so a regular file can still be mapped as is (Short reads from pipes are retried)
+    while (reader->input_size < 2)
+    {
+        const size_t read_size = sexp_prettify_gzip_read_fd(reader, reader->input + reader->input_size, 2 - reader->input_size);
+        if (read_size == 0)
+        {
+            break;
+        }
+        reader->input_size += read_size;
+    }
+
+    reader->gzip = reader->input_size == 2 && reader->input[0] == 0x1f && reader->input[1] == 0x8b;
+    if (!reader->gzip)
+    {
+        return true;
+    }
+
+    if (inflateInit2(&reader->stream, PRETTIFY_SEXPR_GZIP_WINDOW_BITS) != Z_OK)
+    {
+        free(reader->input);
+        reader->input = NULL;
+        return false;
+    }
+
+    reader->stream.next_in = reader->input;
+    reader->stream.avail_in = reader->input_size;
+    return true;
+}
+
+void sexp_prettify_gzip_reader_free(struct PrettifySExprGzipReader *reader)
+{
+    if (reader->gzip)
+    {
+        inflateEnd(&reader->stream);
+    }
+
+    free(reader->input);
+    reader->input = NULL;
+}
+
+size_t sexp_prettify_gzip_read(char *buffer, size_t size, void *context)
+{
+    struct PrettifySExprGzipReader *reader = (struct PrettifySExprGzipReader *)context;
+
+    if (reader->failed || size == 0)
+    {
+        return 0;
+    }
+
+    if (!reader->gzip)
+    {
+        // Hand back the bytes read while looking for the magic bytes first
+        if (reader->input_pos < reader->input_size)
+        {
+            const size_t pending = reader->input_size - reader->input_pos;
+            const size_t chunk = size < pending ? size : pending;
+            memcpy(buffer, reader->input + reader->input_pos, chunk);
+            reader->input_pos += chunk;
+            return chunk;
+        }
+
+        return sexp_prettify_gzip_read_fd(reader, buffer, size);
+    }
+
+    z_stream *stream = &reader->stream;
+    stream->next_out = (Bytef *)buffer;
+    stream->avail_out = size < UINT_MAX ? (uInt)size : UINT_MAX;
+    const uInt avail_out = stream->avail_out;
+
+    // Fill the whole buffer unless the input ends first
+    while (stream->avail_out > 0)
+    {
+        if (stream->avail_in == 0 && !reader->eof)
+        {
+            const size_t read_size = sexp_prettify_gzip_read_fd(reader, reader->input, PRETTIFY_SEXPR_GZIP_BUFFER_SIZE);
+            if (reader->failed)
+            {
+                break;
+            }
+
+            reader->eof = read_size == 0;
+            stream->next_in = reader->input;
+            stream->avail_in = read_size;
+        }
+
+        if (reader->stream_end)
+        {
+            if (stream->avail_in == 0)
+            {
+                if (reader->eof)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            // Another gzip member follows (eg. files joined with cat)
+            inflateReset(stream);
+            reader->stream_end = false;
+        }
+
+        const int status = inflate(stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+        {
+            reader->stream_end = true;
+        }
+        else if (status == Z_BUF_ERROR && stream->avail_in == 0 && reader->eof)
+        {
+            // Truncated
+            reader->failed = true;
+            break;
+        }
+        else if (status != Z_OK && status != Z_BUF_ERROR)
+        {
+            // Corrupt (or trailing data that is not another gzip member)
+            reader->failed = true;
+            break;
+        }
+    }
+
+    return avail_out - stream->avail_out;
+}
+
+/*
+ * Writer
+ */
+static void sexp_prettify_gzip_write_fd(struct PrettifySExprGzipWriter *writer, const void *src, size_t src_size)
+{
+    const char *data = (const char *)src;
+
+    while (src_size > 0 && !writer->failed)
+    {
+        const ssize_t written = write(writer->fd, data, src_size);
+        if (written < 0)
+        {
+            if (errno != EINTR)
+            {
+                writer->failed = true;
+                writer->error = errno;
+            }
+            continue;
+        }
+
+        writer->bytes_out += written;
+        data += written;
+        src_size -= written;
+    }
+}
+
+// Deflate everything queued in the stream and write out each full (or final) output buffer
+static void sexp_prettify_gzip_deflate(struct PrettifySExprGzipWriter *writer, int flush)
+{
+    z_stream *stream = &writer->stream;
+
+    do
+    {
+        stream->next_out = writer->output;
+        stream->avail_out = PRETTIFY_SEXPR_GZIP_BUFFER_SIZE;
+
+        if (deflate(stream, flush) == Z_STREAM_ERROR)
+        {
+            writer->failed = true;
+            return;
+        }
+
+        sexp_prettify_gzip_write_fd(writer, writer->output, PRETTIFY_SEXPR_GZIP_BUFFER_SIZE - stream->avail_out);
+    } while (stream->avail_out == 0);
+}
+
+bool sexp_prettify_gzip_writer_init(struct PrettifySExprGzipWriter *writer, int fd, int level)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = fd;
+    writer->level = level;
+
+    if (level == PRETTIFY_SEXPR_GZIP_LEVEL_NONE)
+    {
+        return true;
+    }
+
+    if (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION)
+    {
+        return false;
+    }
+
+    writer->output = malloc(PRETTIFY_SEXPR_GZIP_BUFFER_SIZE);
+    if (!writer->output)
+    {
+        return false;
+    }
+
+    if (deflateInit2(&writer->stream, level, Z_DEFLATED, PRETTIFY_SEXPR_GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(writer->output);
+        writer->output = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void sexp_prettify_gzip_writer_free(struct PrettifySExprGzipWriter *writer)
+{
+    if (writer->output)
+    {
+        deflateEnd(&writer->stream);
+        free(writer->output);
+        writer->output = NULL;
+    }
+}
+
+bool sexp_prettify_gzip_write(struct PrettifySExprGzipWriter *writer, const char *src, size_t src_size)
+{
+    if (writer->level == PRETTIFY_SEXPR_GZIP_LEVEL_NONE)
+    {
+        sexp_prettify_gzip_write_fd(writer, src, src_size);
+        return !writer->failed;
+    }
+
+    while (src_size > 0 && !writer->failed)
+    {
+        const uInt chunk = src_size < UINT_MAX ? (uInt)src_size : UINT_MAX;
+        writer->stream.next_in = (Bytef *)src;
+        writer->stream.avail_in = chunk;
+        sexp_prettify_gzip_deflate(writer, Z_NO_FLUSH);
+        src += chunk;
+        src_size -= chunk;
+    }
+
+    return !writer->failed;
+}
+
+bool sexp_prettify_gzip_writer_finish(struct PrettifySExprGzipWriter *writer)
+{
+    if (writer->level != PRETTIFY_SEXPR_GZIP_LEVEL_NONE && !writer->failed)
+    {
+        writer->stream.next_in = NULL;
+        writer->stream.avail_in = 0;
+        sexp_prettify_gzip_deflate(writer, Z_FINISH);
+    }
+
+    return !writer->failed;
+}
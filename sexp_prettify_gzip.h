@@ -0,0 +1,79 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Transparent gzip input and optional gzip output. Run through sexp_prettify_pipeline() to decode and encode on their own threads.
+// Note: Unlike sexp_prettify.c this uses the heap and zlib.
+
+#ifndef SEXP_PRETTIFY_GZIP
+#define SEXP_PRETTIFY_GZIP
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+#include "sexp_prettify.h"
+
+// Size of the compressed side buffer of the reader and the writer
+#define PRETTIFY_SEXPR_GZIP_BUFFER_SIZE (64 * 1024)
+
+// Output is written as is (not compressed) with this level
+#define PRETTIFY_SEXPR_GZIP_LEVEL_NONE (-1)
+
+/*
+ * Reader
+ * Input is detected as gzip by its magic bytes (1f 8b) and inflated, including concatenated gzip members like gunzip.
+ * Anything else is passed through as is, so the reader can stand in for read() on any input.
+ */
+struct PrettifySExprGzipReader
+{
+    int fd;
+    bool gzip;   ///< Input started with the gzip magic bytes
+    bool failed; ///< Read error or corrupt gzip data (sexp_prettify_gzip_read() then returns 0)
+    int error;   ///< errno of the read error, 0 if the gzip data was corrupt or truncated
+    bool eof;
+    bool stream_end;
+    uint64_t bytes_in; ///< Bytes read from fd
+    z_stream stream;
+    unsigned char *input;
+    size_t input_pos;  ///< Pass through only: Bytes of input already returned
+    size_t input_size; ///< Pass through only: Bytes read into input while looking for the magic bytes
+};
+
+// Reads up to the first two bytes of fd to detect gzip. Returns false if out of memory (read errors are reported via failed)
+bool sexp_prettify_gzip_reader_init(struct PrettifySExprGzipReader *reader, int fd);
+void sexp_prettify_gzip_reader_free(struct PrettifySExprGzipReader *reader);
+
+// Same contract as PrettifySExprReadFunc (context is the reader). Returns 0 at the end of input or on error
+size_t sexp_prettify_gzip_read(char *buffer, size_t size, void *context);
+
+/*
+ * Writer
+ * Deflates into a single gzip member at level 1 (fastest) to 9 (smallest), or writes as is with PRETTIFY_SEXPR_GZIP_LEVEL_NONE.
+ */
+struct PrettifySExprGzipWriter
+{
+    int fd;
+    int level;
+    bool failed; ///< Write error. Later writes are dropped
+    int error;   ///< errno of the write error
+    uint64_t bytes_out; ///< Bytes written to fd
+    z_stream stream;
+    unsigned char *output;
+};
+
+bool sexp_prettify_gzip_writer_init(struct PrettifySExprGzipWriter *writer, int fd, int level);
+void sexp_prettify_gzip_writer_free(struct PrettifySExprGzipWriter *writer);
+bool sexp_prettify_gzip_write(struct PrettifySExprGzipWriter *writer, const char *src, size_t src_size);
+
+// Ends the gzip member. Must be called once after the last write
+bool sexp_prettify_gzip_writer_finish(struct PrettifySExprGzipWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
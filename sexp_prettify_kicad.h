@@ -0,0 +1,384 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Allocation free variant of Prettify() in sexp_prettify_kicad_cli.cpp with byte identical output.
+// Reads a std::string_view and writes through an output iterator, so nothing is allocated unless the iterator does.
+// PrettifyChunk() and PrettifyStream take the input in chunks, so memory use does not grow with the input size.
+
+#ifndef SEXP_PRETTIFY_KICAD
+#define SEXP_PRETTIFY_KICAD
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+
+namespace sexp_prettify_kicad
+{
+
+// Configuration (Same as Prettify())
+constexpr char kQuoteChar = '"';
+constexpr char kIndentChar = '\t';
+constexpr unsigned int kIndentSize = 1;
+
+// Lists exceeding this wrap threshold will be shifted to the next line
+constexpr unsigned int kCompactListColumnLimit = 99;
+constexpr std::string_view kCompactListPrefixes[] = {"pts"};
+
+// Tokens exceeding this wrap threshold will be shifted to the next line
+constexpr unsigned int kConsecutiveTokenWrapThreshold = 72;
+constexpr std::string_view kShortformPrefixes[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+
+// Longest prefix worth buffering. Longer list names can not match
+constexpr std::size_t kPrefixTokenMax = 8;
+
+template <std::size_t N> constexpr bool PrefixListContains(const std::string_view (&aPrefixes)[N], std::string_view aToken)
+{
+    for (const std::string_view prefix : aPrefixes)
+    {
+        if (prefix == aToken)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <std::size_t N> constexpr std::size_t PrefixListLongest(const std::string_view (&aPrefixes)[N])
+{
+    std::size_t longest = 0;
+    for (const std::string_view prefix : aPrefixes)
+    {
+        longest = std::max(longest, prefix.size());
+    }
+    return longest;
+}
+
+static_assert(kPrefixTokenMax >= PrefixListLongest(kCompactListPrefixes) && kPrefixTokenMax >= PrefixListLongest(kShortformPrefixes), "Prefix buffer too small for the prefix tables");
+
+template <typename OutputIt> OutputIt NewlineIndent(OutputIt aOut, unsigned int aDepth)
+{
+    *aOut++ = '\n';
+    return std::fill_n(aOut, aDepth * kIndentSize, kIndentChar);
+}
+
+// Streaming state of PrettifyChunk(). Fixed size (The list depth is only a counter) so any amount of input can be
+// formatted in chunks with constant memory
+struct PrettifyState
+{
+    explicit PrettifyState(bool aCompactSave = false) : compactSave(aCompactSave) {}
+
+    bool compactSave;
+
+    // Parsing Position Tracking
+    unsigned int listDepth = 0;
+    unsigned int column = 0;
+    char previousNonSpaceOutput = '\0';
+
+    // Parsing state
+    bool inQuote = false;
+    bool escapeNextChar = false;
+    bool singularElement = false;
+    bool spacePending = false;
+    bool wrappedList = false;
+
+    // Prefix scanner to check if a list should be specially handled (prefixLength > kPrefixTokenMax once too long to match)
+    bool scanningForPrefix = false;
+    char prefixToken[kPrefixTokenMax] = {};
+    std::size_t prefixLength = 0;
+
+    // Fixed listDepth feature to place multiple elements in the same line for compactness
+    bool compactListMode = false;
+    unsigned int compactListIndent = 0;
+
+    // Fixed listDepth feature to place multiple elements in the same line for compactness
+    bool shortformMode = false;
+    unsigned int shortformIndent = 0;
+};
+
+/*
+ * Same rules and output as Prettify(), except:
+ *  - The prefix of each list is kept in a fixed buffer and compared against constexpr tables (No string copies)
+ *  - Output goes straight to aOut instead of into a second string
+ *  - Input may be split at any byte across calls with the same aState, and the output is the same as for the whole input
+ * Returns the output iterator past the last written character.
+ */
+template <typename OutputIt> OutputIt PrettifyChunk(PrettifyState &aState, std::string_view aChunk, OutputIt aOut)
+{
+    // Kept in a local copy so the compiler can hold it in registers (Writes through aOut may otherwise alias aState)
+    PrettifyState s = aState;
+
+    for (const char c : aChunk)
+    {
+        // Parse quoted string
+        if (c == kQuoteChar || s.inQuote)
+        {
+            if (s.spacePending)
+            {
+                // Add space before this quoted string
+                *aOut++ = ' ';
+                s.column += 1;
+                s.spacePending = false;
+            }
+
+            if (s.escapeNextChar)
+            {
+                s.escapeNextChar = false;
+            }
+            else if (c == '\\')
+            {
+                s.escapeNextChar = true;
+            }
+            else if (c == kQuoteChar)
+            {
+                s.inQuote = !s.inQuote;
+            }
+
+            *aOut++ = c;
+            s.column += 1;
+            s.previousNonSpaceOutput = c;
+            continue;
+        }
+
+        // Parse space and newlines
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            s.spacePending = true;
+
+            if (s.scanningForPrefix && s.prefixLength <= kPrefixTokenMax)
+            {
+                // Check if we got a match against an expected prefix
+                const std::string_view token(s.prefixToken, s.prefixLength);
+
+                if (PrefixListContains(kCompactListPrefixes, token))
+                {
+                    s.compactListMode = true;
+                    s.compactListIndent = s.listDepth;
+                }
+
+                if (s.compactSave && PrefixListContains(kShortformPrefixes, token))
+                {
+                    s.shortformMode = true;
+                    s.shortformIndent = s.listDepth;
+                }
+            }
+            s.scanningForPrefix = false;
+            continue;
+        }
+
+        // Parse Opening parentheses
+        if (c == '(')
+        {
+            s.spacePending = false;
+
+            if (s.compactListMode)
+            {
+                if ((s.column < kCompactListColumnLimit && s.previousNonSpaceOutput == ')') || kCompactListColumnLimit == 0)
+                {
+                    // Is a consecutive list and still within s.column limit
+                    *aOut++ = ' ';
+                    s.column += 1;
+                    s.spacePending = false;
+                }
+                else
+                {
+                    // Move this list to the next line
+                    aOut = NewlineIndent(aOut, s.compactListIndent);
+                    s.column = s.compactListIndent * kIndentSize;
+                }
+            }
+            else if (s.shortformMode)
+            {
+                // In one liner mode
+                *aOut++ = ' ';
+                s.column += 1;
+                s.spacePending = false;
+            }
+            else
+            {
+                // Start scanning for prefix for special list handling
+                s.scanningForPrefix = true;
+                s.prefixLength = 0;
+                if (s.listDepth > 0)
+                {
+                    aOut = NewlineIndent(aOut, s.listDepth);
+                    s.column = s.listDepth * kIndentSize;
+                }
+            }
+
+            s.singularElement = true;
+            s.listDepth++;
+
+            *aOut++ = '(';
+            s.column += 1;
+
+            s.previousNonSpaceOutput = '(';
+            continue;
+        }
+
+        // Parse Closing Brace
+        if (c == ')')
+        {
+            const bool currShortformMode = s.shortformMode;
+
+            s.spacePending = false;
+            s.scanningForPrefix = false;
+
+            if (s.listDepth > 0)
+            {
+                s.listDepth--;
+            }
+
+            if (s.compactListMode && s.listDepth < s.compactListIndent)
+            {
+                s.compactListMode = false;
+            }
+
+            if (s.shortformMode && s.listDepth < s.shortformIndent)
+            {
+                s.shortformMode = false;
+            }
+
+            if (s.wrappedList)
+            {
+                // This was a list with wrapped tokens so is already indented
+                aOut = NewlineIndent(aOut, s.listDepth);
+                s.column = s.listDepth * kIndentSize;
+                s.singularElement = false;
+                s.wrappedList = false;
+            }
+            else if (s.singularElement)
+            {
+                s.singularElement = false;
+            }
+            else if (!currShortformMode)
+            {
+                // End of a parent element
+                aOut = NewlineIndent(aOut, s.listDepth);
+                s.column = s.listDepth * kIndentSize;
+            }
+
+            *aOut++ = ')';
+            s.column += 1;
+
+            if (s.listDepth <= 0)
+            {
+                // Cap Root Element
+                *aOut++ = '\n';
+                s.column = 0;
+            }
+
+            s.previousNonSpaceOutput = ')';
+            continue;
+        }
+
+        // Parse Characters
+        if (c != '\0')
+        {
+            if (s.previousNonSpaceOutput == ')' && !s.shortformMode)
+            {
+                // Is Bare token after a list that should be on next line
+                aOut = NewlineIndent(aOut, s.listDepth);
+                s.column = s.listDepth * kIndentSize;
+                s.spacePending = false;
+            }
+            else if (s.spacePending && !s.shortformMode && !s.compactListMode && s.column >= kConsecutiveTokenWrapThreshold)
+            {
+                // Token is above wrap threshold. Move token to next line
+                s.wrappedList = true;
+                aOut = NewlineIndent(aOut, s.listDepth);
+                s.column = s.listDepth * kIndentSize;
+                s.spacePending = false;
+            }
+            else if (s.spacePending && s.previousNonSpaceOutput != '(')
+            {
+                // Space was pending
+                *aOut++ = ' ';
+                s.column += 1;
+                s.spacePending = false;
+            }
+
+            if (s.scanningForPrefix && s.prefixLength <= kPrefixTokenMax)
+            {
+                if (s.prefixLength < kPrefixTokenMax)
+                {
+                    s.prefixToken[s.prefixLength] = c;
+                }
+                s.prefixLength++;
+            }
+
+            *aOut++ = c;
+            s.column += 1;
+
+            s.previousNonSpaceOutput = c;
+            continue;
+        }
+    }
+
+    aState = s;
+    return aOut;
+}
+
+// Whole input in one go
+template <typename OutputIt> OutputIt PrettifyTo(std::string_view aSource, OutputIt aOut, bool aCompactSave = false)
+{
+    PrettifyState state(aCompactSave);
+    return PrettifyChunk(state, aSource, aOut);
+}
+
+/*
+ * Chunks in, chunks out. Output is collected in a fixed buffer and handed to aWriteFunc(const char *, std::size_t)
+ * whenever it fills up, so memory use stays at Size plus PrettifyState however large the input is.
+ * Call Finish() after the last Feed() to write out the rest.
+ */
+template <typename WriteFunc, std::size_t Size = 64 * 1024> class PrettifyStream
+{
+  public:
+    explicit PrettifyStream(WriteFunc aWriteFunc, bool aCompactSave = false) : mWriteFunc(aWriteFunc), mState(aCompactSave) {}
+
+    void Feed(std::string_view aChunk) { PrettifyChunk(mState, aChunk, Inserter{this}); }
+
+    void Finish()
+    {
+        if (mCount > 0)
+        {
+            mWriteFunc(static_cast<const char *>(mBuffer), mCount);
+            mCount = 0;
+        }
+    }
+
+  private:
+    // Output iterator appending to the buffer
+    struct Inserter
+    {
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        PrettifyStream *mStream;
+
+        Inserter &operator=(char c)
+        {
+            if (mStream->mCount == Size)
+            {
+                mStream->Finish();
+            }
+            mStream->mBuffer[mStream->mCount++] = c;
+            return *this;
+        }
+        Inserter &operator*() { return *this; }
+        Inserter &operator++() { return *this; }
+        Inserter &operator++(int) { return *this; }
+    };
+
+    WriteFunc mWriteFunc;
+    PrettifyState mState;
+    std::size_t mCount = 0;
+    char mBuffer[Size];
+};
+
+} // namespace sexp_prettify_kicad
+
+#endif
@@ -10,6 +10,12 @@
 #include <unistd.h>
 #include <vector>
 
+#include "sexp_prettify_kicad.h"
+
+// Namespaced so sexp_prettify_bench can link this engine next to the others
+namespace sexp_prettify_kicad
+{
+
 void Prettify(std::string &aSource, bool aCompactSave = false)
 {
     // Configuration
@@ -323,6 +329,10 @@ void Prettify(std::string &aSource, bool aCompactSave = false)
     aSource = std::move(formatted);
 }
 
+} // namespace sexp_prettify_kicad
+
+#ifndef SEXP_PRETTIFY_NO_MAIN
+
 // Display usage instructions
 void usage(const std::string &prog_name, bool full)
 {
@@ -342,6 +352,7 @@ void usage(const std::string &prog_name, bool full)
                   << "  -h                 Show Help Message\n"
                   << "  -c                 Use Compact Mode.\n"
                   << "  -p PROFILE         Predefined Style. (kicad, kicad-compact)\n"
+                  << "  -s                 Stream. Format in fixed size chunks through PrettifyStream (constant memory) instead of reading SOURCE into memory\n"
                   << "Example:\n"
                   << "  - Use standard input and standard output. Also use KiCAD's standard compact list and shortform setting.\n"
                   << "    " << prog_name << " - -\n";
@@ -352,11 +363,12 @@ int main(int argc, char **argv)
 {
     const std::string prog_name = argv[0];
     bool compactsave = false;
+    bool stream_mode = false;
 
     // Parse options
     while (optind < argc)
     {
-        const int c = getopt(argc, argv, "hcp:");
+        const int c = getopt(argc, argv, "hcp:s");
         if (c == -1)
         {
             break;
@@ -382,6 +394,11 @@ int main(int argc, char **argv)
                 }
                 break;
             }
+            case 's':
+            {
+                stream_mode = true;
+                break;
+            }
             case '?':
             {
                 usage(prog_name, false);
@@ -442,14 +459,32 @@ int main(int argc, char **argv)
         dst_stream = dst_file.get();
     }
 
+    if (stream_mode)
+    {
+        // Only one input chunk and one output buffer are held at a time
+        char chunk[64 * 1024];
+        auto write = [dst_stream](const char *buffer, std::size_t size) { dst_stream->write(buffer, size); };
+        sexp_prettify_kicad::PrettifyStream<decltype(write)> stream(write, compactsave);
+
+        while (src_stream->read(chunk, sizeof(chunk)) || src_stream->gcount() > 0)
+        {
+            stream.Feed(std::string_view(chunk, src_stream->gcount()));
+        }
+        stream.Finish();
+
+        return EXIT_SUCCESS;
+    }
+
     // Read input into a string
     std::string aSource((std::istreambuf_iterator<char>(*src_stream)), std::istreambuf_iterator<char>());
 
     // Process the input
-    Prettify(aSource, compactsave);
+    sexp_prettify_kicad::Prettify(aSource, compactsave);
 
     // Write the result to the output stream
     *dst_stream << aSource;
 
     return EXIT_SUCCESS;
 }
+
+#endif // SEXP_PRETTIFY_NO_MAIN
@@ -10,6 +10,10 @@
 #include <string>
 #include <unistd.h>
 
+// Namespaced so sexp_prettify_bench can link this engine next to the others
+namespace sexp_prettify_kicad_original
+{
+
 void Prettify(std::string &aSource, bool aCompactSave)
 {
     // Configuration
@@ -241,6 +245,10 @@ void Prettify(std::string &aSource, bool aCompactSave)
     aSource = std::move(formatted);
 }
 
+} // namespace sexp_prettify_kicad_original
+
+#ifndef SEXP_PRETTIFY_NO_MAIN
+
 // Display usage instructions
 void usage(const std::string &prog_name, bool full)
 {
@@ -356,10 +364,12 @@ int main(int argc, char **argv)
     std::string aSource((std::istreambuf_iterator<char>(*src_stream)), std::istreambuf_iterator<char>());
 
     // Process the input
-    Prettify(aSource, compactsave);
+    sexp_prettify_kicad_original::Prettify(aSource, compactsave);
 
     // Write the result to the output stream
     *dst_stream << aSource;
 
     return EXIT_SUCCESS;
 }
+
+#endif // SEXP_PRETTIFY_NO_MAIN
@@ -0,0 +1,405 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Parallel formatting of a whole buffer by splitting at the direct children of the root list.
+// Note: Unlike sexp_prettify.c this uses the heap and pthreads.
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_parallel.h"
+
+#define PRETTIFY_SEXPR_PARALLEL_OUTPUT_MIN_FREE 4096
+
+// A run of consecutive root children src[start..end) and its formatted output
+struct PrettifySExprParallelTask
+{
+    size_t start;
+    size_t end;
+
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+    bool output_failed;
+    char output_discard[PRETTIFY_SEXPR_PARALLEL_OUTPUT_MIN_FREE];
+
+    struct PrettifySExprState end_state;
+    struct PrettifySExprStats stats;
+    bool done;
+};
+
+struct PrettifySExprParallelJob
+{
+    struct PrettifySExprState config;
+    const char *src;
+
+    struct PrettifySExprParallelTask *tasks;
+    size_t task_count;
+    size_t task_window;
+
+    pthread_mutex_t lock;
+    pthread_cond_t task_done;
+    pthread_cond_t window_moved;
+    size_t next_task;
+    size_t tasks_written;
+};
+
+/*
+ * Prescan
+ * Find runs of root children using the same depth and quote rules as the engine. A task always starts on the '(' of a
+ * child at depth 1 and ends right after the ')' bringing the depth back to 1.
+ */
+static bool sexp_prettify_parallel_task_add(struct PrettifySExprParallelJob *job, size_t *task_capacity, size_t start, size_t end)
+{
+    if (job->task_count >= *task_capacity)
+    {
+        const size_t capacity = *task_capacity ? *task_capacity * 2 : 64;
+        struct PrettifySExprParallelTask *tasks = realloc(job->tasks, capacity * sizeof(*tasks));
+        if (!tasks)
+        {
+            return false;
+        }
+        job->tasks = tasks;
+        *task_capacity = capacity;
+    }
+
+    struct PrettifySExprParallelTask *task = &job->tasks[job->task_count++];
+    memset(task, 0, sizeof(*task));
+    task->start = start;
+    task->end = end;
+    return true;
+}
+
+static bool sexp_prettify_parallel_prescan(struct PrettifySExprParallelJob *job, const struct PrettifySExprState *state, const char *src, size_t src_size)
+{
+    size_t task_capacity = 0;
+    unsigned int depth = state->indent;
+    bool in_quote = state->in_quote;
+    bool escape_next_char = state->escape_next_char;
+
+    bool group_open = false;
+    size_t group_start = 0;
+    size_t group_end = 0;
+    size_t child_start = 0;
+    bool child_open = false;
+
+    for (size_t i = 0; i < src_size; i++)
+    {
+        const char c = src[i];
+
+        if (in_quote)
+        {
+            if (escape_next_char)
+            {
+                escape_next_char = false;
+            }
+            else if (c == '\\')
+            {
+                escape_next_char = true;
+            }
+            else if (c == '"')
+            {
+                in_quote = false;
+            }
+            continue;
+        }
+
+        if (c == '"')
+        {
+            in_quote = true;
+        }
+        else if (c == '(')
+        {
+            if (depth == 1)
+            {
+                child_start = i;
+                child_open = true;
+            }
+            depth++;
+        }
+        else if (c == ')')
+        {
+            if (depth > 0)
+            {
+                depth--;
+            }
+
+            if (depth == 1 && child_open)
+            {
+                // Child complete. Group it with the children before it until the group is large enough
+                child_open = false;
+                if (!group_open)
+                {
+                    group_start = child_start;
+                    group_open = true;
+                }
+                group_end = i + 1;
+
+                if (group_end - group_start >= PRETTIFY_SEXPR_PARALLEL_TASK_SIZE)
+                {
+                    if (!sexp_prettify_parallel_task_add(job, &task_capacity, group_start, group_end))
+                    {
+                        return false;
+                    }
+                    group_open = false;
+                }
+            }
+            else if (depth == 0)
+            {
+                // Root closed. Root level text is formatted serially so close the group here
+                child_open = false;
+                if (group_open)
+                {
+                    if (!sexp_prettify_parallel_task_add(job, &task_capacity, group_start, group_end))
+                    {
+                        return false;
+                    }
+                    group_open = false;
+                }
+            }
+        }
+    }
+
+    if (group_open)
+    {
+        return sexp_prettify_parallel_task_add(job, &task_capacity, group_start, group_end);
+    }
+
+    return true;
+}
+
+/*
+ * Workers
+ */
+static void sexp_prettify_parallel_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprParallelTask *task = (struct PrettifySExprParallelTask *)context;
+
+    if (task->output_failed)
+    {
+        return;
+    }
+
+    task->output_size += sink->count;
+
+    if (task->output_capacity - task->output_size < PRETTIFY_SEXPR_PARALLEL_OUTPUT_MIN_FREE)
+    {
+        const size_t capacity = task->output_capacity * 2;
+        char *output = realloc(task->output, capacity);
+        if (!output)
+        {
+            // Keep the engine going into a scratch buffer. The driver formats this task serially instead
+            task->output_failed = true;
+            sink->buffer = task->output_discard;
+            sink->size = sizeof(task->output_discard);
+            return;
+        }
+        task->output = output;
+        task->output_capacity = capacity;
+    }
+
+    // Continue writing directly after the output so far
+    sink->buffer = task->output + task->output_size;
+    sink->size = task->output_capacity - task->output_size;
+}
+
+static void sexp_prettify_parallel_task_run(const struct PrettifySExprParallelJob *job, struct PrettifySExprParallelTask *task)
+{
+    // State of a root child as it is entered from serial formatting (settings are shared)
+    struct PrettifySExprState *state = &task->end_state;
+    *state = job->config;
+    state->indent = 1;
+    state->column = 0;
+    state->c_out_prev = ')';
+    state->in_quote = false;
+    state->escape_next_char = false;
+    state->singular_element = false;
+    state->space_pending = false;
+    state->wrapped_list = false;
+    state->scanning_for_prefix = false;
+    state->prefix_node = PRETTIFY_SEXPR_PREFIX_TRIE_ROOT;
+    state->compact_list_mode = false;
+    state->shortform_mode = false;
+
+    // Counted separately and merged if the output is used
+    state->stats = job->config.stats ? &task->stats : NULL;
+
+    // Formatted output is usually close to the input size
+    task->output_capacity = (task->end - task->start) + (task->end - task->start) / 4 + PRETTIFY_SEXPR_PARALLEL_OUTPUT_MIN_FREE;
+    task->output = malloc(task->output_capacity);
+    if (!task->output)
+    {
+        task->output_failed = true;
+        return;
+    }
+
+    struct PrettifySExprSink sink;
+    sexp_prettify_sink_init(&sink, task->output, task->output_capacity, sexp_prettify_parallel_output_flush, task);
+    sexp_prettify_buffer_to_sink(state, job->src + task->start, task->end - task->start, &sink);
+    sexp_prettify_sink_flush(&sink);
+}
+
+static void *sexp_prettify_parallel_worker(void *context)
+{
+    struct PrettifySExprParallelJob *job = (struct PrettifySExprParallelJob *)context;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->next_task < job->task_count)
+    {
+        if (job->next_task >= job->tasks_written + job->task_window)
+        {
+            // Too far ahead of the output
+            pthread_cond_wait(&job->window_moved, &job->lock);
+            continue;
+        }
+
+        struct PrettifySExprParallelTask *task = &job->tasks[job->next_task++];
+        pthread_mutex_unlock(&job->lock);
+
+        sexp_prettify_parallel_task_run(job, task);
+
+        pthread_mutex_lock(&job->lock);
+        task->done = true;
+        pthread_cond_broadcast(&job->task_done);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+/*
+ * Driver
+ * Formats root level text serially and splices in task output in order, checking that each task was entered in the
+ * state it was formatted from.
+ */
+bool sexp_prettify_parallel(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, unsigned int thread_count)
+{
+    if (thread_count == 0)
+    {
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpu_count > 0 ? (unsigned int)cpu_count : 1;
+    }
+
+    struct PrettifySExprParallelJob job = {0};
+    job.config = *state;
+    job.src = src;
+    job.task_window = (size_t)thread_count * PRETTIFY_SEXPR_PARALLEL_TASK_WINDOW;
+
+    if (!sexp_prettify_parallel_prescan(&job, state, src, src_size))
+    {
+        free(job.tasks);
+        return false;
+    }
+
+    if (job.task_count < 2 || thread_count < 2)
+    {
+        // Not worth splitting
+        free(job.tasks);
+        sexp_prettify_buffer_to_sink(state, src, src_size, sink);
+        return true;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.task_done, NULL);
+    pthread_cond_init(&job.window_moved, NULL);
+
+    pthread_t *threads = malloc(thread_count * sizeof(*threads));
+    unsigned int threads_started = 0;
+    if (threads)
+    {
+        for (; threads_started < thread_count; threads_started++)
+        {
+            if (pthread_create(&threads[threads_started], NULL, sexp_prettify_parallel_worker, &job) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    if (threads_started < thread_count)
+    {
+        // Stop any started workers before giving up
+        pthread_mutex_lock(&job.lock);
+        job.task_count = job.next_task;
+        pthread_mutex_unlock(&job.lock);
+
+        for (unsigned int i = 0; i < threads_started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        for (size_t i = 0; i < job.task_count; i++)
+        {
+            free(job.tasks[i].output);
+        }
+
+        free(threads);
+        free(job.tasks);
+        pthread_cond_destroy(&job.window_moved);
+        pthread_cond_destroy(&job.task_done);
+        pthread_mutex_destroy(&job.lock);
+        return false;
+    }
+
+    size_t src_pos = 0;
+    for (size_t i = 0; i < job.task_count; i++)
+    {
+        struct PrettifySExprParallelTask *task = &job.tasks[i];
+
+        // Root level text leading up to this task
+        sexp_prettify_buffer_to_sink(state, src + src_pos, task->start - src_pos, sink);
+
+        pthread_mutex_lock(&job.lock);
+        while (!task->done)
+        {
+            pthread_cond_wait(&job.task_done, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        const bool entry_state_matches = state->indent == 1 && !state->in_quote && !state->wrapped_list && !state->compact_list_mode && !state->shortform_mode;
+        if (entry_state_matches && !task->output_failed)
+        {
+            struct PrettifySExprStats *stats = state->stats;
+            sexp_prettify_sink_write(sink, task->output, task->output_size);
+            *state = task->end_state;
+            state->stats = stats;
+            if (stats)
+            {
+                sexp_prettify_stats_merge(stats, &task->stats);
+            }
+        }
+        else
+        {
+            sexp_prettify_buffer_to_sink(state, src + task->start, task->end - task->start, sink);
+        }
+
+        free(task->output);
+        task->output = NULL;
+        src_pos = task->end;
+
+        pthread_mutex_lock(&job.lock);
+        job.tasks_written = i + 1;
+        pthread_cond_broadcast(&job.window_moved);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    // Root level text after the last task
+    sexp_prettify_buffer_to_sink(state, src + src_pos, src_size - src_pos, sink);
+
+    for (unsigned int i = 0; i < threads_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(job.tasks);
+    pthread_cond_destroy(&job.window_moved);
+    pthread_cond_destroy(&job.task_done);
+    pthread_mutex_destroy(&job.lock);
+    return true;
+}
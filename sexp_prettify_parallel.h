@@ -0,0 +1,39 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Parallel formatting of a whole buffer by splitting at the direct children of the root list.
+// Note: Unlike sexp_prettify.c this uses the heap and pthreads.
+
+#ifndef SEXP_PRETTIFY_PARALLEL
+#define SEXP_PRETTIFY_PARALLEL
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sexp_prettify.h"
+
+// Consecutive root children are grouped into tasks of at least this many input bytes
+#define PRETTIFY_SEXPR_PARALLEL_TASK_SIZE (256 * 1024)
+
+// Number of finished tasks allowed to wait for output per worker thread (Bounds memory used by formatted but unwritten tasks)
+#define PRETTIFY_SEXPR_PARALLEL_TASK_WINDOW 4
+
+/*
+ * Every direct child of the root list starts from the same engine state (indent 1, no compact or shortform mode and
+ * a fresh line), so children can be formatted independently and concatenated in order. Anything that does not meet
+ * this (root level tokens that wrapped, a root in compact list or shortform mode) is formatted serially instead, so the
+ * output is always byte identical to sexp_prettify_buffer_to_sink().
+ *
+ * state        : Configured state. Updated exactly as if sexp_prettify_buffer_to_sink() had been called
+ * thread_count : Number of worker threads. 0 picks the number of online cpus
+ * Returns false if the worker threads could not be started or memory ran out (state and sink are then untouched)
+ */
+bool sexp_prettify_parallel(struct PrettifySExprState *state, const char *src, size_t src_size, struct PrettifySExprSink *sink, unsigned int thread_count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,286 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Threaded read, format and write pipeline so input and output latency (pipes, network file systems, gzip) overlaps formatting.
+// Note: Unlike sexp_prettify.c this uses the heap and pthreads.
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_pipeline.h"
+
+// Times a thread polls its ring before going to sleep on it
+#define PRETTIFY_SEXPR_PIPELINE_SPIN_COUNT 256
+
+/*
+ * Ring
+ * Single producer, single consumer ring of fixed size blocks. head and tail only ever increase and are each written by
+ * one side only. The producer fills the block at tail then publishes it by advancing tail, the consumer reads the block
+ * at head then hands it back by advancing head. A side that finds the ring full (or empty) sleeps on the condition
+ * variable, and the other side only takes the lock to wake it if it has announced itself in waiting.
+ */
+
+struct PrettifySExprPipelineRing
+{
+    char *data;
+    size_t *sizes;
+    size_t block_size;
+    size_t block_count;
+    size_t head;  ///< Next block to read. Written by the consumer
+    size_t tail;  ///< Next block to write. Written by the producer
+    bool closed;  ///< Producer is done. Written by the producer
+    int waiting;  ///< Threads sleeping (or about to sleep) on changed
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static bool sexp_prettify_pipeline_ring_readable(struct PrettifySExprPipelineRing *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head || __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST);
+}
+
+static bool sexp_prettify_pipeline_ring_writable(struct PrettifySExprPipelineRing *ring)
+{
+    return ring->tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) < ring->block_count;
+}
+
+static void sexp_prettify_pipeline_ring_wait(struct PrettifySExprPipelineRing *ring, bool (*ready)(struct PrettifySExprPipelineRing *))
+{
+    for (int i = 0; i < PRETTIFY_SEXPR_PIPELINE_SPIN_COUNT; i++)
+    {
+        if (ready(ring))
+        {
+            return;
+        }
+    }
+
+    // Announce before checking again so a change made after the check is guaranteed to see waiting and wake this thread
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    while (!ready(ring))
+    {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    __atomic_sub_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void sexp_prettify_pipeline_ring_notify(struct PrettifySExprPipelineRing *ring)
+{
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+static bool sexp_prettify_pipeline_ring_init(struct PrettifySExprPipelineRing *ring, size_t block_size, size_t block_count)
+{
+    ring->data = malloc(block_size * block_count);
+    ring->sizes = malloc(block_count * sizeof(*ring->sizes));
+    if (!ring->data || !ring->sizes)
+    {
+        free(ring->data);
+        free(ring->sizes);
+        return false;
+    }
+
+    ring->block_size = block_size;
+    ring->block_count = block_count;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->closed = false;
+    ring->waiting = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+    return true;
+}
+
+static void sexp_prettify_pipeline_ring_free(struct PrettifySExprPipelineRing *ring)
+{
+    pthread_cond_destroy(&ring->changed);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->sizes);
+    free(ring->data);
+}
+
+// Producer: Next free block (Waits while the ring is full)
+static char *sexp_prettify_pipeline_ring_write_block(struct PrettifySExprPipelineRing *ring)
+{
+    sexp_prettify_pipeline_ring_wait(ring, sexp_prettify_pipeline_ring_writable);
+    return ring->data + (ring->tail % ring->block_count) * ring->block_size;
+}
+
+static void sexp_prettify_pipeline_ring_write_commit(struct PrettifySExprPipelineRing *ring, size_t size)
+{
+    ring->sizes[ring->tail % ring->block_count] = size;
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+    sexp_prettify_pipeline_ring_notify(ring);
+}
+
+static void sexp_prettify_pipeline_ring_close(struct PrettifySExprPipelineRing *ring)
+{
+    __atomic_store_n(&ring->closed, true, __ATOMIC_SEQ_CST);
+    sexp_prettify_pipeline_ring_notify(ring);
+}
+
+// Consumer: Next filled block, or NULL once the producer closed the ring and every block was read (Waits while the ring is empty)
+static const char *sexp_prettify_pipeline_ring_read_block(struct PrettifySExprPipelineRing *ring, size_t *size)
+{
+    sexp_prettify_pipeline_ring_wait(ring, sexp_prettify_pipeline_ring_readable);
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == ring->head)
+    {
+        return NULL;
+    }
+
+    *size = ring->sizes[ring->head % ring->block_count];
+    return ring->data + (ring->head % ring->block_count) * ring->block_size;
+}
+
+static void sexp_prettify_pipeline_ring_read_release(struct PrettifySExprPipelineRing *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    sexp_prettify_pipeline_ring_notify(ring);
+}
+
+/*
+ * Stages
+ */
+
+struct PrettifySExprPipelineJob
+{
+    PrettifySExprReadFunc read_func;
+    void *read_func_context;
+    PrettifySExprWriteFunc write_func;
+    void *write_func_context;
+
+    struct PrettifySExprPipelineRing input;
+    struct PrettifySExprPipelineRing output;
+};
+
+static void *sexp_prettify_pipeline_reader(void *context)
+{
+    struct PrettifySExprPipelineJob *job = (struct PrettifySExprPipelineJob *)context;
+
+    while (true)
+    {
+        char *block = sexp_prettify_pipeline_ring_write_block(&job->input);
+        const size_t size = job->read_func(block, job->input.block_size, job->read_func_context);
+        if (size == 0)
+        {
+            break;
+        }
+        sexp_prettify_pipeline_ring_write_commit(&job->input, size);
+    }
+
+    sexp_prettify_pipeline_ring_close(&job->input);
+    return NULL;
+}
+
+static void *sexp_prettify_pipeline_writer(void *context)
+{
+    struct PrettifySExprPipelineJob *job = (struct PrettifySExprPipelineJob *)context;
+
+    const char *block;
+    size_t size;
+    while ((block = sexp_prettify_pipeline_ring_read_block(&job->output, &size)))
+    {
+        job->write_func(block, size, job->write_func_context);
+        sexp_prettify_pipeline_ring_read_release(&job->output);
+    }
+
+    return NULL;
+}
+
+static void sexp_prettify_pipeline_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprPipelineJob *job = (struct PrettifySExprPipelineJob *)context;
+
+    // Continue in the next free block while the writer thread drains this one
+    sexp_prettify_pipeline_ring_write_commit(&job->output, sink->count);
+    sink->buffer = sexp_prettify_pipeline_ring_write_block(&job->output);
+}
+
+bool sexp_prettify_pipeline(struct PrettifySExprState *state, struct PrettifySExprMinifyState *minify, PrettifySExprReadFunc read_func, void *read_func_context, PrettifySExprWriteFunc write_func,
+                            void *write_func_context, size_t block_size, size_t block_count)
+{
+    if (block_size == 0 || block_count == 0)
+    {
+        return false;
+    }
+
+    struct PrettifySExprPipelineJob *job = malloc(sizeof(*job));
+    if (!job)
+    {
+        return false;
+    }
+
+    job->read_func = read_func;
+    job->read_func_context = read_func_context;
+    job->write_func = write_func;
+    job->write_func_context = write_func_context;
+
+    if (!sexp_prettify_pipeline_ring_init(&job->input, block_size, block_count))
+    {
+        free(job);
+        return false;
+    }
+
+    if (!sexp_prettify_pipeline_ring_init(&job->output, block_size, block_count))
+    {
+        sexp_prettify_pipeline_ring_free(&job->input);
+        free(job);
+        return false;
+    }
+
+    // The writer thread is started first as it can be stopped before any input is consumed
+    bool ok = true;
+    pthread_t writer_thread;
+    pthread_t reader_thread;
+    if (pthread_create(&writer_thread, NULL, sexp_prettify_pipeline_writer, job) != 0)
+    {
+        ok = false;
+    }
+    else if (pthread_create(&reader_thread, NULL, sexp_prettify_pipeline_reader, job) != 0)
+    {
+        sexp_prettify_pipeline_ring_close(&job->output);
+        pthread_join(writer_thread, NULL);
+        ok = false;
+    }
+
+    if (ok)
+    {
+        struct PrettifySExprSink sink;
+        sexp_prettify_sink_init(&sink, sexp_prettify_pipeline_ring_write_block(&job->output), block_size, sexp_prettify_pipeline_output_flush, job);
+
+        const char *block;
+        size_t size;
+        while ((block = sexp_prettify_pipeline_ring_read_block(&job->input, &size)))
+        {
+            if (minify)
+            {
+                sexp_prettify_minify_buffer_to_sink(minify, block, size, &sink);
+            }
+            else
+            {
+                sexp_prettify_buffer_to_sink(state, block, size, &sink);
+            }
+            sexp_prettify_pipeline_ring_read_release(&job->input);
+        }
+
+        sexp_prettify_sink_flush(&sink);
+        sexp_prettify_pipeline_ring_close(&job->output);
+
+        pthread_join(reader_thread, NULL);
+        pthread_join(writer_thread, NULL);
+    }
+
+    sexp_prettify_pipeline_ring_free(&job->output);
+    sexp_prettify_pipeline_ring_free(&job->input);
+    free(job);
+    return ok;
+}
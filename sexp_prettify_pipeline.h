@@ -0,0 +1,44 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Threaded read, format and write pipeline so input and output latency (pipes, network file systems, gzip) overlaps formatting.
+// Note: Unlike sexp_prettify.c this uses the heap and pthreads.
+
+#ifndef SEXP_PRETTIFY_PIPELINE
+#define SEXP_PRETTIFY_PIPELINE
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sexp_prettify.h"
+
+// Default size of each input and output block
+#define PRETTIFY_SEXPR_PIPELINE_BLOCK_SIZE (64 * 1024)
+
+// Default number of blocks in each ring. A stage that gets this far ahead of the next one waits for it (backpressure)
+#define PRETTIFY_SEXPR_PIPELINE_BLOCK_COUNT 8
+
+/*
+ * A reader thread fills input blocks from read_func into a ring, the calling thread formats them (or minifies them if
+ * minify is not NULL) into output blocks of a second ring, and a writer thread drains those through write_func.
+ * Each ring has a single producer and a single consumer, so blocks are handed over lock free. A thread only sleeps
+ * (on a condition variable) once its ring is full or empty.
+ * Output is byte identical to formatting the whole input with sexp_prettify_buffer_to_sink().
+ *
+ * state       : Configured state. Updated exactly as if sexp_prettify_buffer_to_sink() had been called
+ * read_func   : Called from the reader thread. Returns 0 at the end of input (Errors are for the caller to track)
+ * write_func  : Called from the writer thread with each full (or final) output block
+ * block_size  : Size of each block in both rings
+ * block_count : Number of blocks in each ring
+ * Returns false if block_size or block_count is 0, or if memory ran out or the threads could not be started (nothing is read then)
+ */
+bool sexp_prettify_pipeline(struct PrettifySExprState *state, struct PrettifySExprMinifyState *minify, PrettifySExprReadFunc read_func, void *read_func_context, PrettifySExprWriteFunc write_func,
+                            void *write_func_context, size_t block_size, size_t block_count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,372 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// CPython extension module (_sexp_prettify) with the same prettify() and minify() as sexp_prettify_cli.py, built from sexp_prettify.c.
+// Note: Unlike sexp_prettify.c this uses the heap and the Python C api.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "sexp_prettify.h"
+
+// Most prefixes accepted in compact_list_prefixes or shortform_prefixes (The prefix trie runs out well before this anyway)
+#define PRETTIFY_SEXPR_PYTHON_MAX_PREFIXES 256
+
+static const char *compact_list_prefixes_kicad[] = {"pts"};
+static const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+
+/*
+ * Output
+ * Growable output buffer that the sink writes into directly. Only uses the raw allocator so it can run without the GIL
+ */
+
+struct PrettifySExprPythonOutput
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+    char scratch[PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE]; ///< Output is discarded in here once memory ran out
+};
+
+static bool sexp_prettify_python_output_init(struct PrettifySExprPythonOutput *output, size_t src_size)
+{
+    // Formatting mostly adds indentation, so start a bit larger than the input (Minified output is never larger)
+    output->size = 0;
+    output->capacity = src_size + src_size / 4 + PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE;
+    output->failed = false;
+    output->data = PyMem_RawMalloc(output->capacity);
+    return output->data != NULL;
+}
+
+static void sexp_prettify_python_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprPythonOutput *output = (struct PrettifySExprPythonOutput *)context;
+
+    if (output->failed)
+    {
+        return;
+    }
+
+    output->size += sink->count;
+    if (output->capacity - output->size < PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE)
+    {
+        const size_t capacity = output->capacity * 2;
+        char *data = PyMem_RawRealloc(output->data, capacity);
+        if (!data)
+        {
+            output->failed = true;
+            sink->buffer = output->scratch;
+            sink->size = sizeof(output->scratch);
+            return;
+        }
+
+        output->data = data;
+        output->capacity = capacity;
+    }
+
+    // Continue right after the output so far
+    sink->buffer = output->data + output->size;
+    sink->size = output->capacity - output->size;
+}
+
+/*
+ * Input
+ * str is formatted as its UTF-8 encoding and gives back str. bytes, bytearray, memoryview and any other buffer gives back bytes.
+ * Either way columns count bytes and whitespace is the ASCII set of isspace(), same as sexp_prettify_cli. The pure Python
+ * version counts code points and takes anything str.isspace() does, so it only agrees on ASCII text without \x1c-\x1f
+ */
+
+struct PrettifySExprPythonInput
+{
+    const char *data;
+    size_t size;
+    bool text;
+    Py_buffer view;
+};
+
+static bool sexp_prettify_python_input_get(struct PrettifySExprPythonInput *input, PyObject *source)
+{
+    if (PyUnicode_Check(source))
+    {
+        Py_ssize_t size;
+        input->data = PyUnicode_AsUTF8AndSize(source, &size);
+        input->size = size;
+        input->text = true;
+        return input->data != NULL;
+    }
+
+    // A held buffer can not be resized (eg. bytearray) so it stays valid while the GIL is released
+    if (PyObject_GetBuffer(source, &input->view, PyBUF_SIMPLE) != 0)
+    {
+        PyErr_Format(PyExc_TypeError, "source must be str or a bytes-like object, not %.200s", Py_TYPE(source)->tp_name);
+        return false;
+    }
+
+    input->data = input->view.buf;
+    input->size = input->view.len;
+    input->text = false;
+    return true;
+}
+
+static void sexp_prettify_python_input_release(struct PrettifySExprPythonInput *input)
+{
+    if (!input->text)
+    {
+        PyBuffer_Release(&input->view);
+    }
+}
+
+static PyObject *sexp_prettify_python_result(const struct PrettifySExprPythonInput *input, const struct PrettifySExprPythonOutput *output)
+{
+    if (output->failed)
+    {
+        return PyErr_NoMemory();
+    }
+
+    // Only ASCII whitespace is added or removed, so UTF-8 input stays valid UTF-8
+    if (input->text)
+    {
+        return PyUnicode_DecodeUTF8(output->data, output->size, "strict");
+    }
+
+    return PyBytes_FromStringAndSize(output->data, output->size);
+}
+
+/*
+ * Prefixes
+ * Any iterable of str (eg. a set as in sexp_prettify_cli.py). The returned array points into the items of *items
+ */
+
+static const char **sexp_prettify_python_prefixes_get(PyObject *prefixes, const char *name, PyObject **items, int *count)
+{
+    *items = PySequence_Fast(prefixes, "");
+    if (!*items)
+    {
+        PyErr_Format(PyExc_TypeError, "%s must be an iterable of str", name);
+        return NULL;
+    }
+
+    const Py_ssize_t size = PySequence_Fast_GET_SIZE(*items);
+    if (size > PRETTIFY_SEXPR_PYTHON_MAX_PREFIXES)
+    {
+        PyErr_Format(PyExc_ValueError, "%s has more than %d entries", name, PRETTIFY_SEXPR_PYTHON_MAX_PREFIXES);
+        Py_CLEAR(*items);
+        return NULL;
+    }
+
+    const char **array = PyMem_Malloc((size + 1) * sizeof(*array));
+    if (!array)
+    {
+        PyErr_NoMemory();
+        Py_CLEAR(*items);
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < size; i++)
+    {
+        PyObject *item = PySequence_Fast_GET_ITEM(*items, i);
+        array[i] = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : NULL;
+        if (!array[i])
+        {
+            if (!PyErr_Occurred())
+            {
+                PyErr_Format(PyExc_TypeError, "%s must be an iterable of str", name);
+            }
+            PyMem_Free(array);
+            Py_CLEAR(*items);
+            return NULL;
+        }
+    }
+
+    *count = (int)size;
+    return array;
+}
+
+/*
+ * Module functions
+ */
+
+PyDoc_STRVAR(sexp_prettify_python_prettify_doc,
+             "prettify(source, compact_save=False, indent_char='\\t', indent_size=1, consecutive_token_wrap_threshold=72, compact_list_prefixes={'pts'}, compact_list_column_limit=99, "
+             "shortform_prefixes={'font', 'stroke', 'fill', 'offset', 'rotate', 'scale'})\n"
+             "--\n\n"
+             "Reformats KiCad-like S-expressions to match a specific formatting style.\n"
+             "Same as prettify() in sexp_prettify_cli.py. source is str (returns str) or a bytes-like object (returns bytes).\n"
+             "Columns count UTF-8 bytes and only ASCII whitespace counts, so non-ASCII text may wrap differently from the pure Python version.\n"
+             "The GIL is released while formatting.");
+
+static PyObject *sexp_prettify_python_prettify(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"source", "compact_save", "indent_char", "indent_size", "consecutive_token_wrap_threshold", "compact_list_prefixes", "compact_list_column_limit", "shortform_prefixes", NULL};
+
+    PyObject *source;
+    int compact_save = 0;
+    int indent_char = PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR;
+    int indent_size = PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE;
+    int consecutive_token_wrap_threshold = PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD;
+    PyObject *compact_list_prefixes_object = NULL;
+    int compact_list_column_limit = PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT;
+    PyObject *shortform_prefixes_object = NULL;
+
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pCiiOiO:prettify", keywords, &source, &compact_save, &indent_char, &indent_size, &consecutive_token_wrap_threshold, &compact_list_prefixes_object,
+                                     &compact_list_column_limit, &shortform_prefixes_object))
+    {
+        return NULL;
+    }
+
+    if (indent_char <= 0 || indent_char > 127)
+    {
+        PyErr_SetString(PyExc_ValueError, "indent_char must be a single ASCII character other than '\\0'");
+        return NULL;
+    }
+
+    // Zeroed as sexp_prettify_compact_list_set() and sexp_prettify_shortform_set() each read the prefixes set by the other
+    struct PrettifySExprState state = {0};
+    PyObject *result = NULL;
+    PyObject *compact_list_items = NULL;
+    PyObject *shortform_items = NULL;
+    const char **compact_list_prefixes = compact_list_prefixes_kicad;
+    int compact_list_prefixes_count = sizeof(compact_list_prefixes_kicad) / sizeof(compact_list_prefixes_kicad[0]);
+    const char **shortform_prefixes = shortform_prefixes_kicad;
+    int shortform_prefixes_count = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
+
+    if (!sexp_prettify_init(&state, (char)indent_char, indent_size, consecutive_token_wrap_threshold))
+    {
+        PyErr_SetString(PyExc_ValueError, "indent_size must be at least 1");
+        goto done;
+    }
+
+    if (compact_list_prefixes_object)
+    {
+        compact_list_prefixes = sexp_prettify_python_prefixes_get(compact_list_prefixes_object, "compact_list_prefixes", &compact_list_items, &compact_list_prefixes_count);
+        if (!compact_list_prefixes)
+        {
+            goto done;
+        }
+    }
+
+    // Shortform lists are only used when saving in compact mode (Same as sexp_prettify_cli.py)
+    if (compact_save && shortform_prefixes_object)
+    {
+        shortform_prefixes = sexp_prettify_python_prefixes_get(shortform_prefixes_object, "shortform_prefixes", &shortform_items, &shortform_prefixes_count);
+        if (!shortform_prefixes)
+        {
+            goto done;
+        }
+    }
+
+    // An empty prefix set turns the feature off
+    if (compact_list_prefixes_count > 0 && !sexp_prettify_compact_list_set(&state, compact_list_prefixes, compact_list_prefixes_count, compact_list_column_limit))
+    {
+        PyErr_SetString(PyExc_ValueError, "compact_list_prefixes and shortform_prefixes are too long in total");
+        goto done;
+    }
+
+    if (compact_save && shortform_prefixes_count > 0 && !sexp_prettify_shortform_set(&state, shortform_prefixes, shortform_prefixes_count))
+    {
+        PyErr_SetString(PyExc_ValueError, "compact_list_prefixes and shortform_prefixes are too long in total");
+        goto done;
+    }
+
+    struct PrettifySExprPythonInput input;
+    if (!sexp_prettify_python_input_get(&input, source))
+    {
+        goto done;
+    }
+
+    struct PrettifySExprPythonOutput output;
+    if (!sexp_prettify_python_output_init(&output, input.size))
+    {
+        sexp_prettify_python_input_release(&input);
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    struct PrettifySExprSink sink;
+    sexp_prettify_sink_init(&sink, output.data, output.capacity, sexp_prettify_python_output_flush, &output);
+    sexp_prettify_buffer_to_sink(&state, input.data, input.size, &sink);
+    sexp_prettify_sink_flush(&sink);
+    Py_END_ALLOW_THREADS
+
+    result = sexp_prettify_python_result(&input, &output);
+
+    PyMem_RawFree(output.data);
+    sexp_prettify_python_input_release(&input);
+
+done:
+    if (compact_list_items)
+    {
+        PyMem_Free(compact_list_prefixes);
+        Py_DECREF(compact_list_items);
+    }
+
+    if (shortform_items)
+    {
+        PyMem_Free(shortform_prefixes);
+        Py_DECREF(shortform_items);
+    }
+
+    return result;
+}
+
+PyDoc_STRVAR(sexp_prettify_python_minify_doc,
+             "minify(source)\n"
+             "--\n\n"
+             "Strips the whitespace of KiCad-like S-expressions that does not change the prettify() output.\n"
+             "Same as minify() in sexp_prettify_cli.py. source is str (returns str) or a bytes-like object (returns bytes).\n"
+             "Only ASCII whitespace counts, so text with other whitespace may differ from the pure Python version.\n"
+             "The GIL is released while minifying.");
+
+static PyObject *sexp_prettify_python_minify(PyObject *self, PyObject *source)
+{
+    (void)self;
+
+    struct PrettifySExprPythonInput input;
+    if (!sexp_prettify_python_input_get(&input, source))
+    {
+        return NULL;
+    }
+
+    struct PrettifySExprPythonOutput output;
+    if (!sexp_prettify_python_output_init(&output, input.size))
+    {
+        sexp_prettify_python_input_release(&input);
+        return PyErr_NoMemory();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    struct PrettifySExprMinifyState state;
+    struct PrettifySExprSink sink;
+    sexp_prettify_minify_init(&state);
+    sexp_prettify_sink_init(&sink, output.data, output.capacity, sexp_prettify_python_output_flush, &output);
+    sexp_prettify_minify_buffer_to_sink(&state, input.data, input.size, &sink);
+    sexp_prettify_sink_flush(&sink);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result = sexp_prettify_python_result(&input, &output);
+
+    PyMem_RawFree(output.data);
+    sexp_prettify_python_input_release(&input);
+    return result;
+}
+
+static PyMethodDef sexp_prettify_python_methods[] = {
+    {"prettify", (PyCFunction)(void (*)(void))sexp_prettify_python_prettify, METH_VARARGS | METH_KEYWORDS, sexp_prettify_python_prettify_doc},
+    {"minify", sexp_prettify_python_minify, METH_O, sexp_prettify_python_minify_doc},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef sexp_prettify_python_module = {
+    PyModuleDef_HEAD_INIT, "_sexp_prettify", "KiCad S-Expression Formatter (C implementation of sexp_prettify_cli.py)", -1, sexp_prettify_python_methods, NULL, NULL, NULL, NULL,
+};
+
+PyMODINIT_FUNC PyInit__sexp_prettify(void)
+{
+    return PyModule_Create(&sexp_prettify_python_module);
+}
@@ -0,0 +1,1032 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Persistent formatter server on a Unix domain socket, and the client side of its protocol.
+// Note: Unlike sexp_prettify.c this uses the heap, pthreads, sockets and the file system.
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sexp_prettify.h"
+#include "sexp_prettify_server.h"
+
+struct PrettifySExprServerWorker
+{
+    struct PrettifySExprServer *server;
+    pthread_t thread;
+    int conn_fd; ///< Connection with a request being served or -1 (Under the server lock, so stopping can wake it)
+
+    // Reused for every request this worker serves
+    char *input;
+    size_t input_capacity;
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+    bool output_failed;
+    char scratch[PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE]; ///< Output is discarded in here once memory ran out
+    char *style;
+    size_t style_capacity;
+    const char **prefixes;
+    size_t prefixes_capacity; ///< Bytes
+    uint32_t *index_entries;
+};
+
+static uint64_t sexp_prettify_server_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Grow a reused buffer to at least size bytes. Contents are not kept
+static bool sexp_prettify_server_reserve(char **buffer, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+    {
+        return true;
+    }
+
+    char *grown = malloc(size);
+    if (!grown)
+    {
+        return false;
+    }
+
+    free(*buffer);
+    *buffer = grown;
+    *capacity = size;
+    return true;
+}
+
+/*
+ * Socket I/O
+ * Sends use MSG_NOSIGNAL so a client that went away is an error instead of a SIGPIPE.
+ */
+
+static bool sexp_prettify_server_send_all(int fd, struct iovec *iov, int iov_count)
+{
+    while (iov_count > 0)
+    {
+        struct msghdr message = {.msg_iov = iov, .msg_iovlen = iov_count};
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        // Skip past what was sent (Handles partial sends)
+        while (iov_count > 0 && (size_t)sent >= iov->iov_len)
+        {
+            sent -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+
+        if (iov_count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+
+    return true;
+}
+
+// Returns false at the end of the connection (errno is 0 if it ended cleanly before the first byte)
+static bool sexp_prettify_server_recv_all(int fd, void *buffer, size_t size)
+{
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t count = recv(fd, (char *)buffer + received, size - received, 0);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        if (count == 0)
+        {
+            errno = received == 0 ? 0 : EPROTO;
+            return false;
+        }
+
+        received += count;
+    }
+
+    return true;
+}
+
+/*
+ * Latency Samples
+ */
+
+bool sexp_prettify_latency_init(struct PrettifySExprLatency *latency, size_t capacity)
+{
+    memset(latency, 0, sizeof(*latency));
+    if (capacity == 0)
+    {
+        return false;
+    }
+
+    latency->samples = malloc(capacity * sizeof(*latency->samples));
+    latency->capacity = capacity;
+    return latency->samples != NULL;
+}
+
+void sexp_prettify_latency_free(struct PrettifySExprLatency *latency)
+{
+    free(latency->samples);
+    latency->samples = NULL;
+    latency->capacity = 0;
+}
+
+void sexp_prettify_latency_add(struct PrettifySExprLatency *latency, uint64_t nanoseconds)
+{
+    latency->samples[latency->count % latency->capacity] = nanoseconds;
+    latency->count++;
+    if (nanoseconds > latency->max)
+    {
+        latency->max = nanoseconds;
+    }
+}
+
+static int sexp_prettify_latency_compare(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t sexp_prettify_latency_percentile(const struct PrettifySExprLatency *latency, double percentile)
+{
+    const size_t kept = latency->count < latency->capacity ? (size_t)latency->count : latency->capacity;
+    if (kept == 0)
+    {
+        return 0;
+    }
+
+    uint64_t *sorted = malloc(kept * sizeof(*sorted));
+    if (!sorted)
+    {
+        return 0;
+    }
+    memcpy(sorted, latency->samples, kept * sizeof(*sorted));
+    qsort(sorted, kept, sizeof(*sorted), sexp_prettify_latency_compare);
+
+    // Nearest rank
+    size_t rank = (size_t)(percentile / 100.0 * kept + 0.999999);
+    rank = rank < 1 ? 1 : rank > kept ? kept : rank;
+    const uint64_t value = sorted[rank - 1];
+
+    free(sorted);
+    return value;
+}
+
+void sexp_prettify_latency_summary(const struct PrettifySExprLatency *latency, const char *name, FILE *stream)
+{
+    fprintf(stream, "%s: %llu requests, latency p50 %.1f us, p99 %.1f us, max %.1f us\n", name, (unsigned long long)latency->count, sexp_prettify_latency_percentile(latency, 50) / 1e3,
+            sexp_prettify_latency_percentile(latency, 99) / 1e3, latency->max / 1e3);
+}
+
+/*
+ * Request Handling
+ */
+
+static void sexp_prettify_server_output_flush(struct PrettifySExprSink *sink, void *context)
+{
+    struct PrettifySExprServerWorker *worker = (struct PrettifySExprServerWorker *)context;
+
+    if (worker->output_failed)
+    {
+        return;
+    }
+
+    worker->output_size += sink->count;
+    if (worker->output_capacity - worker->output_size < PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE)
+    {
+        const size_t capacity = worker->output_capacity * 2;
+        char *output = realloc(worker->output, capacity);
+        if (!output)
+        {
+            worker->output_failed = true;
+            sink->buffer = worker->scratch;
+            sink->size = sizeof(worker->scratch);
+            return;
+        }
+
+        worker->output = output;
+        worker->output_capacity = capacity;
+    }
+
+    // Continue right after the output so far
+    sink->buffer = worker->output + worker->output_size;
+    sink->size = worker->output_capacity - worker->output_size;
+}
+
+// Profile state with the request's settings, plus its extra prefixes (pointing into worker->style) if it has any
+static const char *sexp_prettify_server_request_state(struct PrettifySExprServerWorker *worker, const struct PrettifySExprServerRequest *request, struct PrettifySExprState *state)
+{
+    if (request->profile >= PRETTIFY_SEXPR_SERVER_PROFILE_COUNT)
+    {
+        return "Unknown profile";
+    }
+
+    const struct PrettifySExprState *profile = worker->server->profiles[request->profile];
+    if (request->compact_list_prefixes_count == 0 && request->shortform_prefixes_count == 0)
+    {
+        *state = *profile;
+        state->consecutive_token_wrap_threshold = request->consecutive_token_wrap_threshold;
+        state->compact_list_column_limit = request->compact_list_column_limit;
+        return NULL;
+    }
+
+    // Split the style block into its NUL terminated prefixes, after the profile ones
+    const size_t compact_count = profile->compact_list_prefixes_entries_count + request->compact_list_prefixes_count;
+    const size_t shortform_count = profile->shortform_prefixes_entries_count + request->shortform_prefixes_count;
+    if (!sexp_prettify_server_reserve((char **)&worker->prefixes, &worker->prefixes_capacity, (compact_count + shortform_count) * sizeof(*worker->prefixes)))
+    {
+        return "Out of memory";
+    }
+
+    const char **compact_prefixes = worker->prefixes;
+    const char **shortform_prefixes = worker->prefixes + compact_count;
+    for (int i = 0; i < profile->compact_list_prefixes_entries_count; i++)
+    {
+        compact_prefixes[i] = profile->compact_list_prefixes[i];
+    }
+    for (int i = 0; i < profile->shortform_prefixes_entries_count; i++)
+    {
+        shortform_prefixes[i] = profile->shortform_prefixes[i];
+    }
+
+    const char *style = worker->style;
+    const char *style_end = worker->style + request->style_size;
+    for (size_t i = 0; i < (size_t)request->compact_list_prefixes_count + request->shortform_prefixes_count; i++)
+    {
+        const char *end = memchr(style, '\0', style_end - style);
+        if (!end)
+        {
+            return "Malformed style block";
+        }
+
+        if (i < request->compact_list_prefixes_count)
+        {
+            compact_prefixes[profile->compact_list_prefixes_entries_count + i] = style;
+        }
+        else
+        {
+            shortform_prefixes[profile->shortform_prefixes_entries_count + i - request->compact_list_prefixes_count] = style;
+        }
+        style = end + 1;
+    }
+
+    // Same order of settings as sexp_prettify_cli
+    memset(state, 0, sizeof(*state));
+    if (!sexp_prettify_init(state, profile->indent_char, profile->indent_size, request->consecutive_token_wrap_threshold))
+    {
+        return "Invalid settings";
+    }
+
+    if (compact_count > 0 && !sexp_prettify_compact_list_set(state, compact_prefixes, (int)compact_count, request->compact_list_column_limit))
+    {
+        return "Too many or too long compact list prefixes";
+    }
+
+    if (shortform_count > 0 && !sexp_prettify_shortform_set(state, shortform_prefixes, (int)shortform_count))
+    {
+        return "Too many or too long shortform prefixes";
+    }
+
+    return NULL;
+}
+
+// Reads the file of a path request into worker->input (The path in there is not needed once the file is open). It is not
+// mapped, as a client truncating the file while it is formatted would take the server down with SIGBUS. Returns an error message or NULL
+static const char *sexp_prettify_server_read_source(struct PrettifySExprServerWorker *worker, const char *path, size_t *src_size)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return strerror(errno);
+    }
+
+    struct stat src_stat;
+    const char *error = NULL;
+    if (fstat(fd, &src_stat) != 0 || !S_ISREG(src_stat.st_mode))
+    {
+        error = "Not a regular file";
+    }
+    else if (src_stat.st_size > PRETTIFY_SEXPR_SERVER_MAX_PAYLOAD_SIZE)
+    {
+        error = "File too large";
+    }
+    else if (!sexp_prettify_server_reserve(&worker->input, &worker->input_capacity, src_stat.st_size + 1))
+    {
+        error = "Out of memory";
+    }
+
+    // A file that changes size meanwhile is formatted as read, up to its size when opened
+    size_t size = 0;
+    while (!error && size < (size_t)src_stat.st_size)
+    {
+        const ssize_t count = read(fd, worker->input + size, src_stat.st_size - size);
+        if (count < 0 && errno != EINTR)
+        {
+            error = strerror(errno);
+        }
+        else if (count == 0)
+        {
+            break;
+        }
+        size += count > 0 ? count : 0;
+    }
+
+    close(fd);
+    *src_size = size;
+    return error;
+}
+
+// Serve one request. Returns false once the connection should be closed
+static bool sexp_prettify_server_handle(struct PrettifySExprServerWorker *worker, int fd)
+{
+    struct PrettifySExprServer *server = worker->server;
+
+    struct PrettifySExprServerRequest request;
+    if (!sexp_prettify_server_recv_all(fd, &request, sizeof(request)))
+    {
+        return false;
+    }
+
+    const uint64_t start_time = sexp_prettify_server_now();
+
+    // Framing errors can not be recovered from as the rest of the stream is not trusted anymore
+    if (request.magic != PRETTIFY_SEXPR_SERVER_REQUEST_MAGIC || request.size > PRETTIFY_SEXPR_SERVER_MAX_PAYLOAD_SIZE || request.style_size > PRETTIFY_SEXPR_SERVER_MAX_STYLE_SIZE)
+    {
+        return false;
+    }
+
+    // Read the style block and the payload, or the path with a NUL added
+    const size_t input_size = request.kind == PRETTIFY_SEXPR_SERVER_KIND_PATH ? request.size + 1 : request.size;
+    if (!sexp_prettify_server_reserve(&worker->style, &worker->style_capacity, request.style_size + 1) || !sexp_prettify_server_reserve(&worker->input, &worker->input_capacity, input_size + 1))
+    {
+        return false;
+    }
+
+    if (!sexp_prettify_server_recv_all(fd, worker->style, request.style_size) || !sexp_prettify_server_recv_all(fd, worker->input, request.size))
+    {
+        return false;
+    }
+    worker->style[request.style_size] = '\0';
+    worker->input[request.size] = '\0';
+
+    struct PrettifySExprServerResponse response = {.magic = PRETTIFY_SEXPR_SERVER_RESPONSE_MAGIC, .status = PRETTIFY_SEXPR_SERVER_STATUS_OK};
+    const char *error = NULL;
+    size_t src_size = request.size;
+
+    worker->output_size = 0;
+    worker->output_failed = false;
+
+    struct PrettifySExprState state;
+    if (request.kind == PRETTIFY_SEXPR_SERVER_KIND_STATS)
+    {
+        // Rendered into the output buffer like formatted output
+        char *text = NULL;
+        size_t text_size = 0;
+        FILE *stream = open_memstream(&text, &text_size);
+        if (stream)
+        {
+            pthread_mutex_lock(&server->lock);
+            sexp_prettify_server_summary(server, stream);
+            pthread_mutex_unlock(&server->lock);
+            fclose(stream);
+
+            if (sexp_prettify_server_reserve(&worker->output, &worker->output_capacity, text_size))
+            {
+                memcpy(worker->output, text, text_size);
+                worker->output_size = text_size;
+            }
+            free(text);
+        }
+        else
+        {
+            error = "Out of memory";
+        }
+        src_size = 0;
+    }
+    else if (request.kind != PRETTIFY_SEXPR_SERVER_KIND_PAYLOAD && request.kind != PRETTIFY_SEXPR_SERVER_KIND_PATH)
+    {
+        error = "Unknown request kind";
+    }
+    else if (request.mode > PRETTIFY_SEXPR_SERVER_MODE_CHECK)
+    {
+        error = "Unknown mode";
+    }
+    else if ((error = sexp_prettify_server_request_state(worker, &request, &state)) != NULL)
+    {
+        // Reported below
+    }
+    else if (request.kind == PRETTIFY_SEXPR_SERVER_KIND_PATH && (error = sexp_prettify_server_read_source(worker, worker->input, &src_size)) != NULL)
+    {
+        // Reported below
+    }
+    else if (request.mode == PRETTIFY_SEXPR_SERVER_MODE_CHECK)
+    {
+        struct PrettifySExprCheck check;
+        sexp_prettify_check_buffer(&state, worker->input, src_size, &check);
+        response.status = check.canonical ? PRETTIFY_SEXPR_SERVER_STATUS_OK : PRETTIFY_SEXPR_SERVER_STATUS_NOT_FORMATTED;
+        response.offset = check.offset;
+        response.line = check.line;
+        response.column = check.column;
+    }
+    else
+    {
+        // Formatting mostly adds indentation, so start a bit larger than the input (Minified output is never larger)
+        if (!sexp_prettify_server_reserve(&worker->output, &worker->output_capacity, src_size + src_size / 4 + PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE))
+        {
+            error = "Out of memory";
+        }
+        else
+        {
+            struct PrettifySExprSink sink;
+            sexp_prettify_sink_init(&sink, worker->output, worker->output_capacity, sexp_prettify_server_output_flush, worker);
+
+            if (request.mode == PRETTIFY_SEXPR_SERVER_MODE_MINIFY)
+            {
+                struct PrettifySExprMinifyState minify;
+                sexp_prettify_minify_init(&minify);
+                sexp_prettify_minify_buffer_to_sink(&minify, worker->input, src_size, &sink);
+            }
+            else
+            {
+                struct PrettifySExprIndex index;
+                sexp_prettify_index_init(&index, worker->index_entries, PRETTIFY_SEXPR_SERVER_INDEX_ENTRY_COUNT);
+                sexp_prettify_indexed(&state, worker->input, src_size, &sink, &index);
+            }
+            sexp_prettify_sink_flush(&sink);
+
+            if (worker->output_failed)
+            {
+                error = "Out of memory";
+            }
+        }
+    }
+
+    struct iovec iov[2] = {{&response, sizeof(response)}, {worker->output, worker->output_size}};
+    if (error)
+    {
+        response.status = PRETTIFY_SEXPR_SERVER_STATUS_ERROR;
+        iov[1].iov_base = (void *)error;
+        iov[1].iov_len = strlen(error);
+    }
+    response.size = iov[1].iov_len;
+    response.server_nanoseconds = sexp_prettify_server_now() - start_time;
+
+    const bool sent = sexp_prettify_server_send_all(fd, iov, 2);
+
+    pthread_mutex_lock(&server->lock);
+    if (error || !sent)
+    {
+        server->failed_count++;
+    }
+    server->bytes_in += src_size;
+    server->bytes_out += error ? 0 : response.size;
+    sexp_prettify_latency_add(&server->latency, sexp_prettify_server_now() - start_time);
+    pthread_mutex_unlock(&server->lock);
+
+    return sent;
+}
+
+/*
+ * Dispatch
+ * Idle connections are watched by the poller. Once one has a request (or hung up) it is queued for the next free worker,
+ * which serves that one request and hands the connection back to the poller. All queues are under the server lock.
+ */
+
+static bool sexp_prettify_server_queue_push(struct PrettifySExprServerQueue *queue, int fd)
+{
+    if (queue->count == queue->capacity)
+    {
+        const size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+        int *fds = realloc(queue->fds, capacity * sizeof(*fds));
+        if (!fds)
+        {
+            return false;
+        }
+        queue->fds = fds;
+        queue->capacity = capacity;
+    }
+
+    queue->fds[queue->count++] = fd;
+    return true;
+}
+
+static int sexp_prettify_server_queue_pop(struct PrettifySExprServerQueue *queue)
+{
+    const int fd = queue->fds[0];
+    queue->count--;
+    memmove(queue->fds, queue->fds + 1, queue->count * sizeof(*queue->fds));
+    return fd;
+}
+
+static void sexp_prettify_server_queue_close(struct PrettifySExprServerQueue *queue)
+{
+    for (size_t i = 0; i < queue->count; i++)
+    {
+        close(queue->fds[i]);
+    }
+    free(queue->fds);
+    memset(queue, 0, sizeof(*queue));
+}
+
+static void sexp_prettify_server_wake(struct PrettifySExprServer *server)
+{
+    // A full pipe already wakes the poller
+    const char byte = 0;
+    while (write(server->wake_fds[1], &byte, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+// Watch an idle connection, or close it if the poller can not hold another one
+static bool sexp_prettify_server_watch(struct pollfd **fds, size_t *count, size_t *capacity, int fd)
+{
+    if (*count == *capacity)
+    {
+        const size_t grown = *capacity * 2;
+        struct pollfd *grown_fds = realloc(*fds, grown * sizeof(**fds));
+        if (!grown_fds)
+        {
+            close(fd);
+            return false;
+        }
+        *fds = grown_fds;
+        *capacity = grown;
+    }
+
+    (*fds)[*count] = (struct pollfd){.fd = fd, .events = POLLIN};
+    (*count)++;
+    return true;
+}
+
+static void *sexp_prettify_server_poller(void *context)
+{
+    struct PrettifySExprServer *server = (struct PrettifySExprServer *)context;
+
+    // The wake pipe and the listening socket, then every idle connection
+    size_t count = 2;
+    size_t capacity = 64;
+    struct pollfd *fds = malloc(capacity * sizeof(*fds));
+    if (!fds)
+    {
+        return NULL;
+    }
+    fds[0] = (struct pollfd){.fd = server->wake_fds[0], .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+
+    while (true)
+    {
+        if (poll(fds, count, -1) < 0)
+        {
+            // Out of memory for the poll set is transient, like running out of descriptors below
+            if (errno != EINTR)
+            {
+                usleep(10000);
+            }
+            continue;
+        }
+
+        // Hand over the connections with a request, and take back the ones whose request was served
+        pthread_mutex_lock(&server->lock);
+        for (size_t i = count; i-- > 2;)
+        {
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            if (sexp_prettify_server_queue_push(&server->ready, fds[i].fd))
+            {
+                pthread_cond_signal(&server->ready_cond);
+            }
+            else
+            {
+                close(fds[i].fd);
+            }
+            fds[i] = fds[--count];
+        }
+
+        for (size_t i = 0; i < server->returned.count; i++)
+        {
+            sexp_prettify_server_watch(&fds, &count, &capacity, server->returned.fds[i]);
+        }
+        server->returned.count = 0;
+        const bool stopping = server->stopping;
+        pthread_mutex_unlock(&server->lock);
+
+        if (stopping)
+        {
+            break;
+        }
+
+        if (fds[0].revents != 0)
+        {
+            char drain[64];
+            while (read(server->wake_fds[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+
+        // The listening socket does not block, so take every pending connection
+        while (fds[1].revents != 0)
+        {
+            const int fd = accept(server->listen_fd, NULL, NULL);
+            if (fd < 0)
+            {
+                // Transient, but do not spin if the process ran out of descriptors
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    usleep(10000);
+                }
+                break;
+            }
+
+            // Only applies while a request is being received or its response sent, as idle connections are not read from
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            const struct timeval timeout = {.tv_sec = PRETTIFY_SEXPR_SERVER_TIMEOUT_SECONDS};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            sexp_prettify_server_watch(&fds, &count, &capacity, fd);
+        }
+    }
+
+    for (size_t i = 2; i < count; i++)
+    {
+        close(fds[i].fd);
+    }
+    free(fds);
+    return NULL;
+}
+
+static void *sexp_prettify_server_worker(void *context)
+{
+    struct PrettifySExprServerWorker *worker = (struct PrettifySExprServerWorker *)context;
+    struct PrettifySExprServer *server = worker->server;
+
+    pthread_mutex_lock(&server->lock);
+    while (true)
+    {
+        while (server->ready.count == 0 && !server->stopping)
+        {
+            pthread_cond_wait(&server->ready_cond, &server->lock);
+        }
+
+        if (server->stopping)
+        {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+
+        const int fd = sexp_prettify_server_queue_pop(&server->ready);
+        worker->conn_fd = fd;
+        pthread_mutex_unlock(&server->lock);
+
+        const bool keep = sexp_prettify_server_handle(worker, fd);
+
+        pthread_mutex_lock(&server->lock);
+        worker->conn_fd = -1;
+        if (keep && !server->stopping && sexp_prettify_server_queue_push(&server->returned, fd))
+        {
+            sexp_prettify_server_wake(server);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+}
+
+/*
+ * Server
+ */
+
+bool sexp_prettify_server_init(struct PrettifySExprServer *server, const char *socket_path, unsigned int thread_count, const struct PrettifySExprState *profiles[PRETTIFY_SEXPR_SERVER_PROFILE_COUNT])
+{
+    struct sockaddr_un address;
+    if (!socket_path || strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < PRETTIFY_SEXPR_SERVER_PROFILE_COUNT; i++)
+    {
+        if (!profiles[i])
+        {
+            return false;
+        }
+    }
+
+    if (thread_count == 0)
+    {
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpu_count > 0 ? (unsigned int)cpu_count : 1;
+    }
+
+    memset(server, 0, sizeof(*server));
+    server->socket_path = socket_path;
+    server->thread_count = thread_count;
+    memcpy(server->profiles, profiles, sizeof(server->profiles));
+    server->listen_fd = -1;
+    server->wake_fds[0] = -1;
+    server->wake_fds[1] = -1;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready_cond, NULL);
+    return sexp_prettify_latency_init(&server->latency, PRETTIFY_SEXPR_SERVER_LATENCY_SAMPLES);
+}
+
+void sexp_prettify_server_free(struct PrettifySExprServer *server)
+{
+    sexp_prettify_latency_free(&server->latency);
+    pthread_cond_destroy(&server->ready_cond);
+    pthread_mutex_destroy(&server->lock);
+}
+
+static bool sexp_prettify_server_bind(struct PrettifySExprServer *server)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strcpy(address.sun_path, server->socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (server->listen_fd < 0)
+    {
+        return false;
+    }
+
+    if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (errno != EADDRINUSE)
+        {
+            return false;
+        }
+
+        // Replace the socket file only if no server answers on it anymore
+        const int probe_fd = sexp_prettify_client_connect(server->socket_path);
+        if (probe_fd >= 0)
+        {
+            close(probe_fd);
+            errno = EADDRINUSE;
+            return false;
+        }
+
+        struct stat socket_stat;
+        if (errno != ECONNREFUSED || lstat(server->socket_path, &socket_stat) != 0 || !S_ISSOCK(socket_stat.st_mode) || unlink(server->socket_path) != 0 ||
+            bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            errno = EADDRINUSE;
+            return false;
+        }
+    }
+
+    // Sources and formatted output of the user pass through here, so nobody else may connect. Not listening yet
+    if (chmod(server->socket_path, 0600) != 0 || listen(server->listen_fd, SOMAXCONN) != 0)
+    {
+        const int error = errno;
+        unlink(server->socket_path);
+        errno = error;
+        return false;
+    }
+
+    return true;
+}
+
+bool sexp_prettify_server_start(struct PrettifySExprServer *server)
+{
+    if (!sexp_prettify_server_bind(server))
+    {
+        const int error = errno;
+        if (server->listen_fd >= 0)
+        {
+            close(server->listen_fd);
+            server->listen_fd = -1;
+        }
+        errno = error;
+        return false;
+    }
+
+    server->stopping = false;
+    server->poller_started = false;
+    server->worker_count = 0;
+    server->workers = calloc(server->thread_count, sizeof(*server->workers));
+    if (!server->workers || pipe(server->wake_fds) != 0)
+    {
+        sexp_prettify_server_stop(server);
+        errno = ENOMEM;
+        return false;
+    }
+
+    for (; server->worker_count < server->thread_count; server->worker_count++)
+    {
+        struct PrettifySExprServerWorker *worker = &server->workers[server->worker_count];
+        worker->server = server;
+        worker->conn_fd = -1;
+        worker->output_capacity = PRETTIFY_SEXPR_OUTPUT_CHUNK_SIZE * 16;
+        worker->output = malloc(worker->output_capacity);
+        worker->index_entries = malloc(PRETTIFY_SEXPR_SERVER_INDEX_ENTRY_COUNT * sizeof(*worker->index_entries));
+        if (!worker->output || !worker->index_entries || pthread_create(&worker->thread, NULL, sexp_prettify_server_worker, worker) != 0)
+        {
+            free(worker->output);
+            free(worker->index_entries);
+            break;
+        }
+    }
+
+    // Serve with the workers that could be started
+    for (int i = 0; i < 2 && server->worker_count > 0; i++)
+    {
+        fcntl(server->wake_fds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(server->wake_fds[i], F_SETFL, O_NONBLOCK);
+    }
+    server->poller_started = server->worker_count > 0 && pthread_create(&server->poller, NULL, sexp_prettify_server_poller, server) == 0;
+    if (!server->poller_started)
+    {
+        sexp_prettify_server_stop(server);
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+void sexp_prettify_server_stop(struct PrettifySExprServer *server)
+{
+    if (server->listen_fd < 0)
+    {
+        return;
+    }
+
+    // Wake the poller, idle workers and those waiting for the rest of a request. Responses in progress are still sent
+    pthread_mutex_lock(&server->lock);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->ready_cond);
+    for (unsigned int i = 0; i < server->worker_count; i++)
+    {
+        if (server->workers[i].conn_fd >= 0)
+        {
+            shutdown(server->workers[i].conn_fd, SHUT_RD);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (server->poller_started)
+    {
+        sexp_prettify_server_wake(server);
+        pthread_join(server->poller, NULL);
+        server->poller_started = false;
+    }
+
+    for (unsigned int i = 0; i < server->worker_count; i++)
+    {
+        struct PrettifySExprServerWorker *worker = &server->workers[i];
+        pthread_join(worker->thread, NULL);
+        free(worker->input);
+        free(worker->output);
+        free(worker->style);
+        free(worker->prefixes);
+        free(worker->index_entries);
+    }
+    free(server->workers);
+    server->workers = NULL;
+
+    // Connections the poller or the workers did not get to
+    sexp_prettify_server_queue_close(&server->ready);
+    sexp_prettify_server_queue_close(&server->returned);
+    for (int i = 0; i < 2; i++)
+    {
+        if (server->wake_fds[i] >= 0)
+        {
+            close(server->wake_fds[i]);
+            server->wake_fds[i] = -1;
+        }
+    }
+
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    unlink(server->socket_path);
+}
+
+void sexp_prettify_server_summary(struct PrettifySExprServer *server, FILE *stream)
+{
+    const struct PrettifySExprLatency *latency = &server->latency;
+    fprintf(stream, "Server: %llu requests, %llu failed, %llu bytes in, %llu bytes out, %u workers, latency p50 %.1f us, p99 %.1f us, max %.1f us\n", (unsigned long long)latency->count,
+            (unsigned long long)server->failed_count, (unsigned long long)server->bytes_in, (unsigned long long)server->bytes_out, server->worker_count, sexp_prettify_latency_percentile(latency, 50) / 1e3,
+            sexp_prettify_latency_percentile(latency, 99) / 1e3, latency->max / 1e3);
+}
+
+/*
+ * Client
+ */
+
+bool sexp_prettify_server_default_path(char *path, size_t size)
+{
+    const char *socket_path = getenv("SEXP_PRETTIFY_SOCKET");
+    if (socket_path && socket_path[0])
+    {
+        return (size_t)snprintf(path, size, "%s", socket_path) < size;
+    }
+
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && runtime_dir[0])
+    {
+        return (size_t)snprintf(path, size, "%s/sexp_prettify.sock", runtime_dir) < size;
+    }
+
+    return (size_t)snprintf(path, size, "/tmp/sexp_prettify-%u.sock", (unsigned int)getuid()) < size;
+}
+
+int sexp_prettify_client_connect(const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    while (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (errno != EINTR)
+        {
+            const int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+bool sexp_prettify_client_request(int fd, const struct PrettifySExprServerRequest *request, const char *style, const char *data, struct PrettifySExprServerResponse *response,
+                                  PrettifySExprWriteFunc write_func, void *write_func_context)
+{
+    struct iovec iov[3] = {{(void *)request, sizeof(*request)}, {(void *)style, request->style_size}, {(void *)data, request->size}};
+    if (!sexp_prettify_server_send_all(fd, iov, 3))
+    {
+        return false;
+    }
+
+    if (!sexp_prettify_server_recv_all(fd, response, sizeof(*response)) || response->magic != PRETTIFY_SEXPR_SERVER_RESPONSE_MAGIC)
+    {
+        errno = errno ? errno : EPROTO;
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    uint64_t remaining = response->size;
+    while (remaining > 0)
+    {
+        ssize_t count = recv(fd, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer), 0);
+        if (count <= 0)
+        {
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            errno = count == 0 ? EPROTO : errno;
+            return false;
+        }
+
+        write_func(buffer, count, write_func_context);
+        remaining -= count;
+    }
+
+    return true;
+}
@@ -0,0 +1,202 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Persistent formatter server on a Unix domain socket, and the client side of its protocol.
+// A pool of worker threads keeps its profiles and buffers warm between requests, so editor integrations and save hooks
+// only pay for a connect() and a round trip instead of starting a formatter process for every small file.
+// A poller thread watches the idle connections and hands each request to the next free worker, so any number of clients
+// can stay connected without holding on to a worker.
+// Note: Unlike sexp_prettify.c this uses the heap, pthreads, sockets and the file system.
+
+#ifndef SEXP_PRETTIFY_SERVER
+#define SEXP_PRETTIFY_SERVER
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sexp_prettify.h"
+
+// Protocol version is part of the magic, so a mismatched client and server reject each other's frames
+#define PRETTIFY_SEXPR_SERVER_REQUEST_MAGIC 0x31525853  // "SXR1"
+#define PRETTIFY_SEXPR_SERVER_RESPONSE_MAGIC 0x31415853 // "SXA1"
+
+// Largest payload (or path) and style block a request may carry
+#define PRETTIFY_SEXPR_SERVER_MAX_PAYLOAD_SIZE (256 * 1024 * 1024)
+#define PRETTIFY_SEXPR_SERVER_MAX_STYLE_SIZE (64 * 1024)
+
+// Structural index entries held by each worker
+#define PRETTIFY_SEXPR_SERVER_INDEX_ENTRY_COUNT (16 * 1024)
+
+// A connection that stalls this long in the middle of a request is dropped, so it can not hold on to a worker.
+// Idle connections between requests are kept for as long as the client likes
+#define PRETTIFY_SEXPR_SERVER_TIMEOUT_SECONDS 10
+
+// Request latencies kept for the percentiles of the server summary. Older ones are overwritten
+#define PRETTIFY_SEXPR_SERVER_LATENCY_SAMPLES (64 * 1024)
+
+enum PrettifySExprServerKind
+{
+    PRETTIFY_SEXPR_SERVER_KIND_PAYLOAD = 0, ///< The request carries the source itself
+    PRETTIFY_SEXPR_SERVER_KIND_PATH,        ///< The request carries the path of a source file the server reads
+    PRETTIFY_SEXPR_SERVER_KIND_STATS,       ///< Server summary (request count, latency percentiles) as text
+};
+
+enum PrettifySExprServerMode
+{
+    PRETTIFY_SEXPR_SERVER_MODE_PRETTIFY = 0,
+    PRETTIFY_SEXPR_SERVER_MODE_MINIFY,
+    PRETTIFY_SEXPR_SERVER_MODE_CHECK, ///< No output. The response reports the first difference instead
+};
+
+enum PrettifySExprServerProfile
+{
+    PRETTIFY_SEXPR_SERVER_PROFILE_NONE = 0,
+    PRETTIFY_SEXPR_SERVER_PROFILE_KICAD,
+    PRETTIFY_SEXPR_SERVER_PROFILE_KICAD_COMPACT,
+    PRETTIFY_SEXPR_SERVER_PROFILE_COUNT,
+};
+
+enum PrettifySExprServerStatus
+{
+    PRETTIFY_SEXPR_SERVER_STATUS_OK = 0,
+    PRETTIFY_SEXPR_SERVER_STATUS_NOT_FORMATTED, ///< Check mode: offset, line and column give the first difference
+    PRETTIFY_SEXPR_SERVER_STATUS_ERROR,         ///< The body is an error message
+};
+
+/*
+ * Framing (native byte order, both ends are on the same host)
+ *  - Request  : Header, then style_size bytes of NUL terminated prefixes (compact list ones first), then size bytes of payload or path
+ *  - Response : Header, then size bytes of output, stats text or error message
+ * A connection may carry any number of requests, one after the other.
+ */
+struct PrettifySExprServerRequest
+{
+    uint32_t magic;
+    uint8_t kind;    ///< enum PrettifySExprServerKind
+    uint8_t mode;    ///< enum PrettifySExprServerMode
+    uint8_t profile; ///< enum PrettifySExprServerProfile
+    uint8_t reserved;
+    int32_t consecutive_token_wrap_threshold;
+    int32_t compact_list_column_limit;
+    uint16_t compact_list_prefixes_count; ///< Prefixes added on top of the profile ones (like -l after -p)
+    uint16_t shortform_prefixes_count;    ///< Prefixes added on top of the profile ones (like -s after -p)
+    uint32_t style_size;
+    uint64_t size;
+};
+
+struct PrettifySExprServerResponse
+{
+    uint32_t magic;
+    uint32_t status; ///< enum PrettifySExprServerStatus
+    uint64_t size;
+    uint64_t server_nanoseconds; ///< Time from the request header arriving to the response being ready to send
+    uint64_t offset;             ///< Check mode (Same as struct PrettifySExprCheck)
+    uint64_t line;
+    uint64_t column;
+};
+
+/*
+ * Latency Samples
+ */
+
+struct PrettifySExprLatency
+{
+    uint64_t *samples; ///< Nanoseconds. Once full the oldest samples are overwritten
+    size_t capacity;
+    uint64_t count; ///< Samples added in total
+    uint64_t max;
+};
+
+bool sexp_prettify_latency_init(struct PrettifySExprLatency *latency, size_t capacity);
+void sexp_prettify_latency_free(struct PrettifySExprLatency *latency);
+void sexp_prettify_latency_add(struct PrettifySExprLatency *latency, uint64_t nanoseconds);
+
+// Nearest rank percentile (0 to 100) of the kept samples in nanoseconds. 0 if there are none
+uint64_t sexp_prettify_latency_percentile(const struct PrettifySExprLatency *latency, double percentile);
+
+// Print "<name>: <count> requests, latency p50 .. us, p99 .. us, max .. us"
+void sexp_prettify_latency_summary(const struct PrettifySExprLatency *latency, const char *name, FILE *stream);
+
+/*
+ * Server
+ */
+
+struct PrettifySExprServerWorker;
+
+// FIFO of connection descriptors
+struct PrettifySExprServerQueue
+{
+    int *fds;
+    size_t count;
+    size_t capacity;
+};
+
+struct PrettifySExprServer
+{
+    // Settings
+    const char *socket_path;
+    unsigned int thread_count;
+    const struct PrettifySExprState *profiles[PRETTIFY_SEXPR_SERVER_PROFILE_COUNT]; ///< Configured states of each profile. The wrap settings come with each request
+
+    // Running
+    int listen_fd;
+    int wake_fds[2]; ///< Pipe that wakes the poller when a connection is handed back or the server stops
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    pthread_t poller;
+    bool poller_started;
+    struct PrettifySExprServerQueue ready;    ///< Connections with a request waiting, for the workers
+    struct PrettifySExprServerQueue returned; ///< Connections whose request was served, for the poller to watch again
+    struct PrettifySExprServerWorker *workers;
+    unsigned int worker_count;
+
+    // Summary (Updated under lock as each request completes)
+    uint64_t failed_count;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    struct PrettifySExprLatency latency;
+};
+
+/*
+ * thread_count : Number of worker threads. 0 picks the number of online cpus
+ * profiles     : Configured state of each enum PrettifySExprServerProfile. Must outlive the server
+ */
+bool sexp_prettify_server_init(struct PrettifySExprServer *server, const char *socket_path, unsigned int thread_count, const struct PrettifySExprState *profiles[PRETTIFY_SEXPR_SERVER_PROFILE_COUNT]);
+void sexp_prettify_server_free(struct PrettifySExprServer *server);
+
+// Bind the socket (only accessible to the current user) and start the poller and the workers. A stale socket file left by a server that
+// is gone is replaced, a live one is not. Returns false with errno set (EADDRINUSE if another server is listening)
+bool sexp_prettify_server_start(struct PrettifySExprServer *server);
+
+// Stop accepting, let requests in progress finish, close every connection, join the threads and remove the socket file. The summary is kept
+void sexp_prettify_server_stop(struct PrettifySExprServer *server);
+
+// Print the request count, failures, bytes and the latency percentiles of requests, from their header arriving to the response being sent
+void sexp_prettify_server_summary(struct PrettifySExprServer *server, FILE *stream);
+
+/*
+ * Client
+ */
+
+// $SEXP_PRETTIFY_SOCKET, else sexp_prettify.sock in $XDG_RUNTIME_DIR, else /tmp/sexp_prettify-<uid>.sock
+bool sexp_prettify_server_default_path(char *path, size_t size);
+
+// Returns the connected socket, or -1 with errno set
+int sexp_prettify_client_connect(const char *socket_path);
+
+// Send a request and stream the response body through write_func (called with pieces of it as they arrive)
+// Returns false with errno set if the connection failed or the server sent a malformed response
+bool sexp_prettify_client_request(int fd, const struct PrettifySExprServerRequest *request, const char *style, const char *data, struct PrettifySExprServerResponse *response,
+                                  PrettifySExprWriteFunc write_func, void *write_func_context);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
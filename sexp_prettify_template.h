@@ -0,0 +1,442 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Header only C++17 variant of sexp_prettify() with byte identical output, templated on a sink and a profile.
+// With a StaticProfile every setting is a compile time constant, so each profile compiles into its own fully inlined loop
+// without the PrettifySExprPutcFunc indirection. RuntimeProfile covers settings only known at run time.
+
+#ifndef SEXP_PRETTIFY_TEMPLATE
+#define SEXP_PRETTIFY_TEMPLATE
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C"
+{
+#include "sexp_prettify.h"
+}
+
+namespace sexp_prettify_template
+{
+
+/* Profiles */
+
+template <typename Prefixes> constexpr std::size_t prefix_longest(const Prefixes &prefixes)
+{
+    std::size_t longest = 0;
+    for (const std::string_view prefix : prefixes)
+    {
+        longest = std::max(longest, prefix.size());
+    }
+    return longest;
+}
+
+// Compile time profile. Prefix tables are constexpr std::array<std::string_view, N> with static storage
+template <char IndentChar, unsigned int IndentSize, unsigned int ConsecutiveTokenWrapThreshold, unsigned int CompactListColumnLimit, const auto &CompactListPrefixes, const auto &ShortformPrefixes>
+struct StaticProfile
+{
+    static_assert(IndentChar != '\0' && IndentSize > 0, "Same restrictions as sexp_prettify_init()");
+
+    static constexpr char indent_char = IndentChar;
+    static constexpr unsigned int indent_size = IndentSize;
+    static constexpr unsigned int consecutive_token_wrap_threshold = ConsecutiveTokenWrapThreshold; ///< If 0 then token wrapping is disabled
+    static constexpr unsigned int compact_list_column_limit = CompactListColumnLimit;               ///< If 0 then compact list entries never move to the next line
+    static constexpr const auto &compact_list_prefixes = CompactListPrefixes;
+    static constexpr const auto &shortform_prefixes = ShortformPrefixes;
+
+    // Longest list prefix that can match. Sizes the prefix buffer of the formatter
+    static constexpr std::size_t prefix_token_max = std::max(prefix_longest(CompactListPrefixes), prefix_longest(ShortformPrefixes));
+};
+
+inline constexpr std::array<std::string_view, 0> no_prefixes = {};
+inline constexpr std::array<std::string_view, 1> kicad_compact_list_prefixes = {"pts"};
+inline constexpr std::array<std::string_view, 6> kicad_shortform_prefixes = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+
+// Same settings as sexp_prettify_cpp_cli without a profile, with -p kicad and with -p kicad-compact
+using ZeroStyleProfile = StaticProfile<PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD,
+                                       PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT, no_prefixes, no_prefixes>;
+using KicadProfile = StaticProfile<PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD,
+                                   PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT, kicad_compact_list_prefixes, no_prefixes>;
+using KicadCompactProfile = StaticProfile<PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD,
+                                          PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT, kicad_compact_list_prefixes, kicad_shortform_prefixes>;
+
+// Run time profile (Generic instantiation). Same meaning as the settings of sexp_prettify_init(), sexp_prettify_compact_list_set() and sexp_prettify_shortform_set()
+struct RuntimeProfile
+{
+    static constexpr std::size_t prefix_token_max = 64;
+
+    char indent_char = PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR;
+    unsigned int indent_size = PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE;
+    unsigned int consecutive_token_wrap_threshold = PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD;
+    unsigned int compact_list_column_limit = PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT;
+    std::vector<std::string> compact_list_prefixes;
+    std::vector<std::string> shortform_prefixes;
+
+    // Returns false if the prefix is empty or longer than prefix_token_max
+    bool compact_list_add(std::string_view prefix)
+    {
+        if (prefix.empty() || prefix.size() > prefix_token_max)
+        {
+            return false;
+        }
+        compact_list_prefixes.emplace_back(prefix);
+        return true;
+    }
+
+    bool shortform_add(std::string_view prefix)
+    {
+        if (prefix.empty() || prefix.size() > prefix_token_max)
+        {
+            return false;
+        }
+        shortform_prefixes.emplace_back(prefix);
+        return true;
+    }
+};
+
+/* Sinks */
+
+// Writes through an output iterator (eg. a char pointer into a large enough buffer or std::back_inserter())
+template <typename OutputIt> struct IteratorSink
+{
+    OutputIt out;
+
+    void put(char c) { *out++ = c; }
+    void fill(char c, std::size_t count) { out = std::fill_n(out, count, c); }
+};
+
+// Collects output in a fixed buffer and calls flush_func(const char *buffer, size_t size) when it is full or on flush()
+template <typename FlushFunc, std::size_t Size = 64 * 1024> class BufferSink
+{
+  public:
+    explicit BufferSink(FlushFunc flush_func) : flush_func(flush_func) {}
+
+    void put(char c)
+    {
+        if (count == Size)
+        {
+            flush();
+        }
+        buffer[count++] = c;
+    }
+
+    void fill(char c, std::size_t size)
+    {
+        while (size > 0)
+        {
+            if (count == Size)
+            {
+                flush();
+            }
+            const std::size_t step = std::min(size, Size - count);
+            memset(&buffer[count], c, step);
+            count += step;
+            size -= step;
+        }
+    }
+
+    void flush()
+    {
+        if (count > 0)
+        {
+            flush_func(buffer, count);
+            count = 0;
+        }
+    }
+
+  private:
+    FlushFunc flush_func;
+    std::size_t count = 0;
+    char buffer[Size];
+};
+
+/* Formatter */
+
+/*
+ * Same rules as sexp_prettify_char() in sexp_prettify.c. Input may be split at any byte boundary across put() and feed() calls.
+ * The sink needs put(char) and fill(char, count). The profile is copied (Empty for a StaticProfile).
+ */
+template <typename Profile, typename Sink> class Formatter
+{
+  public:
+    explicit Formatter(Sink &sink, const Profile &profile = Profile()) : sink(sink), profile(profile) {}
+
+    void feed(std::string_view src)
+    {
+        for (const char c : src)
+        {
+            put(c);
+        }
+    }
+
+    void put(const char c)
+    {
+        // Parse quoted string
+        if (in_quote || c == '"')
+        {
+            if (space_pending)
+            {
+                // Add space before this quoted string
+                sink.put(' ');
+                column += 1;
+                space_pending = false;
+            }
+
+            if (escape_next_char)
+            {
+                escape_next_char = false;
+            }
+            else if (c == '\\')
+            {
+                escape_next_char = true;
+            }
+            else if (c == '"')
+            {
+                in_quote = !in_quote;
+            }
+
+            sink.put(c);
+            column += 1;
+            c_out_prev = c;
+            return;
+        }
+
+        // Parse space and newlines
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            space_pending = true;
+
+            if (scanning_for_prefix)
+            {
+                // Check if we got a match against an expected prefix for fixed indent mode
+                if (prefix_length <= Profile::prefix_token_max)
+                {
+                    const std::string_view token(prefix_token, prefix_length);
+
+                    if (prefix_listed(profile.compact_list_prefixes, token))
+                    {
+                        compact_list_mode = true;
+                        compact_list_indent = indent;
+                    }
+
+                    if (prefix_listed(profile.shortform_prefixes, token))
+                    {
+                        shortform_mode = true;
+                        shortform_indent = indent;
+                    }
+                }
+
+                scanning_for_prefix = false;
+            }
+            return;
+        }
+
+        // Parse Opening parentheses
+        if (c == '(')
+        {
+            space_pending = false;
+
+            if (compact_list_mode)
+            {
+                if ((column < profile.compact_list_column_limit && c_out_prev == ')') || profile.compact_list_column_limit == 0)
+                {
+                    // Is a consecutive list and still within column limit (or column limit disabled)
+                    sink.put(' ');
+                    column += 1;
+                }
+                else
+                {
+                    // Move this list to the next line
+                    newline_indent(compact_list_indent);
+                }
+            }
+            else if (shortform_mode)
+            {
+                // In one liner mode
+                sink.put(' ');
+                column += 1;
+            }
+            else
+            {
+                // Start scanning for prefix for special list handling
+                scanning_for_prefix = true;
+                prefix_length = 0;
+
+                if (indent > 0)
+                {
+                    newline_indent(indent);
+                }
+            }
+
+            singular_element = true;
+            indent++;
+
+            sink.put('(');
+            column += 1;
+
+            c_out_prev = '(';
+            return;
+        }
+
+        // Parse Closing Brace
+        if (c == ')')
+        {
+            const bool curr_shortform_mode = shortform_mode;
+
+            space_pending = false;
+            scanning_for_prefix = false;
+
+            if (indent > 0)
+            {
+                indent--;
+            }
+
+            if (compact_list_mode && indent < compact_list_indent)
+            {
+                compact_list_mode = false;
+            }
+
+            if (shortform_mode && indent < shortform_indent)
+            {
+                shortform_mode = false;
+            }
+
+            if (wrapped_list)
+            {
+                // This was a list with wrapped tokens so is already indented
+                newline_indent(indent);
+                singular_element = false;
+                wrapped_list = false;
+            }
+            else if (singular_element)
+            {
+                singular_element = false;
+            }
+            else if (!curr_shortform_mode)
+            {
+                // End of a parent element
+                newline_indent(indent);
+            }
+
+            sink.put(')');
+            column += 1;
+
+            if (indent == 0)
+            {
+                // Cap Root Element
+                sink.put('\n');
+                column = 0;
+            }
+
+            c_out_prev = ')';
+            return;
+        }
+
+        // Parse Characters
+        if (c != '\0')
+        {
+            if (c_out_prev == ')' && !shortform_mode)
+            {
+                // Is Bare token after a list that should be on next line
+                newline_indent(indent);
+                space_pending = false;
+            }
+            else if (space_pending && !shortform_mode && !compact_list_mode && profile.consecutive_token_wrap_threshold != 0 && column >= profile.consecutive_token_wrap_threshold)
+            {
+                // Token is above wrap threshold. Move token to next line
+                wrapped_list = true;
+                newline_indent(indent);
+                space_pending = false;
+            }
+            else if (space_pending && c_out_prev != '(')
+            {
+                // Space was pending
+                sink.put(' ');
+                column += 1;
+                space_pending = false;
+            }
+
+            // Collect the list prefix (Only its length is kept once it is too long to match)
+            if (scanning_for_prefix)
+            {
+                if (prefix_length < Profile::prefix_token_max)
+                {
+                    prefix_token[prefix_length] = c;
+                }
+                prefix_length += (prefix_length <= Profile::prefix_token_max) ? 1 : 0;
+            }
+
+            sink.put(c);
+            column += 1;
+
+            c_out_prev = c;
+            return;
+        }
+    }
+
+  private:
+    template <typename Prefixes> static bool prefix_listed(const Prefixes &prefixes, std::string_view token)
+    {
+        for (const std::string_view prefix : prefixes)
+        {
+            if (prefix == token)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void newline_indent(unsigned int depth)
+    {
+        sink.put('\n');
+        sink.fill(profile.indent_char, depth * profile.indent_size);
+        column = depth * profile.indent_size;
+    }
+
+    Sink &sink;
+    Profile profile;
+
+    // Parsing Position Tracking
+    unsigned int indent = 0;
+    unsigned int column = 0;
+    char c_out_prev = '\0';
+
+    // Parsing state
+    bool in_quote = false;
+    bool escape_next_char = false;
+    bool singular_element = false;
+    bool space_pending = false;
+    bool wrapped_list = false;
+
+    // Prefix scanner to check if a list should be specially handled
+    bool scanning_for_prefix = false;
+    std::size_t prefix_length = 0;
+    char prefix_token[Profile::prefix_token_max > 0 ? Profile::prefix_token_max : 1];
+
+    // Fixed indent feature to place multiple elements in the same line for compactness
+    bool compact_list_mode = false;
+    unsigned int compact_list_indent = 0;
+
+    // Fixed indent feature to place multiple elements in the same line for compactness
+    bool shortform_mode = false;
+    unsigned int shortform_indent = 0;
+};
+
+// Format a whole buffer. Returns the output iterator past the last written character
+template <typename Profile, typename OutputIt> OutputIt prettify(std::string_view src, OutputIt out, const Profile &profile = Profile())
+{
+    IteratorSink<OutputIt> sink{out};
+    Formatter<Profile, IteratorSink<OutputIt>> formatter(sink, profile);
+    formatter.feed(src);
+    return sink.out;
+}
+
+} // namespace sexp_prettify_template
+
+#endif
@@ -12,6 +12,32 @@ echo "========================================================================"
 ./test_standard_single.sh ./sexp_prettify_cpp_cli   false
 ./test_standard_single.sh ./sexp_prettify_cli       false
 ./test_standard_single.sh ./sexp_prettify_cli.py    true
+./test_batch.sh ./sexp_prettify_cli
+./test_batch.sh "./sexp_prettify_cli --io-uring"
+./test_check.sh ./sexp_prettify_cpp_cli
+./test_check.sh ./sexp_prettify_cli
+./test_gen.sh ./sexp_prettify_cli
+./test_stats.sh ./sexp_prettify_cpp_cli
+./test_stats.sh ./sexp_prettify_cli
+./test_minify.sh ./sexp_prettify_cpp_cli
+./test_minify.sh ./sexp_prettify_cli
+./test_minify.sh ./sexp_prettify_cli.py
+./test_gzip.sh ./sexp_prettify_cli
+./test_pipeline.sh ./sexp_prettify_cli
+./test_parallel.sh ./sexp_prettify_cli
+./test_passthrough.sh ./sexp_prettify_cli
+./test_kicad_stream.sh ./sexp_prettify_kicad_cli
+./test_server.sh ./sexp_prettify_cli
+./test_python_ext.sh
+./test_kicad_alloc ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*
+./test_template_engine ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*
+
+# Reformat also runs on a generated board, minified and formatted, as those have far more root children than the testcases
+reformat_dir=$(mktemp -d)
+trap 'rm -rf "$reformat_dir"' EXIT
+./sexp_prettify_gen -s 256K -S 21 "$reformat_dir/minified.kicad_pcb"
+./sexp_prettify_gen -s 256K -S 22 -p kicad "$reformat_dir/formatted.kicad_pcb"
+./test_reformat ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/* "$reformat_dir"/*.kicad_pcb
 
 echo "All tests passed in all executables!"
 exit 0
\ No newline at end of file
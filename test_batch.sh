@@ -0,0 +1,87 @@
+#!/bin/bash
+# Batch mode: Format a copy of the testcases in place and compare against the expected kicad profile output
+
+executable=${1:-./sexp_prettify_cli}
+
+temp_dir="temp_batch"
+rm -rf "$temp_dir"
+mkdir -p "$temp_dir/lib/nested"
+
+# Files found in directories are picked by extension. Other files are left alone
+cp ./testcases/*.kicad_sym "$temp_dir/lib/"
+cp ./testcases/*.kicad_mod ./testcases/*.kicad_pcb "$temp_dir/lib/nested/"
+echo "(not (a kicad file))" > "$temp_dir/lib/notes.txt"
+
+if ! $executable -b -j 2 "$temp_dir/lib" 2> "$temp_dir/summary.txt"; then
+    echo "Batch run failed"
+    cat "$temp_dir/summary.txt"
+    exit 1
+fi
+
+all_passed=true
+for formatted_path in "$temp_dir"/lib/*.kicad_* "$temp_dir"/lib/nested/*.kicad_*; do
+    name=$(basename "$formatted_path")
+    expected="./testcases/standard/${name%.*}_formatted.${name##*.}"
+    if ! diff -q "$expected" "$formatted_path" > /dev/null; then
+        echo "FAILED: $formatted_path does not match $expected"
+        all_passed=false
+    fi
+done
+
+# Second run finds everything canonical and must not touch any file
+touch -d "2001-01-01 00:00:00" "$temp_dir"/lib/*.kicad_* "$temp_dir"/lib/nested/*.kicad_*
+if ! $executable -b "$temp_dir/lib" 2> "$temp_dir/summary.txt" || ! grep -q "Batch: 0 changed, 7 unchanged, 0 failed" "$temp_dir/summary.txt"; then
+    echo "FAILED: Second batch run should leave every file unchanged"
+    cat "$temp_dir/summary.txt"
+    all_passed=false
+fi
+
+if [ -n "$(find "$temp_dir/lib" -newermt "2001-01-02" -name "*.kicad_*")" ] || [ -n "$(find "$temp_dir/lib" -name ".*.??????")" ]; then
+    echo "FAILED: Second batch run rewrote files or left temp files behind"
+    all_passed=false
+fi
+
+if [ "$(cat "$temp_dir/lib/notes.txt")" != "(not (a kicad file))" ]; then
+    echo "FAILED: Batch mode modified a file without a KiCad extension"
+    all_passed=false
+fi
+
+# Paths from standard input, with a missing file reported without aborting the run
+cp ./testcases/ad620.kicad_sym "$temp_dir/stdin.kicad_sym"
+if printf '%s\n%s\n' "$temp_dir/missing.kicad_sym" "$temp_dir/stdin.kicad_sym" | $executable -b 2> "$temp_dir/summary.txt"; then
+    echo "FAILED: Batch mode should fail when a listed file is missing"
+    all_passed=false
+fi
+
+if ! diff -q ./testcases/standard/ad620_formatted.kicad_sym "$temp_dir/stdin.kicad_sym" > /dev/null; then
+    echo "FAILED: Batch mode stopped at the missing file"
+    all_passed=false
+fi
+
+# Replaced files keep the owner, group and mode of the original (Only root can hand a file to another user)
+echo "(kicad_symbol_lib  (version 20211014))" > "$temp_dir/owned.kicad_sym"
+chmod 0640 "$temp_dir/owned.kicad_sym"
+if [ "$(id -u)" = 0 ]; then
+    chown 65534:65534 "$temp_dir/owned.kicad_sym"
+fi
+expected_owner=$(stat -c "%u:%g %a" "$temp_dir/owned.kicad_sym")
+if ! $executable -b "$temp_dir/owned.kicad_sym" 2> "$temp_dir/summary.txt" || ! grep -q "Batch: 1 changed" "$temp_dir/summary.txt"; then
+    echo "FAILED: Batch mode did not replace a file to check its owner"
+    cat "$temp_dir/summary.txt"
+    all_passed=false
+fi
+
+owner=$(stat -c "%u:%g %a" "$temp_dir/owned.kicad_sym")
+if [ "$owner" != "$expected_owner" ]; then
+    echo "FAILED: Replaced file has owner and mode $owner instead of $expected_owner"
+    all_passed=false
+fi
+
+if $all_passed; then
+    rm -rf "$temp_dir"
+    echo "All batch tests passed for $executable"
+    exit 0
+else
+    echo "Some batch tests failed"
+    exit 1
+fi
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Check mode: Formatted files pass, unformatted files fail with the position of the first difference
+
+executable=$1
+
+all_passed=true
+
+function expect_check ()
+{
+    local expected_status=$1
+    shift
+
+    local status=0
+    "$@" 2> /dev/null || status=$?
+    if [ "$status" != "$expected_status" ]; then
+        echo "FAILED: '$*' exited with $status (expected $expected_status)"
+        all_passed=false
+    fi
+}
+
+for formatted in ./testcases/standard/*; do
+    expect_check 0 $executable -p kicad --check "$formatted"
+done
+
+for formatted in ./testcases/compact/*; do
+    expect_check 0 $executable -p kicad-compact -c "$formatted"
+done
+
+# Standard input is checked as a stream instead of as a whole mapped file
+if ! $executable -p kicad --check - < ./testcases/standard/flat_hierarchy_schlib_formatted.kicad_sym; then
+    echo "FAILED: Formatted standard input reported as not formatted"
+    all_passed=false
+fi
+
+# Reported position must match the first byte cmp finds
+unformatted=./testcases/group_and_image.kicad_pcb
+report=$($executable -p kicad --check "$unformatted" 2>&1)
+expected_line=$($executable -p kicad "$unformatted" | cmp - "$unformatted" | sed -E 's/.*char ([0-9]+), line ([0-9]+)/\2/')
+expected_offset=$(($($executable -p kicad "$unformatted" | cmp - "$unformatted" | sed -E 's/.*char ([0-9]+),.*/\1/') - 1))
+if [[ "$report" != "$unformatted:$expected_line:"*"byte offset $expected_offset" ]]; then
+    echo "FAILED: Unexpected check report '$report' (expected line $expected_line and offset $expected_offset)"
+    all_passed=false
+fi
+
+if $all_passed; then
+    echo "All check tests passed for $executable"
+    exit 0
+else
+    echo "Some check tests failed"
+    exit 1
+fi
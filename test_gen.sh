@@ -0,0 +1,57 @@
+#!/bin/bash
+# Synthetic input generator: Deterministic from its seed, honours the target size and its pre-formatted output is already formatted
+
+executable=$1
+generator=./sexp_prettify_gen
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+$generator -s 2M -S 7 -I 5 "$tmp_dir/first.kicad_pcb"
+$generator -s 2M -S 7 -I 5 "$tmp_dir/second.kicad_pcb"
+$generator -s 2M -S 8 -I 5 "$tmp_dir/other.kicad_pcb"
+
+if ! cmp -s "$tmp_dir/first.kicad_pcb" "$tmp_dir/second.kicad_pcb"; then
+    echo "FAILED: Same seed generated different output"
+    all_passed=false
+fi
+
+if cmp -s "$tmp_dir/first.kicad_pcb" "$tmp_dir/other.kicad_pcb"; then
+    echo "FAILED: Different seeds generated the same output"
+    all_passed=false
+fi
+
+if [ "$(stat -c %s "$tmp_dir/first.kicad_pcb")" -lt $((2 * 1024 * 1024)) ]; then
+    echo "FAILED: Generated output is smaller than the target size"
+    all_passed=false
+fi
+
+for profile in zerostyle kicad kicad-compact; do
+    # The formatter uses zerostyle when no profile is given
+    style=()
+    if [ "$profile" != "zerostyle" ]; then
+        style=(-p $profile)
+    fi
+
+    $generator -s 1M -S 3 -d 6 -q 90 -l 40 -p $profile "$tmp_dir/formatted.kicad_pcb"
+    if ! $executable "${style[@]}" --check "$tmp_dir/formatted.kicad_pcb"; then
+        echo "FAILED: Generated $profile output is not formatted"
+        all_passed=false
+    fi
+
+    # Minified input formats to the same result in one pass
+    $executable "${style[@]}" "$tmp_dir/first.kicad_pcb" "$tmp_dir/first_formatted.kicad_pcb"
+    if ! $executable "${style[@]}" --check "$tmp_dir/first_formatted.kicad_pcb"; then
+        echo "FAILED: Formatting generated minified input is not stable for $profile"
+        all_passed=false
+    fi
+done
+
+if $all_passed; then
+    echo "All generator tests passed for $executable"
+    exit 0
+else
+    echo "Some generator tests failed"
+    exit 1
+fi
@@ -0,0 +1,89 @@
+#!/bin/bash
+# Gzip: Compressed input is formatted like the plain file (file, pipe, concatenated members) and gzip output decompresses to it
+# Also checks that check and minify modes see through gzip input and that corrupt or truncated input is an error
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+function expect_same ()
+{
+    local message=$1
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        echo "FAILED: $message"
+        all_passed=false
+    fi
+}
+
+for src in ./testcases/*.kicad_* ./testcases/standard/*; do
+    gzip -c "$src" > "$tmp_dir/src.gz"
+    $executable -p kicad "$src" "$tmp_dir/expected"
+
+    $executable -p kicad "$tmp_dir/src.gz" "$tmp_dir/output"
+    expect_same "Formatting gzip compressed $src differs from formatting it directly"
+
+    $executable -p kicad - - < "$tmp_dir/src.gz" > "$tmp_dir/output"
+    expect_same "Formatting gzip compressed $src from standard input differs from formatting it directly"
+
+    for level in 1 9; do
+        $executable -p kicad --gzip=$level "$tmp_dir/src.gz" "$tmp_dir/output.gz"
+        gzip -dc "$tmp_dir/output.gz" > "$tmp_dir/output"
+        expect_same "Gzip output (level $level) of $src does not decompress to the formatted output"
+    done
+
+    $executable -p kicad -z6 "$src" - | gzip -dc > "$tmp_dir/output"
+    expect_same "Gzip output of plain $src does not decompress to the formatted output"
+
+    # The level is optional, so a bare -z is followed by the source
+    $executable -p kicad -z "$src" "$tmp_dir/output.gz"
+    gzip -dc "$tmp_dir/output.gz" > "$tmp_dir/output"
+    expect_same "Gzip output (default level) of plain $src does not decompress to the formatted output"
+
+    $executable --minify "$src" "$tmp_dir/expected"
+    $executable --minify "$tmp_dir/src.gz" "$tmp_dir/output"
+    expect_same "Minifying gzip compressed $src differs from minifying it directly"
+done
+
+# Concatenated gzip members decompress as one stream (Same as gunzip)
+src=./testcases/group_and_image.kicad_pcb
+head -c 1000 "$src" | gzip -c > "$tmp_dir/src.gz"
+tail -c +1001 "$src" | gzip -c >> "$tmp_dir/src.gz"
+$executable -p kicad "$src" "$tmp_dir/expected"
+$executable -p kicad "$tmp_dir/src.gz" "$tmp_dir/output"
+expect_same "Concatenated gzip members of $src differ from formatting it directly"
+
+# Check mode on gzip input
+gzip -c ./testcases/standard/flat_hierarchy_schlib_formatted.kicad_sym > "$tmp_dir/formatted.gz"
+if ! $executable -p kicad --check "$tmp_dir/formatted.gz"; then
+    echo "FAILED: Formatted gzip input reported as not formatted"
+    all_passed=false
+fi
+
+gzip -c "$src" > "$tmp_dir/unformatted.gz"
+if $executable -p kicad --check "$tmp_dir/unformatted.gz" 2> /dev/null; then
+    echo "FAILED: Unformatted gzip input reported as formatted"
+    all_passed=false
+fi
+
+# Truncated and corrupt gzip input are errors
+head -c 2000 "$tmp_dir/unformatted.gz" > "$tmp_dir/truncated.gz"
+if $executable -p kicad "$tmp_dir/truncated.gz" "$tmp_dir/output" 2> /dev/null; then
+    echo "FAILED: Truncated gzip input was not reported as an error"
+    all_passed=false
+fi
+
+{ head -c 100 "$tmp_dir/unformatted.gz"; head -c 400 /dev/zero; tail -c +501 "$tmp_dir/unformatted.gz"; } > "$tmp_dir/corrupt.gz"
+if $executable -p kicad "$tmp_dir/corrupt.gz" "$tmp_dir/output" 2> /dev/null; then
+    echo "FAILED: Corrupt gzip input was not reported as an error"
+    all_passed=false
+fi
+
+if $all_passed; then
+    echo "All gzip tests passed for $executable"
+    exit 0
+else
+    echo "Some gzip tests failed"
+    exit 1
+fi
@@ -0,0 +1,140 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Checks that sexp_prettify_kicad::PrettifyTo() matches Prettify() byte for byte without a single heap allocation.
+// The same for PrettifyChunk() and PrettifyStream with the input split into chunks of various sizes.
+// Usage: test_kicad_alloc FILE...
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include "sexp_prettify_kicad.h"
+
+namespace sexp_prettify_kicad
+{
+void Prettify(std::string &aSource, bool aCompactSave);
+}
+
+// Every heap allocation made through operator new is counted
+static std::size_t allocation_count = 0;
+
+void *operator new(std::size_t size)
+{
+    allocation_count++;
+    if (void *ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+static bool check_file(const char *path, bool compact_save)
+{
+    std::ifstream src_file(path, std::ios::binary);
+    if (!src_file.is_open())
+    {
+        fprintf(stderr, "FAILED: Could not open %s\n", path);
+        return false;
+    }
+
+    const std::string source((std::istreambuf_iterator<char>(src_file)), std::istreambuf_iterator<char>());
+    std::string expected = source;
+    sexp_prettify_kicad::Prettify(expected, compact_save);
+
+    // Output buffers are sized up front. Only the formatting itself is measured
+    std::vector<char> output(expected.size());
+    std::string output_string;
+    output_string.reserve(expected.size());
+
+    const std::size_t allocations_before = allocation_count;
+    char *output_end = sexp_prettify_kicad::PrettifyTo(std::string_view(source), output.data(), compact_save);
+    sexp_prettify_kicad::PrettifyTo(std::string_view(source), std::back_inserter(output_string), compact_save);
+    const std::size_t allocations = allocation_count - allocations_before;
+
+    bool ok = true;
+    if (std::string_view(output.data(), output_end - output.data()) != expected || output_string != expected)
+    {
+        fprintf(stderr, "FAILED: PrettifyTo() output differs from Prettify() for %s%s\n", path, compact_save ? " (compact)" : "");
+        ok = false;
+    }
+
+    if (allocations != 0)
+    {
+        fprintf(stderr, "FAILED: PrettifyTo() made %zu heap allocations for %s%s\n", allocations, path, compact_save ? " (compact)" : "");
+        ok = false;
+    }
+
+    // Chunked input (down to single bytes) and a small stream buffer so output is written out many times
+    const std::size_t chunk_sizes[] = {1, 7, 4096};
+    for (const std::size_t chunk_size : chunk_sizes)
+    {
+        std::size_t streamed_size = 0;
+        bool streamed_same = true;
+        auto write = [&](const char *buffer, std::size_t size)
+        {
+            streamed_same = streamed_same && streamed_size + size <= expected.size() && std::string_view(buffer, size) == std::string_view(expected).substr(streamed_size, size);
+            streamed_size += size;
+        };
+
+        const std::size_t allocations_before = allocation_count;
+        sexp_prettify_kicad::PrettifyState state(compact_save);
+        char *chunk_end = output.data();
+        sexp_prettify_kicad::PrettifyStream<decltype(write), 16> stream(write, compact_save);
+        for (std::size_t offset = 0; offset < source.size(); offset += chunk_size)
+        {
+            const std::string_view chunk = std::string_view(source).substr(offset, chunk_size);
+            chunk_end = sexp_prettify_kicad::PrettifyChunk(state, chunk, chunk_end);
+            stream.Feed(chunk);
+        }
+        stream.Finish();
+        const std::size_t allocations = allocation_count - allocations_before;
+
+        if (std::string_view(output.data(), chunk_end - output.data()) != expected)
+        {
+            fprintf(stderr, "FAILED: PrettifyChunk() output in %zu byte chunks differs from Prettify() for %s%s\n", chunk_size, path, compact_save ? " (compact)" : "");
+            ok = false;
+        }
+
+        if (!streamed_same || streamed_size != expected.size())
+        {
+            fprintf(stderr, "FAILED: PrettifyStream output in %zu byte chunks differs from Prettify() for %s%s\n", chunk_size, path, compact_save ? " (compact)" : "");
+            ok = false;
+        }
+
+        if (allocations != 0)
+        {
+            fprintf(stderr, "FAILED: PrettifyChunk() and PrettifyStream made %zu heap allocations for %s%s\n", allocations, path, compact_save ? " (compact)" : "");
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool all_passed = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        all_passed = check_file(argv[i], false) && all_passed;
+        all_passed = check_file(argv[i], true) && all_passed;
+    }
+
+    if (!all_passed)
+    {
+        printf("Some allocation tests failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("All allocation tests passed for sexp_prettify_kicad::PrettifyTo(), PrettifyChunk() and PrettifyStream (%d files)\n", argc - 1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Kicad stream: Formatting in chunks through PrettifyStream (-s) gives the same output as Prettify() on the whole file,
+# from files and pipes
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+for src in ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*; do
+    for profile in kicad kicad-compact; do
+        $executable -p $profile "$src" "$tmp_dir/expected"
+
+        $executable -s -p $profile "$src" "$tmp_dir/output"
+        if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+            echo "FAILED: Streamed output of $src ($profile) differs from Prettify()"
+            all_passed=false
+        fi
+
+        cat "$src" | $executable -s -p $profile - - | cat > "$tmp_dir/output"
+        if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+            echo "FAILED: Streamed output of $src ($profile) through pipes differs from Prettify()"
+            all_passed=false
+        fi
+    done
+done
+
+# Larger than the stream buffers
+./sexp_prettify_gen -s 1M -S 7 "$tmp_dir/big.kicad_pcb"
+$executable -p kicad "$tmp_dir/big.kicad_pcb" "$tmp_dir/expected"
+$executable -s -p kicad "$tmp_dir/big.kicad_pcb" "$tmp_dir/output"
+if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+    echo "FAILED: Streamed output of a generated board differs from Prettify()"
+    all_passed=false
+fi
+
+if $all_passed; then
+    echo "All stream tests passed for $executable"
+    exit 0
+else
+    echo "Some stream tests failed"
+    exit 1
+fi
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Minify: Formatting the minified file gives the same output as formatting the original, in every style
+# Also checks that minifying is idempotent and strips the formatting whitespace
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+# Zero style has no -p option
+styles=("" "-p kicad" "-p kicad-compact")
+
+for src in ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*; do
+    $executable --minify "$src" "$tmp_dir/minified"
+    $executable --minify "$tmp_dir/minified" "$tmp_dir/minified_again"
+
+    if ! cmp -s "$tmp_dir/minified" "$tmp_dir/minified_again"; then
+        echo "FAILED: Minifying $src again changed it"
+        all_passed=false
+    fi
+
+    if [ "$(stat -c %s "$tmp_dir/minified")" -ge "$(stat -c %s "$src")" ]; then
+        echo "FAILED: Minified $src is not smaller"
+        all_passed=false
+    fi
+
+    for style in "${styles[@]}"; do
+        $executable $style "$src" "$tmp_dir/expected"
+        $executable $style "$tmp_dir/minified" "$tmp_dir/output"
+
+        if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+            echo "FAILED: Formatting minified $src (${style:-zerostyle}) differs from formatting it directly"
+            all_passed=false
+        fi
+    done
+done
+
+if $all_passed; then
+    echo "All minify tests passed for $executable"
+    exit 0
+else
+    echo "Some minify tests failed"
+    exit 1
+fi
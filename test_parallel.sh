@@ -0,0 +1,55 @@
+#!/bin/bash
+# Parallel: Formatting with -j 4 splits inputs larger than a task at the root list children and gives the same output as
+# -j 1, including roots that can not be split (root level tokens that wrap, a root in compact list or shortform mode)
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+function expect_same ()
+{
+    local src=$1
+    shift
+    $executable -j 1 "$@" "$src" "$tmp_dir/expected"
+    backend=$($executable -v -j 4 "$@" "$src" "$tmp_dir/output" 2>&1)
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        echo "FAILED: -j 4 output of $(basename "$src") ($*) differs from -j 1"
+        all_passed=false
+    fi
+    if [[ "$backend" != *"mmap (parallel)"* ]]; then
+        echo "FAILED: $(basename "$src") ($*) did not use the parallel engine ($backend)"
+        all_passed=false
+    fi
+}
+
+./sexp_prettify_gen -s 4M -S 11 "$tmp_dir/minified.kicad_pcb"
+./sexp_prettify_gen -s 4M -S 12 -p kicad "$tmp_dir/formatted.kicad_pcb"
+./sexp_prettify_gen -s 4M -S 13 -p kicad-compact -l 40 "$tmp_dir/compact.kicad_pcb"
+
+# Root level tokens long enough to wrap, at the start of the root and between its children
+tokens=$(printf 'root_level_token_%02d ' $(seq 20))
+sed "s/^(kicad_pcb /(kicad_pcb $tokens/; s/(footprint /$tokens(footprint /50" "$tmp_dir/minified.kicad_pcb" > "$tmp_dir/wrapped.kicad_pcb"
+
+# Roots that put the whole file in compact list mode and in shortform mode
+sed 's/^(kicad_pcb /(pts /' "$tmp_dir/minified.kicad_pcb" > "$tmp_dir/compact_root.kicad_pcb"
+sed 's/^(kicad_pcb /(font /' "$tmp_dir/minified.kicad_pcb" > "$tmp_dir/shortform_root.kicad_pcb"
+
+# Several roots one after the other
+cat "$tmp_dir/minified.kicad_pcb" "$tmp_dir/formatted.kicad_pcb" > "$tmp_dir/two_roots.kicad_pcb"
+
+for src in "$tmp_dir"/*.kicad_pcb; do
+    expect_same "$src"
+    expect_same "$src" -p kicad
+    expect_same "$src" -p kicad-compact
+    expect_same "$src" -w 0
+done
+
+if $all_passed; then
+    echo "All parallel tests passed for $executable"
+    exit 0
+else
+    echo "Some parallel tests failed"
+    exit 1
+fi
@@ -0,0 +1,58 @@
+#!/bin/bash
+# Passthrough: Writing the unchanged stretches of a mapped source straight from the mapping gives the same output as
+# copying everything through the output buffers, and an already formatted source is passed through completely
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+function expect_same ()
+{
+    local message=$1
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        echo "FAILED: $message"
+        all_passed=false
+    fi
+}
+
+for src in ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*; do
+    for profile in kicad kicad-compact; do
+        $executable --no-passthrough -p $profile "$src" "$tmp_dir/expected"
+
+        $executable -p $profile "$src" "$tmp_dir/output"
+        expect_same "Passthrough output of $src ($profile) differs from copying it"
+
+        $executable -p $profile "$src" - | cat > "$tmp_dir/output"
+        expect_same "Passthrough output of $src ($profile) through a pipe differs from copying it"
+    done
+done
+
+# Formatted input is written from the mapping as a whole
+for src in ./testcases/standard/*; do
+    report=$($executable -v -p kicad "$src" "$tmp_dir/output" 2>&1 | grep "^Passthrough:")
+    read -r _ passed _ total _ <<< "$report"
+    if [[ -z "$passed" || "$passed" != "$total" ]]; then
+        echo "FAILED: Formatted $src was not passed through as a whole ($report)"
+        all_passed=false
+    fi
+done
+
+# Larger inputs so the spans and output buffers fill up and are written several times
+./sexp_prettify_gen -s 4M -S 5 -p kicad "$tmp_dir/formatted.kicad_pcb"
+sed '0~50{N;s/\n\t*/ /}' "$tmp_dir/formatted.kicad_pcb" > "$tmp_dir/edited.kicad_pcb"
+./sexp_prettify_gen -s 4M -S 5 "$tmp_dir/minified.kicad_pcb"
+for src in "$tmp_dir/formatted.kicad_pcb" "$tmp_dir/edited.kicad_pcb" "$tmp_dir/minified.kicad_pcb"; do
+    $executable --no-passthrough -p kicad "$src" "$tmp_dir/expected"
+    $executable -p kicad "$src" "$tmp_dir/output"
+    expect_same "Passthrough output of generated $(basename "$src") differs from copying it"
+done
+
+if $all_passed; then
+    echo "All passthrough tests passed for $executable"
+    exit 0
+else
+    echo "Some passthrough tests failed"
+    exit 1
+fi
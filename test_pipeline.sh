@@ -0,0 +1,75 @@
+#!/bin/bash
+# Pipeline: Formatting on the reader, format and writer threads gives the same output as formatting directly,
+# for any block size and count (down to single byte blocks), from files and pipes
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+# "SIZE COUNT" pairs
+blocks=("64K 8" "16 1" "7 3" "4096 2")
+
+for src in ./testcases/*.kicad_* ./testcases/standard/*; do
+    $executable -p kicad "$src" "$tmp_dir/expected"
+    $executable --minify "$src" "$tmp_dir/expected_minified"
+
+    for block in "${blocks[@]}"; do
+        read -r size count <<< "$block"
+
+        $executable -p kicad -P --block-size=$size --block-count=$count "$src" "$tmp_dir/output"
+        if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+            echo "FAILED: Pipeline (block size $size, count $count) output of $src differs from formatting it directly"
+            all_passed=false
+        fi
+
+        cat "$src" | $executable -p kicad -P --block-size=$size --block-count=$count - - | cat > "$tmp_dir/output"
+        if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+            echo "FAILED: Pipeline (block size $size, count $count) output of $src through pipes differs from formatting it directly"
+            all_passed=false
+        fi
+
+        $executable --minify -P --block-size=$size --block-count=$count "$src" "$tmp_dir/output"
+        if ! cmp -s "$tmp_dir/expected_minified" "$tmp_dir/output"; then
+            echo "FAILED: Pipeline (block size $size, count $count) minified output of $src differs from minifying it directly"
+            all_passed=false
+        fi
+    done
+done
+
+# Single byte blocks in a single block ring (Every byte is a hand over in both rings)
+src=./testcases/group_and_image.kicad_pcb
+$executable -p kicad "$src" "$tmp_dir/expected"
+$executable -p kicad -P --block-size=1 --block-count=1 "$src" "$tmp_dir/output"
+if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+    echo "FAILED: Pipeline (block size 1, count 1) output of $src differs from formatting it directly"
+    all_passed=false
+fi
+
+# Larger input so every ring wraps many times and both sides wait on each other
+./sexp_prettify_gen -s 2M -S 3 "$tmp_dir/big.kicad_pcb"
+$executable -p kicad "$tmp_dir/big.kicad_pcb" "$tmp_dir/expected"
+for block in "${blocks[@]:2}"; do
+    read -r size count <<< "$block"
+    $executable -p kicad -P --block-size=$size --block-count=$count - - < "$tmp_dir/big.kicad_pcb" > "$tmp_dir/output"
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        echo "FAILED: Pipeline (block size $size, count $count) output of a generated board differs from formatting it directly"
+        all_passed=false
+    fi
+done
+
+for option in "--block-size=0" "--block-size=1X" "--block-count=0"; do
+    if $executable -P $option "$src" "$tmp_dir/output" > /dev/null 2>&1; then
+        echo "FAILED: '$option' was accepted"
+        all_passed=false
+    fi
+done
+
+if $all_passed; then
+    echo "All pipeline tests passed for $executable"
+    exit 0
+else
+    echo "Some pipeline tests failed"
+    exit 1
+fi
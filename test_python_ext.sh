@@ -0,0 +1,107 @@
+#!/bin/bash
+# Python extension: _sexp_prettify gives the same output as the pure Python prettify() and minify() of sexp_prettify_cli.py
+# for str, bytes and other buffer input and for non default settings, and sexp_prettify_cli.py picks it up when importable.
+# Text the extension would format differently (columns in code points, non-ASCII whitespace) still matches through sexp_prettify_cli.py
+
+if ! python3 -c "import _sexp_prettify" 2> /dev/null; then
+    echo "Skipped python extension tests: _sexp_prettify is not built (make python)"
+    exit 0
+fi
+
+all_passed=true
+
+if ! python3 - << 'EOF'
+import glob
+import sys
+
+import _sexp_prettify
+import sexp_prettify_cli
+
+passed = True
+
+settings = [
+    {},
+    {"compact_save": True},
+    {"indent_char": " ", "indent_size": 2, "consecutive_token_wrap_threshold": 0, "compact_list_column_limit": 0},
+    {"compact_save": True, "compact_list_prefixes": ["pts", "xy"], "shortform_prefixes": ("at", "size")},
+    {"compact_list_prefixes": set(), "consecutive_token_wrap_threshold": 20},
+]
+
+for path in sorted(glob.glob("./testcases/*.kicad_*") + glob.glob("./testcases/standard/*")):
+    with open(path, "r", encoding="utf-8") as f:
+        source = f.read()
+
+    for kwargs in settings:
+        expected = sexp_prettify_cli.python_prettify(source, **kwargs)
+        if _sexp_prettify.prettify(source, **kwargs) != expected:
+            print(f"FAILED: prettify() of {path} with {kwargs} differs from the pure Python version")
+            passed = False
+
+        for source_bytes in (source.encode(), bytearray(source.encode()), memoryview(source.encode())):
+            if _sexp_prettify.prettify(source_bytes, **kwargs) != expected.encode():
+                print(f"FAILED: prettify() of {path} as {type(source_bytes).__name__} with {kwargs} differs from the pure Python version")
+                passed = False
+
+    expected = sexp_prettify_cli.python_minify(source)
+    if _sexp_prettify.minify(source) != expected or _sexp_prettify.minify(source.encode()) != expected.encode():
+        print(f"FAILED: minify() of {path} differs from the pure Python version")
+        passed = False
+
+if sexp_prettify_cli.prettify is sexp_prettify_cli.python_prettify or sexp_prettify_cli.minify is sexp_prettify_cli.python_minify:
+    print("FAILED: sexp_prettify_cli.py does not use the extension module")
+    passed = False
+
+# Columns count code points in the pure Python version (This wraps after 7 tokens there and after 4 counting UTF-8 bytes),
+# and str.isspace() also takes non-ASCII whitespace and the \x1c-\x1f separators
+non_ascii = [
+    "(a " + " ".join(["é" * 10] * 12) + ")",
+    "(a (b \u00a0c)\u2003(d\u3000e))",
+    "(a\x1cb (c\x1fd) \x1d(e))",
+    "(a (b \"é (quoted)\")\n\t(c 名前 (d)))",
+]
+for source in non_ascii:
+    for kwargs in settings:
+        if sexp_prettify_cli.prettify(source, **kwargs) != sexp_prettify_cli.python_prettify(source, **kwargs):
+            print(f"FAILED: prettify() of {source!r} with {kwargs} differs from the pure Python version")
+            passed = False
+
+    if sexp_prettify_cli.minify(source) != sexp_prettify_cli.python_minify(source):
+        print(f"FAILED: minify() of {source!r} differs from the pure Python version")
+        passed = False
+
+for kwargs in ({"indent_size": 0}, {"indent_char": "é"}, {"compact_list_prefixes": [1]}, {"compact_list_prefixes": ["x" * 1000]}):
+    try:
+        _sexp_prettify.prettify("(a)", **kwargs)
+        print(f"FAILED: prettify() accepted {kwargs}")
+        passed = False
+    except (TypeError, ValueError):
+        pass
+
+sys.exit(0 if passed else 1)
+EOF
+then
+    all_passed=false
+fi
+
+# The cli gives the same output with and without the extension module
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+python3 -c 'print("(a " + " ".join(["é" * 10] * 12) + ")")' > "$tmp_dir/non_ascii.kicad_sym"
+
+for src in ./testcases/*.kicad_* "$tmp_dir/non_ascii.kicad_sym"; do
+    SEXP_PRETTIFY_PURE_PYTHON=1 ./sexp_prettify_cli.py -p kicad-compact "$src" "$tmp_dir/expected"
+    ./sexp_prettify_cli.py -p kicad-compact "$src" "$tmp_dir/output"
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        echo "FAILED: sexp_prettify_cli.py output of $src differs with the extension module"
+        all_passed=false
+    fi
+done
+
+if $all_passed; then
+    echo "All python extension tests passed for _sexp_prettify"
+    exit 0
+else
+    echo "Some python extension tests failed"
+    exit 1
+fi
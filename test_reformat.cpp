@@ -0,0 +1,222 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Checks that sexp_prettify_reformat() matches formatting the edited input from scratch byte for byte for every profile.
+// Each file goes through rounds of random (seeded) edits, each round reformatting from the output and checkpoints of the
+// round before, with few checkpoints (so they thin out) and with plenty of them.
+// Usage: test_reformat FILE...
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "sexp_prettify.h"
+
+typedef enum styleProfile
+{
+    STYLE_PROFILE_NONE = 0,
+    STYLE_PROFILE_KICAD_STANDARD,
+    STYLE_PROFILE_KICAD_COMPACT,
+} styleProfile;
+
+const char *style_profile_names[] = {"zerostyle", "kicad", "kicad-compact"};
+
+const char *compact_list_prefixes_kicad[] = {"pts"};
+const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad) / sizeof(compact_list_prefixes_kicad[0]);
+
+const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
+
+// Inserted text. Some keep the structure, some change the state every following root child starts from
+const char *edit_snippets[] = {
+    "", " ", "\n", "\t", "(", ")", "\"", "\\", "token", " 1.27 ", "(at 1 2)", "(pts (xy 1 2) (xy 3 4))", "(font (size 1 1))", "(stroke (width 0.1) (type solid))", "\"quoted (text)\"", "((",
+    "))",
+};
+const int edit_snippets_size = sizeof(edit_snippets) / sizeof(edit_snippets[0]);
+
+#define REFORMAT_ROUNDS 40
+#define REFORMAT_MAX_EDITS 4
+#define REFORMAT_SINK_SIZE 61
+
+static void string_flush_handler(PrettifySExprSink *sink, void *context)
+{
+    static_cast<std::string *>(context)->append(sink->buffer, sink->count);
+}
+
+static PrettifySExprState profile_state(styleProfile profile)
+{
+    PrettifySExprState state = {0};
+    sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+
+    if (profile == STYLE_PROFILE_KICAD_STANDARD || profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_compact_list_set(&state, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+    }
+
+    if (profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_shortform_set(&state, shortform_prefixes_kicad, shortform_prefixes_kicad_size);
+    }
+
+    return state;
+}
+
+static std::string fresh_prettify(const PrettifySExprState &config, const std::string &src)
+{
+    PrettifySExprState state = config;
+    std::string out;
+    char buffer[REFORMAT_SINK_SIZE];
+    PrettifySExprSink sink;
+    sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), string_flush_handler, &out);
+    sexp_prettify_buffer_to_sink(&state, src.data(), src.size(), &sink);
+    sexp_prettify_sink_flush(&sink);
+    return out;
+}
+
+static uint64_t xorshift64(uint64_t *random)
+{
+    *random ^= *random << 13;
+    *random ^= *random >> 7;
+    *random ^= *random << 17;
+    return *random;
+}
+
+// Sorted, not overlapping edits of src. Returns the edited input
+static std::string random_edits(const std::string &src, uint64_t *random, std::vector<PrettifySExprEdit> &edits)
+{
+    std::vector<size_t> offsets(1 + xorshift64(random) % REFORMAT_MAX_EDITS);
+    for (size_t &offset : offsets)
+    {
+        offset = xorshift64(random) % (src.size() + 1);
+    }
+    std::sort(offsets.begin(), offsets.end());
+
+    std::string edited;
+    size_t copied = 0;
+    edits.clear();
+    for (const size_t offset : offsets)
+    {
+        if (offset < copied)
+        {
+            continue;
+        }
+
+        // Removes up to a few dozen bytes, or reinserts a slice of the source (moving whole lists around)
+        const size_t removable = src.size() - offset;
+        const size_t src_size = removable ? xorshift64(random) % (removable < 40 ? removable + 1 : 40) : 0;
+        std::string inserted = edit_snippets[xorshift64(random) % edit_snippets_size];
+        if (xorshift64(random) % 4 == 0)
+        {
+            const size_t from = xorshift64(random) % (src.size() + 1);
+            inserted = src.substr(from, xorshift64(random) % 200);
+        }
+
+        edited.append(src, copied, offset - copied);
+        edited.append(inserted);
+        copied = offset + src_size;
+        edits.push_back({offset, src_size, inserted.size()});
+    }
+    edited.append(src, copied, std::string::npos);
+    return edited;
+}
+
+static bool check_profile(const char *path, const std::string &original, styleProfile profile, size_t checkpoint_capacity, uint64_t seed)
+{
+    const PrettifySExprState config = profile_state(profile);
+    std::vector<PrettifySExprCheckpoint> entries[2] = {std::vector<PrettifySExprCheckpoint>(checkpoint_capacity), std::vector<PrettifySExprCheckpoint>(checkpoint_capacity)};
+    PrettifySExprCheckpoints checkpoints[2];
+    sexp_prettify_checkpoints_init(&checkpoints[0], entries[0].data(), checkpoint_capacity);
+    sexp_prettify_checkpoints_init(&checkpoints[1], entries[1].data(), checkpoint_capacity);
+
+    std::string src = original;
+    std::string dst;
+    char buffer[REFORMAT_SINK_SIZE];
+    PrettifySExprSink sink;
+    PrettifySExprState state = config;
+    sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), string_flush_handler, &dst);
+    sexp_prettify_buffer_checkpointed(&state, src.data(), src.size(), &sink, &checkpoints[0]);
+    sexp_prettify_sink_flush(&sink);
+
+    if (dst != fresh_prettify(config, src))
+    {
+        fprintf(stderr, "FAILED: Checkpointed output differs from sexp_prettify_buffer_to_sink() for %s (%s)\n", path, style_profile_names[profile]);
+        return false;
+    }
+
+    uint64_t random = seed;
+    std::vector<PrettifySExprEdit> edits;
+    for (int round = 0; round < REFORMAT_ROUNDS; round++)
+    {
+        const PrettifySExprCheckpoints &prev_checkpoints = checkpoints[round % 2];
+        PrettifySExprCheckpoints &next_checkpoints = checkpoints[(round + 1) % 2];
+
+        const std::string edited = random_edits(src, &random, edits);
+        std::string output;
+        sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), string_flush_handler, &output);
+        if (!sexp_prettify_reformat(&config, edited.data(), edited.size(), dst.data(), dst.size(), &prev_checkpoints, edits.data(), edits.size(), &sink, &next_checkpoints))
+        {
+            fprintf(stderr, "FAILED: Reformat rejected sorted edits for %s (%s, round %d)\n", path, style_profile_names[profile], round);
+            return false;
+        }
+        sexp_prettify_sink_flush(&sink);
+
+        const std::string expected = fresh_prettify(config, edited);
+        if (output != expected)
+        {
+            fprintf(stderr, "FAILED: Reformat output differs from formatting from scratch for %s (%s, %zu checkpoints, seed %llu, round %d)\n", path, style_profile_names[profile], checkpoint_capacity,
+                    (unsigned long long)seed, round);
+            return false;
+        }
+
+        src = edited;
+        dst = output;
+    }
+
+    // Overlapping edits are rejected without writing anything
+    const PrettifySExprEdit overlapping[] = {{0, 2, 0}, {1, 0, 0}};
+    std::string output;
+    sexp_prettify_sink_init(&sink, buffer, sizeof(buffer), string_flush_handler, &output);
+    if (sexp_prettify_reformat(&config, src.data(), src.size(), dst.data(), dst.size(), &checkpoints[REFORMAT_ROUNDS % 2], overlapping, 2, &sink, &checkpoints[(REFORMAT_ROUNDS + 1) % 2]) || sink.count != 0)
+    {
+        fprintf(stderr, "FAILED: Reformat accepted overlapping edits for %s (%s)\n", path, style_profile_names[profile]);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool all_passed = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::ifstream src_file(argv[i], std::ios::binary);
+        if (!src_file.is_open())
+        {
+            fprintf(stderr, "FAILED: Could not open %s\n", argv[i]);
+            all_passed = false;
+            continue;
+        }
+
+        const std::string src((std::istreambuf_iterator<char>(src_file)), std::istreambuf_iterator<char>());
+        for (int profile = STYLE_PROFILE_NONE; profile <= STYLE_PROFILE_KICAD_COMPACT; profile++)
+        {
+            all_passed = check_profile(argv[i], src, (styleProfile)profile, 4, 0x9E3779B97F4A7C15ULL + i) && all_passed;
+            all_passed = check_profile(argv[i], src, (styleProfile)profile, 4096, 0xD1B54A32D192ED03ULL + i) && all_passed;
+        }
+    }
+
+    if (!all_passed)
+    {
+        printf("Some reformat tests failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("All reformat tests passed for sexp_prettify_reformat() (%d files)\n", argc - 1);
+    return EXIT_SUCCESS;
+}
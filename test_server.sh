@@ -0,0 +1,215 @@
+#!/bin/bash
+# Server: sexp_prettify_client formats through sexp_prettify_cli --serve with the same output and exit codes as running
+# the cli directly, for every option it mirrors, for payload and path requests and for several clients at once
+
+executable=$1
+client=./sexp_prettify_client
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+socket="$tmp_dir/server.sock"
+server_pid=
+
+function cleanup ()
+{
+    if [[ -n "$server_pid" ]]; then
+        kill "$server_pid" 2>/dev/null
+        wait "$server_pid" 2>/dev/null
+    fi
+    rm -rf "$tmp_dir"
+}
+trap cleanup EXIT
+
+function fail ()
+{
+    echo "FAILED: $1"
+    all_passed=false
+}
+
+function expect_same ()
+{
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output"; then
+        fail "$1"
+    fi
+}
+
+function start_server ()
+{
+    $executable -j 2 --serve="$socket" 2> "$tmp_dir/server.log" &
+    server_pid=$!
+    for _ in $(seq 100); do
+        [[ -S "$socket" ]] && return 0
+        sleep 0.05
+    done
+    fail "Server did not start listening on $socket"
+    return 1
+}
+
+# Without a server the client fails cleanly
+if $client --socket="$socket" ./testcases/standard/$(ls ./testcases/standard | head -1) > /dev/null 2>&1; then
+    fail "Client succeeded without a server"
+fi
+
+start_server || exit 1
+
+# Only one server per socket
+if $executable --serve="$socket" 2> /dev/null; then
+    fail "Second server started on a socket in use"
+fi
+
+options=("" "-p kicad" "-p kicad-compact" "-w 0" "-p kicad -k 0" "-l pts -s font -s stroke" "-p kicad -l xy -s at" "-l pts -p kicad-compact" "-m")
+for src in ./testcases/*.kicad_* ./testcases/standard/* ./testcases/compact/*; do
+    for option in "${options[@]}"; do
+        $executable $option "$src" "$tmp_dir/expected"
+
+        $client --socket="$socket" $option "$src" "$tmp_dir/output"
+        expect_same "Client output of $src ($option) differs from the cli"
+
+        $client --socket="$socket" $option --send-path "$src" "$tmp_dir/output"
+        expect_same "Client output of $src by path ($option) differs from the cli"
+
+        $client --socket="$socket" $option - < "$src" > "$tmp_dir/output"
+        expect_same "Client output of $src from standard input ($option) differs from the cli"
+    done
+
+    for profile in kicad kicad-compact; do
+        $executable -p $profile --check "$src" 2> "$tmp_dir/expected"
+        expected_status=$?
+        $client --socket="$socket" -p $profile --check "$src" 2> "$tmp_dir/output"
+        status=$?
+        if [[ $status != "$expected_status" ]]; then
+            fail "Client check of $src ($profile) exited with $status instead of $expected_status"
+        fi
+        expect_same "Client check report of $src ($profile) differs from the cli"
+    done
+done
+
+# Several clients at once, each on its own connections
+./sexp_prettify_gen -s 256K -S 7 "$tmp_dir/generated.kicad_pcb"
+$executable -p kicad "$tmp_dir/generated.kicad_pcb" "$tmp_dir/expected"
+for i in $(seq 8); do
+    $client --socket="$socket" -p kicad --repeat=5 "$tmp_dir/generated.kicad_pcb" "$tmp_dir/output.$i" 2> /dev/null &
+done
+wait $(jobs -p | grep -v "^$server_pid$")
+for i in $(seq 8); do
+    if ! cmp -s "$tmp_dir/expected" "$tmp_dir/output.$i"; then
+        fail "Output of concurrent client $i differs from the cli"
+    fi
+done
+
+# Idle connections do not hold on to a worker. More clients than workers stay connected while another client is served,
+# and each of them is still served once it sends a request
+python3 - "$socket" "$tmp_dir/idle_ready" "$tmp_dir/idle_done" << 'EOF' &
+import os
+import socket
+import struct
+import sys
+import time
+
+socket_path, ready_path, done_path = sys.argv[1:]
+
+def recv_exactly(connection, size):
+    data = b""
+    while len(data) < size:
+        chunk = connection.recv(size - len(data))
+        if not chunk:
+            sys.exit(1)
+        data += chunk
+    return data
+
+connections = []
+for _ in range(6):
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(socket_path)
+    connections.append(connection)
+open(ready_path, "w").close()
+
+while not os.path.exists(done_path):
+    time.sleep(0.01)
+
+# Server stats request on each connection
+for connection in connections:
+    connection.sendall(struct.pack("=IBBBBiiHHIQ", 0x31525853, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0))
+    magic, status, size = struct.unpack("=IIQ", recv_exactly(connection, 48)[:16])
+    recv_exactly(connection, size)
+    if magic != 0x31415853 or status != 0:
+        sys.exit(1)
+EOF
+idle_pid=$!
+for _ in $(seq 100); do
+    [[ -e "$tmp_dir/idle_ready" ]] && break
+    sleep 0.05
+done
+
+if ! timeout 5 $client --socket="$socket" -p kicad "$tmp_dir/generated.kicad_pcb" "$tmp_dir/output"; then
+    fail "Client was not served while idle connections outnumber the workers"
+fi
+expect_same "Output next to idle connections differs from the cli"
+
+touch "$tmp_dir/idle_done"
+if ! wait $idle_pid; then
+    fail "Idle connections were not served once they sent a request"
+fi
+
+# Errors are reported without taking the server down
+if $client --socket="$socket" --send-path "$tmp_dir" > /dev/null 2> "$tmp_dir/error"; then
+    fail "Client succeeded on a directory"
+fi
+if ! grep -q "^Server error: Not a regular file" "$tmp_dir/error"; then
+    fail "Directory was not reported as a server error"
+fi
+
+# A path request for a file that is truncated while being formatted does not take the server down
+./sexp_prettify_gen -s 4M -S 8 "$tmp_dir/large.kicad_pcb"
+for _ in $(seq 30); do
+    cp "$tmp_dir/large.kicad_pcb" "$tmp_dir/truncated.kicad_pcb"
+    $client --socket="$socket" --send-path --repeat=3 "$tmp_dir/truncated.kicad_pcb" /dev/null 2> /dev/null &
+    sleep 0.01
+    : > "$tmp_dir/truncated.kicad_pcb"
+    wait $!
+done
+if ! kill -0 "$server_pid" 2> /dev/null; then
+    fail "Server died on a path request for a file truncated meanwhile"
+    exit 1
+fi
+
+# Latency percentiles of repeated requests and of the server
+report=$($client --socket="$socket" -p kicad --check --repeat=20 ./testcases/standard/$(ls ./testcases/standard | head -1) 2>&1)
+if ! grep -q "^Round trip: 20 requests, latency p50 .* us, p99 .* us" <<< "$report"; then
+    fail "Repeated requests did not report their latency ($report)"
+fi
+
+report=$($client --socket="$socket" --server-stats)
+if ! grep -q "^Server: [0-9]* requests, 1 failed, .* latency p50 .* us, p99 .* us" <<< "$report"; then
+    fail "Server stats are missing the request count or latency ($report)"
+fi
+
+# Stopping prints the summary and removes the socket
+kill -TERM "$server_pid"
+wait "$server_pid"
+status=$?
+server_pid=
+if [[ $status != 0 || -e "$socket" ]]; then
+    fail "Server did not stop cleanly on SIGTERM (status $status)"
+fi
+if ! grep -q "^Server: [0-9]* requests" "$tmp_dir/server.log"; then
+    fail "Server did not print its summary when stopped"
+fi
+
+# The socket file left behind by a killed server is replaced
+start_server || exit 1
+kill -KILL "$server_pid"
+wait "$server_pid" 2>/dev/null
+server_pid=
+start_server || exit 1
+if ! $client --socket="$socket" --server-stats > /dev/null; then
+    fail "Server did not replace the socket file of a killed server"
+fi
+
+if $all_passed; then
+    echo "All server tests passed for $executable"
+    exit 0
+else
+    echo "Some server tests failed"
+    exit 1
+fi
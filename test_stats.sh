@@ -0,0 +1,33 @@
+#!/bin/bash
+# Statistics: Byte and line counters agree with the formatted output and the json form parses
+
+executable=$1
+
+all_passed=true
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+for src in ./testcases/*.kicad_*; do
+    $executable -p kicad-compact --stats=json "$src" "$tmp_dir/output" 2> "$tmp_dir/stats.json"
+
+    if ! python3 -m json.tool "$tmp_dir/stats.json" > /dev/null; then
+        echo "FAILED: Stats for $src are not valid json"
+        all_passed=false
+        continue
+    fi
+
+    counters=$(python3 -c 'import json,sys; s=json.load(open(sys.argv[1])); print(s["input_bytes"], s["output_bytes"], s["lines"])' "$tmp_dir/stats.json")
+    expected="$(stat -c %s "$src") $(stat -c %s "$tmp_dir/output") $(wc -l < "$tmp_dir/output")"
+    if [ "$counters" != "$expected" ]; then
+        echo "FAILED: Stats for $src counted '$counters' (expected '$expected')"
+        all_passed=false
+    fi
+done
+
+if $all_passed; then
+    echo "All stats tests passed for $executable"
+    exit 0
+else
+    echo "Some stats tests failed"
+    exit 1
+fi
@@ -0,0 +1,154 @@
+// KiCADv8 Style Prettify S-Expression Formatter (sexp formatter)
+// By Brian Khuu, 2024
+// Checks that the template engine in sexp_prettify_template.h matches sexp_prettify() byte for byte for every profile,
+// both with the compile time profiles and the run time profile, and when fed in small chunks through a small buffer sink.
+// Usage: test_template_engine FILE...
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "sexp_prettify_template.h"
+
+typedef enum styleProfile
+{
+    STYLE_PROFILE_NONE = 0,
+    STYLE_PROFILE_KICAD_STANDARD,
+    STYLE_PROFILE_KICAD_COMPACT,
+} styleProfile;
+
+const char *style_profile_names[] = {"zerostyle", "kicad", "kicad-compact"};
+
+const char *compact_list_prefixes_kicad[] = {"pts"};
+const int compact_list_prefixes_kicad_size = sizeof(compact_list_prefixes_kicad) / sizeof(compact_list_prefixes_kicad[0]);
+
+const char *shortform_prefixes_kicad[] = {"font", "stroke", "fill", "offset", "rotate", "scale"};
+const int shortform_prefixes_kicad_size = sizeof(shortform_prefixes_kicad) / sizeof(shortform_prefixes_kicad[0]);
+
+static std::string c_prettify(const std::string &src, styleProfile profile)
+{
+    PrettifySExprState state = {0};
+    sexp_prettify_init(&state, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_CHAR, PRETTIFY_SEXPR_KICAD_DEFAULT_INDENT_SIZE, PRETTIFY_SEXPR_KICAD_DEFAULT_CONSECUTIVE_TOKEN_WRAP_THRESHOLD);
+
+    if (profile == STYLE_PROFILE_KICAD_STANDARD || profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_compact_list_set(&state, compact_list_prefixes_kicad, compact_list_prefixes_kicad_size, PRETTIFY_SEXPR_KICAD_DEFAULT_COMPACT_LIST_COLUMN_LIMIT);
+    }
+
+    if (profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        sexp_prettify_shortform_set(&state, shortform_prefixes_kicad, shortform_prefixes_kicad_size);
+    }
+
+    std::string out;
+    auto putc_handler = [](char c, void *context) { static_cast<std::string *>(context)->push_back(c); };
+    for (const char c : src)
+    {
+        sexp_prettify(&state, c, putc_handler, &out);
+    }
+    return out;
+}
+
+static sexp_prettify_template::RuntimeProfile runtime_profile(styleProfile profile)
+{
+    sexp_prettify_template::RuntimeProfile runtime;
+
+    if (profile == STYLE_PROFILE_KICAD_STANDARD || profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        for (const char *prefix : compact_list_prefixes_kicad)
+        {
+            runtime.compact_list_add(prefix);
+        }
+    }
+
+    if (profile == STYLE_PROFILE_KICAD_COMPACT)
+    {
+        for (const char *prefix : shortform_prefixes_kicad)
+        {
+            runtime.shortform_add(prefix);
+        }
+    }
+
+    return runtime;
+}
+
+template <typename Profile> static std::string template_prettify(const std::string &src, const Profile &profile)
+{
+    std::string out;
+    sexp_prettify_template::prettify(std::string_view(src), std::back_inserter(out), profile);
+    return out;
+}
+
+// Odd sized input chunks through a sink that flushes every few bytes
+template <typename Profile> static std::string template_prettify_chunked(const std::string &src, const Profile &profile)
+{
+    std::string out;
+    auto flush_handler = [&out](const char *buffer, size_t size) { out.append(buffer, size); };
+    sexp_prettify_template::BufferSink<decltype(flush_handler), 5> sink(flush_handler);
+    sexp_prettify_template::Formatter<Profile, decltype(sink)> formatter(sink, profile);
+
+    const std::string_view src_view(src);
+    for (size_t i = 0; i < src_view.size(); i += 7)
+    {
+        formatter.feed(src_view.substr(i, 7));
+    }
+
+    sink.flush();
+    return out;
+}
+
+static bool check_output(const char *path, styleProfile profile, const char *engine, const std::string &expected, const std::string &output)
+{
+    if (output == expected)
+    {
+        return true;
+    }
+
+    fprintf(stderr, "FAILED: %s output differs from sexp_prettify() for %s (%s)\n", engine, path, style_profile_names[profile]);
+    return false;
+}
+
+template <typename Profile> static bool check_profile(const char *path, const std::string &src, styleProfile profile)
+{
+    const std::string expected = c_prettify(src, profile);
+    const sexp_prettify_template::RuntimeProfile runtime = runtime_profile(profile);
+
+    bool ok = true;
+    ok = check_output(path, profile, "template", expected, template_prettify(src, Profile())) && ok;
+    ok = check_output(path, profile, "template chunked", expected, template_prettify_chunked(src, Profile())) && ok;
+    ok = check_output(path, profile, "template runtime", expected, template_prettify(src, runtime)) && ok;
+    ok = check_output(path, profile, "template runtime chunked", expected, template_prettify_chunked(src, runtime)) && ok;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool all_passed = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::ifstream src_file(argv[i], std::ios::binary);
+        if (!src_file.is_open())
+        {
+            fprintf(stderr, "FAILED: Could not open %s\n", argv[i]);
+            all_passed = false;
+            continue;
+        }
+
+        const std::string src((std::istreambuf_iterator<char>(src_file)), std::istreambuf_iterator<char>());
+        all_passed = check_profile<sexp_prettify_template::ZeroStyleProfile>(argv[i], src, STYLE_PROFILE_NONE) && all_passed;
+        all_passed = check_profile<sexp_prettify_template::KicadProfile>(argv[i], src, STYLE_PROFILE_KICAD_STANDARD) && all_passed;
+        all_passed = check_profile<sexp_prettify_template::KicadCompactProfile>(argv[i], src, STYLE_PROFILE_KICAD_COMPACT) && all_passed;
+    }
+
+    if (!all_passed)
+    {
+        printf("Some template engine tests failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("All template engine tests passed for sexp_prettify_template.h (%d files)\n", argc - 1);
+    return EXIT_SUCCESS;
+}